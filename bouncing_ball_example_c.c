@@ -83,6 +83,13 @@ hyb_bool BouncingBall_flow_set(hyb_float t, hyb_float j, const hyb_float *x, con
   return x[0] >= 0 ? hyb_true : hyb_false;
 }
 
+/**
+ * @brief Jump guard for the bouncing ball: the height of the ball
+ */
+hyb_float BouncingBall_guard(hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  return x[0];
+}
+
 /**
  * @brief Output map for the bouncing ball
  */
@@ -104,5 +111,6 @@ hyb_opts options = {
   BouncingBall_jump_map,  /**< Jump Map */
   BouncingBall_out_map,   /**< Output Map */
   BouncingBall_jump_set,  /**< Jump Set */
-  BouncingBall_flow_set   /**< Flow Set */
+  BouncingBall_flow_set,  /**< Flow Set */
+  BouncingBall_guard      /**< Jump Guard */
 };
@@ -21,12 +21,17 @@ function model = idnlhybrid(modelname, order, params, ts, varargin)
   addParameter(p, 'path', current_path, validModelName);
   addParameter(p, 'jumpLogic', 'D', validJumpCond);
   addParameter(p, 'forceCompile', false, validBool);
+  addParameter(p, 'stats', false, validBool);
 
   parse(p, modelname, order, params, ts, varargin{:});
   args = p.Results;
 
   % Checking sources and compiling
   model_source = fullfile(pwd(), sprintf('%s.c', args.modelname));
+  if ~exist(model_source, 'file') && exist(fullfile(pwd(), sprintf('%s.cpp', args.modelname)), 'file')
+    % C++ models (libhybrid.hpp) are compiled as a separate unit
+    model_source = fullfile(pwd(), sprintf('%s.cpp', args.modelname));
+  end
   if idnlhybrid_check_sources(model_source, args) || args.forceCompile
     idnlhybrid_compile(model_source, args);
   end
@@ -78,9 +83,15 @@ function compile = idnlhybrid_check_sources(model_source, args)
   sources = { ...
     model_source, ...
     sprintf('%s/libhybrid.h', args.path), ...
+    sprintf('%s/libhybrid_stats.h', args.path), ...
     sprintf('%s/libhybrid.c', args.path), ...
-    sprintf('%s/librk4/librk4.h', args.path), ...
-    sprintf('%s/librk4/librk4.c', args.path), ...
+    sprintf('%s/libhybrid.hpp', args.path), ...
+    sprintf('%s/libhybrid_model.h', args.path), ...
+    sprintf('%s/libhybrid_model.c', args.path), ...
+    sprintf('%s/libhybrid_estim.h', args.path), ...
+    sprintf('%s/libhybrid_estim.c', args.path), ...
+    sprintf('%s/libhybrid_parallel.h', args.path), ...
+    sprintf('%s/libhybrid_parallel.c', args.path), ...
     sprintf('%s/mex_wrapper.c', args.path), ...
   };
   object_dir = dir(sprintf('%s.%s', args.modelname, mexext()));
@@ -107,17 +118,45 @@ function idnlhybrid_compile(model_source, args)
     jump_logic = 2;
   end
 
-  source_librk4 = sprintf('%s/librk4/librk4.c', args.path);
   source_libhybrid = sprintf('%s/libhybrid.c', args.path);
   source_mexwrapper = sprintf('%s/mex_wrapper.c', args.path);
+  source_model = sprintf('%s/libhybrid_model.c', args.path);
+  % The estimator (model('estimate', ...)) runs on the POSIX thread pool,
+  % thus it is compiled only where POSIX threads are available
+  source_estim = {};
+  estim_define = {};
+  thread_lib = {};
+  if isunix()
+    source_estim = { ...
+      sprintf('%s/libhybrid_estim.c', args.path), ...
+      sprintf('%s/libhybrid_parallel.c', args.path) };
+    estim_define = {'-DHYB_MEX_ESTIMATE'};
+    thread_lib = {'-lpthread'};
+  end
   include_dir_libhybrid = sprintf('-I%s', args.path);
-  include_dir_librk4 = sprintf('-I%s/librk4', args.path);
 
-  mex('-v', include_dir_libhybrid, include_dir_librk4, ...
+  [~, ~, model_ext] = fileparts(model_source);
+  if strcmp(model_ext, '.cpp')
+    model_define = '-DHYB_MODEL_EXTERN';
+    model_unit = {model_source};
+  else
+    model_define = sprintf('-DHYB_MODEL_SOURCE="\\"%s\\""', model_source);
+    model_unit = {};
+  end
+
+  % Runtime statistics (model('stats')) are compiled only on request
+  stats_define = {};
+  if args.stats
+    stats_define = {'-DHYB_STATS'};
+  end
+
+  mex('-v', include_dir_libhybrid, ...
       '-DMATLAB_WRAPPER', ...
+      stats_define{:}, estim_define{:}, ...
       '-DMATLAB_SYSTEM_IDENTIFICATION', ...
-      sprintf('-DHYB_MODEL_SOURCE="\\"%s\\""', model_source), ...
+      model_define, ...
       sprintf('-DHYB_JUMP_LOGIC=%d', jump_logic), ...
-      source_librk4, source_libhybrid, source_mexwrapper, ...
+      source_libhybrid, source_mexwrapper, model_unit{:}, ...
+      source_model, source_estim{:}, thread_lib{:}, ...
       '-output', args.modelname);
 end
@@ -27,19 +27,142 @@
  */
 
 #include "libhybrid.h"
+#include "libhybrid_stats.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <stdint.h>
 
-hyb_errorcode hyb_main_loop(hyb_opts *opts, hyb_float *y, hyb_float *xp, hyb_float tau, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+/**
+ * @brief Time of the k-th sample of an input signal
+ */
+static inline hyb_float hyb_input_time(const hyb_input *in, size_t k) {
+  return in->t ? in->t[k] : in->t0 + (hyb_float) k * in->dt;
+}
 
-  opts->Y(y, x[0], x[1], x + 2, u, p);
+/**
+ * @brief Sample interval of the attached input signal at the time t
+ *
+ * Returns k and the normalized time s in [t_k, t_k+1]. A time on a sample
+ * (within HYB_INPUT_TOL) selects the interval that starts there (s = 0), or
+ * the one that ends there (s = 1) if left is set. Before the first sample
+ * the result is (0, 0), after the last one (length - 1, 0).
+ */
+static size_t hyb_input_find(hyb_workspace *ws, hyb_float t, hyb_bool left, hyb_float *s) {
+  const hyb_input *in = ws->input;
+  const size_t last = in->length - 1;
+  size_t k;
+  hyb_float r;
+  if (in->t) {
+    k = ws->u_k < last ? ws->u_k : last - 1;
+    while (k + 1 < last && t >= in->t[k + 1])
+      k++;
+    while (k > 0 && t < in->t[k])
+      k--;
+    r = (t - in->t[k]) / (in->t[k + 1] - in->t[k]);
+  } else {
+    r = (t - in->t0) / in->dt;
+    k = r <= 0.0 ? 0 : (r >= (hyb_float) last ? last - 1 : (size_t) r);
+    r -= (hyb_float) k;
+  }
 
-  if (x[0] >= opts->T_horizon)
-    return HYB_TLIMIT;
-  if (x[1] >= opts->J_horizon)
-    return HYB_JLIMIT;
+  *s = 0.0;
+  if (r >= 1.0 - HYB_INPUT_TOL) {
+    if (r > 1.0 + HYB_INPUT_TOL)
+      return last;
+    if (left) {
+      *s = 1.0;
+      return k;
+    }
+    return k + 1;
+  }
+  if (r <= HYB_INPUT_TOL) {
+    if (left && k > 0 && r >= -HYB_INPUT_TOL) {
+      *s = 1.0;
+      return k - 1;
+    }
+    return k;
+  }
+  *s = r;
+  return k;
+}
+
+/**
+ * @brief Evaluates the attached input signal at the time t
+ *
+ * The value is cached, since all the callbacks at the same time share it.
+ * Samples are returned without copies whenever the hold allows it.
+ */
+static const hyb_float *hyb_input_eval(hyb_workspace *ws, hyb_float t, hyb_bool left) {
+  if (ws->u_val && ws->u_t == t && ws->u_left == left)
+    return ws->u_val;
+
+  const hyb_input *in = ws->input;
+  const size_t n = in->u_size;
+  const size_t stride = in->stride ? in->stride : n;
+  const size_t last = in->length - 1;
+  hyb_float s = 0.0;
+  const size_t k = last > 0 ? hyb_input_find(ws, t, left, &s) : 0;
+  const hyb_float *u0 = in->u + k * stride;
+
+  ws->u_k = k < last ? k : (last > 0 ? last - 1 : 0);
+  ws->u_t = t;
+  ws->u_left = left;
+  if (in->hold == HYB_ZOH || s == 0.0) {
+    ws->u_val = u0;
+  } else if (s == 1.0) {
+    ws->u_val = u0 + stride;
+  } else if (in->hold == HYB_FOH) {
+    const hyb_float *u1 = u0 + stride;
+    for (size_t i = 0; i < n; i++)
+      ws->u[i] = u0[i] + s * (u1[i] - u0[i]);
+    ws->u_val = ws->u;
+  } else {
+    /* Catmull-Rom slopes, one sided at the ends of the signal */
+    const hyb_float *u1 = u0 + stride;
+    const hyb_float *um = k > 0 ? u0 - stride : u0;
+    const hyb_float *u2 = k + 1 < last ? u1 + stride : u1;
+    const hyb_float ta = hyb_input_time(in, k > 0 ? k - 1 : k);
+    const hyb_float t0 = hyb_input_time(in, k), t1 = hyb_input_time(in, k + 1);
+    const hyb_float tb = hyb_input_time(in, k + 1 < last ? k + 2 : k + 1);
+    const hyb_float h = t1 - t0;
+    const hyb_float s2 = s * s, s3 = s2 * s;
+    const hyb_float h00 = 2.0 * s3 - 3.0 * s2 + 1.0;
+    const hyb_float h10 = (s3 - 2.0 * s2 + s) * h / (t1 - ta);
+    const hyb_float h01 = 3.0 * s2 - 2.0 * s3;
+    const hyb_float h11 = (s3 - s2) * h / (tb - t0);
+    for (size_t i = 0; i < n; i++)
+      ws->u[i] = h00 * u0[i] + h10 * (u1[i] - um[i]) + h01 * u1[i] + h11 * (u2[i] - u0[i]);
+    ws->u_val = ws->u;
+  }
+  return ws->u_val;
+}
 
-  hyb_bool d = opts->D(x[0], x[1], x + 2, u, p);
+/**
+ * @brief Input of a callback at the time t: the attached signal, if any, or u
+ */
+static inline const hyb_float *hyb_u(hyb_workspace *ws, const hyb_float *u, hyb_float t) {
+  return (ws && ws->input) ? hyb_input_eval(ws, t, hyb_false) : u;
+}
+
+/**
+ * @brief Input of a callback inside the current flow step (from the left after its start)
+ */
+static inline const hyb_float *hyb_u_flow(hyb_workspace *ws, const hyb_float *u, hyb_float t) {
+  return ws->input ? hyb_input_eval(ws, t, t > ws->t_flow ? hyb_true : hyb_false) : u;
+}
+
+/**
+ * @brief Decides between flow and jump step, accounting the sets in ws (if not NULL)
+ */
+static hyb_bool hyb_decide(hyb_opts *opts, hyb_workspace *ws, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  hyb_bool d;
+  u = hyb_u(ws, u, x[0]);
+  HYB_TIMED(ws, HYB_CB_D, d = opts->D(x[0], x[1], x + 2, u, p));
   #if HYB_JUMP_LOGIC == 2
-    hyb_bool c = opts->C(x[0], x[1], x + 2, u, p);
+    hyb_bool c;
+    HYB_TIMED(ws, HYB_CB_C, c = opts->C(x[0], x[1], x + 2, u, p));
   #endif
 
   hyb_bool it_jumps;
@@ -48,22 +171,1116 @@ hyb_errorcode hyb_main_loop(hyb_opts *opts, hyb_float *y, hyb_float *xp, hyb_flo
   #elif HYB_JUMP_LOGIC == 2
     it_jumps = d && !c;
   #endif
+  return it_jumps;
+}
 
+/**
+ * @brief Output and flow / jump decision through the fused callback
+ *
+ * The flow map at x is stored in k[0] and marked as ready for the next flow
+ * step, which is discarded by a jump. y may be NULL.
+ */
+static hyb_bool hyb_fused_eval(hyb_opts *opts, hyb_workspace *ws, hyb_float *y, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  hyb_float *k0 = ws->k[0];
+  hyb_bool d = hyb_false;
+  u = hyb_u(ws, u, x[0]);
+  k0[0] = 1.0;
+  k0[1] = 0.0;
+  #if HYB_JUMP_LOGIC == 1
+    HYB_TIMED(ws, HYB_CB_FUSED, opts->fused(y, &d, NULL, k0 + 2, x[0], x[1], x + 2, u, p));
+  #elif HYB_JUMP_LOGIC == 2
+    hyb_bool c = hyb_true;
+    HYB_TIMED(ws, HYB_CB_FUSED, opts->fused(y, &d, &c, k0 + 2, x[0], x[1], x + 2, u, p));
+  #endif
+  ws->k0_ready = hyb_true;
+
+  #if HYB_JUMP_LOGIC == 1
+    return d;
+  #elif HYB_JUMP_LOGIC == 2
+    return d && !c;
+  #endif
+}
+
+hyb_bool hyb_it_jumps(hyb_opts *opts, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  return hyb_decide(opts, NULL, x, u, p);
+}
+
+/* No contraction in fused multiply-add, whatever the flags of the build: the
+ * vector kernels and the scalar loops below round the same way */
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#elif defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+#if !defined(HYB_NO_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HYB_SIMD_X86 /**< Vector kernels for x86, selected at runtime */
+#include <immintrin.h>
+
+#define HYB_SIMD_TARGET(isa) __attribute__((target(isa)))
+
+/**
+ * @brief Defines the stage kernels for an instruction set
+ *
+ * hyb_axpy_<name> computes z = x + a y and hyb_rk4_sum_<name> the weighted
+ * sum of the Runge Kutta 4 stages z = x + c (k1 + 2 k2 + 2 k3 + k4), with the
+ * same order of the operations of the scalar loops.
+ */
+#define HYB_SIMD_KERNELS(isa, name, vec, w, load, store, add, mul, set1) \
+  HYB_SIMD_TARGET(isa) static void hyb_axpy_##name(double *z, const double *x, double a, const double *y, size_t n) { \
+    const vec va = set1(a); \
+    size_t i = 0; \
+    for (; i + w <= n; i += w) \
+      store(z + i, add(load(x + i), mul(va, load(y + i)))); \
+    for (; i < n; i++) \
+      z[i] = x[i] + a * y[i]; \
+  } \
+  HYB_SIMD_TARGET(isa) static void hyb_rk4_sum_##name(double *z, const double *x, double c, const double *k1, const double *k2, const double *k3, const double *k4, size_t n) { \
+    const vec vc = set1(c), two = set1(2.0); \
+    size_t i = 0; \
+    for (; i + w <= n; i += w) { \
+      const vec s = add(add(add(load(k1 + i), mul(two, load(k2 + i))), mul(two, load(k3 + i))), load(k4 + i)); \
+      store(z + i, add(load(x + i), mul(vc, s))); \
+    } \
+    for (; i < n; i++) \
+      z[i] = x[i] + c * (k1[i] + 2.0 * k2[i] + 2.0 * k3[i] + k4[i]); \
+  }
+
+HYB_SIMD_KERNELS("sse2", sse2, __m128d, 2, _mm_loadu_pd, _mm_storeu_pd, _mm_add_pd, _mm_mul_pd, _mm_set1_pd)
+HYB_SIMD_KERNELS("avx2", avx2, __m256d, 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_add_pd, _mm256_mul_pd, _mm256_set1_pd)
+HYB_SIMD_KERNELS("avx512f", avx512, __m512d, 8, _mm512_loadu_pd, _mm512_storeu_pd, _mm512_add_pd, _mm512_mul_pd, _mm512_set1_pd)
+#endif
+
+/**
+ * @brief Detects the best instruction set for the stage kernels
+ */
+static hyb_simd hyb_simd_detect(void) {
+#ifdef HYB_SIMD_X86
+  if (sizeof(hyb_float) != sizeof(double))
+    return HYB_SIMD_NONE;
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f"))
+    return HYB_SIMD_AVX512;
+  if (__builtin_cpu_supports("avx2"))
+    return HYB_SIMD_AVX2;
+  if (__builtin_cpu_supports("sse2"))
+    return HYB_SIMD_SSE2;
+#endif
+  return HYB_SIMD_NONE;
+}
+
+/**
+ * @brief Stage update z = x + a y on the augmented vectors
+ *
+ * Flow time and jump time are updated apart, the state goes through the
+ * kernel of the workspace.
+ */
+static inline void hyb_axpy(const hyb_workspace *ws, hyb_float *z, const hyb_float *x, hyb_float a, const hyb_float *y) {
+  const size_t n = ws->x_size - 2;
+  z[0] = x[0] + a * y[0];
+  z[1] = x[1] + a * y[1];
+  z += 2; x += 2; y += 2;
+  switch (ws->simd) {
+#ifdef HYB_SIMD_X86
+  case HYB_SIMD_AVX512:
+    hyb_axpy_avx512((double *)z, (const double *)x, a, (const double *)y, n);
+    return;
+  case HYB_SIMD_AVX2:
+    hyb_axpy_avx2((double *)z, (const double *)x, a, (const double *)y, n);
+    return;
+  case HYB_SIMD_SSE2:
+    hyb_axpy_sse2((double *)z, (const double *)x, a, (const double *)y, n);
+    return;
+#endif
+  default:
+    for (size_t i = 0; i < n; i++)
+      z[i] = x[i] + a * y[i];
+  }
+}
+
+/**
+ * @brief Weighted sum of the Runge Kutta 4 stages z = x + c (k1 + 2 k2 + 2 k3 + k4)
+ */
+static inline void hyb_rk4_sum(const hyb_workspace *ws, hyb_float *z, const hyb_float *x, hyb_float c) {
+  const size_t n = ws->x_size - 2;
+  const hyb_float *k1 = ws->k[0], *k2 = ws->k[1], *k3 = ws->k[2], *k4 = ws->k[3];
+  for (size_t i = 0; i < 2; i++)
+    z[i] = x[i] + c * (k1[i] + 2.0 * k2[i] + 2.0 * k3[i] + k4[i]);
+  z += 2; x += 2; k1 += 2; k2 += 2; k3 += 2; k4 += 2;
+  switch (ws->simd) {
+#ifdef HYB_SIMD_X86
+  case HYB_SIMD_AVX512:
+    hyb_rk4_sum_avx512((double *)z, (const double *)x, c, (const double *)k1, (const double *)k2, (const double *)k3, (const double *)k4, n);
+    return;
+  case HYB_SIMD_AVX2:
+    hyb_rk4_sum_avx2((double *)z, (const double *)x, c, (const double *)k1, (const double *)k2, (const double *)k3, (const double *)k4, n);
+    return;
+  case HYB_SIMD_SSE2:
+    hyb_rk4_sum_sse2((double *)z, (const double *)x, c, (const double *)k1, (const double *)k2, (const double *)k3, (const double *)k4, n);
+    return;
+#endif
+  default:
+    for (size_t i = 0; i < n; i++)
+      z[i] = x[i] + c * (k1[i] + 2.0 * k2[i] + 2.0 * k3[i] + k4[i]);
+  }
+}
+
+#if defined(__clang__)
+#pragma STDC FP_CONTRACT DEFAULT
+#elif defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+/**
+ * @brief Number of elements of a workspace vector of size n, padded to a cache line
+ */
+static size_t hyb_workspace_stride(size_t n) {
+  const size_t line = HYB_CACHE_LINE / sizeof(hyb_float);
+  return ((n + line - 1) / line) * line;
+}
+
+hyb_errorcode hyb_workspace_init(hyb_workspace *ws, const hyb_opts *opts) {
+  if (!ws || !opts)
+    return HYB_NULLPTR;
+  memset(ws, 0, sizeof(hyb_workspace));
+
+  const size_t nx = hyb_workspace_stride(opts->x_size + 2);
+  const size_t ny = hyb_workspace_stride(opts->y_size);
+  const hyb_bool implicit = opts->integrator == HYB_ROS2 ? hyb_true : hyb_false;
+  const size_t nj = implicit ? hyb_workspace_stride(opts->x_size * opts->x_size) : 0;
+  const size_t np = implicit ? hyb_workspace_stride((opts->x_size * sizeof(size_t) + sizeof(hyb_float) - 1) / sizeof(hyb_float)) : 0;
+  const size_t size = ((HYB_WS_STAGES + 8) * nx + ny + 2 * nj + np) * sizeof(hyb_float);
+  ws->block = malloc(size + 2 * HYB_CACHE_LINE);
+  if (!ws->block)
+    return HYB_EMALLOC;
+  memset(ws->block, 0, size + 2 * HYB_CACHE_LINE);
+
+  /* Flow time and jump time sit before the boundary, the state is aligned */
+  hyb_float *v = (hyb_float *)(((size_t)ws->block + HYB_CACHE_LINE - 1) & ~((size_t)HYB_CACHE_LINE - 1));
+  v += HYB_CACHE_LINE / sizeof(hyb_float) - 2;
+  for (size_t s = 0; s < HYB_WS_STAGES; s++, v += nx)
+    ws->k[s] = v;
+  ws->xs = v;
+  ws->ev = v + nx;
+  ws->xa = v + 2 * nx;
+  ws->xb = v + 3 * nx;
+  ws->d0 = v + 4 * nx;
+  ws->df0 = v + 5 * nx;
+  ws->d1 = v + 6 * nx;
+  ws->df1 = v + 7 * nx;
+  ws->y = v + 8 * nx;
+  if (implicit) {
+    ws->jac = ws->y + ny;
+    ws->lu = ws->jac + nj;
+    ws->piv = (size_t *)(ws->lu + nj);
+  }
+  ws->x_size = opts->x_size + 2;
+  ws->y_size = opts->y_size;
+  ws->h = opts->h;
+  ws->simd = hyb_simd_detect();
+  return HYB_SUCCESS;
+}
+
+void hyb_workspace_free(hyb_workspace *ws) {
+  if (!ws)
+    return;
+  free(ws->block);
+  free(ws->u);
+  memset(ws, 0, sizeof(hyb_workspace));
+}
+
+hyb_errorcode hyb_stats_get(const hyb_workspace *ws, hyb_stats *stats) {
+  if (!ws || !stats)
+    return HYB_NULLPTR;
+#ifdef HYB_STATS
+  *stats = ws->stats;
+  return HYB_SUCCESS;
+#else
+  memset(stats, 0, sizeof(hyb_stats));
+  return HYB_GENERIC;
+#endif
+}
+
+void hyb_stats_reset(hyb_workspace *ws) {
+#ifdef HYB_STATS
+  if (ws)
+    memset(&ws->stats, 0, sizeof(hyb_stats));
+#else
+  (void) ws;
+#endif
+}
+
+static const char hyb_checkpoint_magic[8] = { 'H', 'Y', 'B', 'C', 'K', 'P', 'T', '\0' }; /**< Checkpoint signature */
+
+#define HYB_CHECKPOINT_JAC 1u   /**< The checkpoint contains the implicit integrator state */
+#define HYB_CHECKPOINT_STATS 2u /**< The checkpoint contains the statistics */
+
+/**
+ * @brief Header of a checkpoint blob
+ */
+typedef struct hyb_checkpoint_header {
+  char magic[8];       /**< hyb_checkpoint_magic */
+  uint32_t version;    /**< HYB_CHECKPOINT_VERSION */
+  uint32_t float_size; /**< sizeof(hyb_float) */
+  uint64_t x_size;     /**< Augmented state size */
+  uint64_t flags;      /**< HYB_CHECKPOINT_JAC, HYB_CHECKPOINT_STATS */
+  uint64_t size;       /**< Size of the whole blob */
+  uint64_t checksum;   /**< FNV-1a of the blob after the header */
+} hyb_checkpoint_header;
+
+/**
+ * @brief Scalar state of the workspace in a checkpoint
+ */
+typedef struct hyb_checkpoint_scalars {
+  hyb_float h;       /**< hyb_workspace::h */
+  hyb_float hs;      /**< hyb_workspace::hs */
+  hyb_float theta;   /**< hyb_workspace::theta */
+  hyb_float h_lu;    /**< hyb_workspace::h_lu */
+  uint64_t jac_age;  /**< hyb_workspace::jac_age */
+  uint32_t event;    /**< hyb_workspace::event */
+  uint32_t fsal;     /**< hyb_workspace::fsal */
+} hyb_checkpoint_scalars;
+
+/**
+ * @brief FNV-1a hash of a memory area
+ */
+static uint64_t hyb_checkpoint_hash(const unsigned char *data, size_t size) {
+  uint64_t hash = 14695981039346656037ull;
+  for (size_t i = 0; i < size; i++)
+    hash = (hash ^ data[i]) * 1099511628211ull;
+  return hash;
+}
+
+/**
+ * @brief Flags of the optional sections for a workspace
+ */
+static uint64_t hyb_checkpoint_flags(const hyb_workspace *ws) {
+  uint64_t flags = ws->jac ? HYB_CHECKPOINT_JAC : 0;
+#ifdef HYB_STATS
+  flags |= HYB_CHECKPOINT_STATS;
+#endif
+  return flags;
+}
+
+/**
+ * @brief Size of a checkpoint with the given sizes and optional sections
+ */
+static size_t hyb_checkpoint_bytes(size_t nx, uint64_t flags) {
+  const size_t n = nx - 2;
+  size_t size = sizeof(hyb_checkpoint_header) + sizeof(hyb_checkpoint_scalars) + 5 * nx * sizeof(hyb_float);
+  if (flags & HYB_CHECKPOINT_JAC)
+    size += 2 * n * n * sizeof(hyb_float) + n * sizeof(uint64_t);
+  if (flags & HYB_CHECKPOINT_STATS)
+    size += sizeof(hyb_stats);
+  return size;
+}
+
+size_t hyb_checkpoint_size(const hyb_workspace *ws) {
+  return ws ? hyb_checkpoint_bytes(ws->x_size, hyb_checkpoint_flags(ws)) : 0;
+}
+
+hyb_errorcode hyb_checkpoint_save(const hyb_workspace *ws, const hyb_float *x, void *blob, size_t size) {
+  if (!ws || !x || !blob)
+    return HYB_NULLPTR;
+  const size_t nx = ws->x_size, n = nx - 2;
+  const uint64_t flags = hyb_checkpoint_flags(ws);
+  const size_t bytes = hyb_checkpoint_bytes(nx, flags);
+  if (size < bytes)
+    return HYB_BUFFER;
+
+  unsigned char *b = (unsigned char *)blob + sizeof(hyb_checkpoint_header);
+  hyb_checkpoint_scalars sc;
+  memset(&sc, 0, sizeof(sc));
+  sc.h = ws->h;
+  sc.hs = ws->hs;
+  sc.theta = ws->theta;
+  sc.h_lu = ws->h_lu;
+  sc.jac_age = ws->jac_age;
+  sc.event = ws->event;
+  sc.fsal = ws->fsal;
+  memcpy(b, &sc, sizeof(sc));
+  b += sizeof(sc);
+
+  const hyb_float *vectors[5] = { x, ws->d0, ws->df0, ws->d1, ws->df1 };
+  for (size_t v = 0; v < 5; v++, b += nx * sizeof(hyb_float))
+    memcpy(b, vectors[v], nx * sizeof(hyb_float));
+  if (flags & HYB_CHECKPOINT_JAC) {
+    memcpy(b, ws->jac, n * n * sizeof(hyb_float));
+    b += n * n * sizeof(hyb_float);
+    memcpy(b, ws->lu, n * n * sizeof(hyb_float));
+    b += n * n * sizeof(hyb_float);
+    for (size_t i = 0; i < n; i++, b += sizeof(uint64_t)) {
+      uint64_t piv = ws->piv[i];
+      memcpy(b, &piv, sizeof(piv));
+    }
+  }
+#ifdef HYB_STATS
+  memcpy(b, &ws->stats, sizeof(hyb_stats));
+#endif
+
+  hyb_checkpoint_header hd;
+  memset(&hd, 0, sizeof(hd));
+  memcpy(hd.magic, hyb_checkpoint_magic, sizeof(hd.magic));
+  hd.version = HYB_CHECKPOINT_VERSION;
+  hd.float_size = sizeof(hyb_float);
+  hd.x_size = nx;
+  hd.flags = flags;
+  hd.size = bytes;
+  hd.checksum = hyb_checkpoint_hash((const unsigned char *)blob + sizeof(hd), bytes - sizeof(hd));
+  memcpy(blob, &hd, sizeof(hd));
+  return HYB_SUCCESS;
+}
+
+hyb_errorcode hyb_checkpoint_load(hyb_workspace *ws, hyb_float *x, const void *blob, size_t size) {
+  if (!ws || !x || !blob)
+    return HYB_NULLPTR;
+  hyb_checkpoint_header hd;
+  if (size < sizeof(hd))
+    return HYB_GENERIC;
+  memcpy(&hd, blob, sizeof(hd));
+
+  const size_t nx = ws->x_size, n = nx - 2;
+  if (memcmp(hd.magic, hyb_checkpoint_magic, sizeof(hd.magic)) || hd.version != HYB_CHECKPOINT_VERSION ||
+      hd.float_size != sizeof(hyb_float) || hd.x_size != nx || hd.size > size ||
+      hd.size != hyb_checkpoint_bytes(nx, hd.flags) ||
+      ((hd.flags & HYB_CHECKPOINT_JAC) && !ws->jac) ||
+      hd.checksum != hyb_checkpoint_hash((const unsigned char *)blob + sizeof(hd), hd.size - sizeof(hd)))
+    return HYB_GENERIC;
+
+  const unsigned char *b = (const unsigned char *)blob + sizeof(hd);
+  hyb_checkpoint_scalars sc;
+  memcpy(&sc, b, sizeof(sc));
+  b += sizeof(sc);
+  ws->h = sc.h;
+  ws->hs = sc.hs;
+  ws->theta = sc.theta;
+  ws->event = sc.event ? hyb_true : hyb_false;
+  ws->fsal = sc.fsal ? hyb_true : hyb_false;
+  ws->k0_ready = hyb_false;
+
+  hyb_float *vectors[5] = { x, ws->d0, ws->df0, ws->d1, ws->df1 };
+  for (size_t v = 0; v < 5; v++, b += nx * sizeof(hyb_float))
+    memcpy(vectors[v], b, nx * sizeof(hyb_float));
+  if (hd.flags & HYB_CHECKPOINT_JAC) {
+    memcpy(ws->jac, b, n * n * sizeof(hyb_float));
+    b += n * n * sizeof(hyb_float);
+    memcpy(ws->lu, b, n * n * sizeof(hyb_float));
+    b += n * n * sizeof(hyb_float);
+    for (size_t i = 0; i < n; i++, b += sizeof(uint64_t)) {
+      uint64_t piv;
+      memcpy(&piv, b, sizeof(piv));
+      ws->piv[i] = (size_t)piv;
+    }
+    ws->h_lu = sc.h_lu;
+    ws->jac_age = (size_t)sc.jac_age;
+  } else {
+    /* A workspace for the implicit integrator restarts from a new Jacobian */
+    ws->h_lu = 0.0;
+    ws->jac_age = 0;
+  }
+#ifdef HYB_STATS
+  if (hd.flags & HYB_CHECKPOINT_STATS)
+    memcpy(&ws->stats, b, sizeof(hyb_stats));
+  else
+    memset(&ws->stats, 0, sizeof(hyb_stats));
+#endif
+  return HYB_SUCCESS;
+}
+
+/**
+ * @brief Evaluates the augmented flow map (flow time, jump time, state)
+ */
+static inline void hyb_flow_eval(hyb_opts *opts, hyb_workspace *ws, hyb_float *dx, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  u = hyb_u_flow(ws, u, x[0]);
+  dx[0] = 1.0;
+  dx[1] = 0.0;
+  HYB_TIMED(ws, HYB_CB_F, opts->F(dx + 2, x[0], x[1], x + 2, u, p));
+}
+
+/**
+ * @brief Derivative at the start of a flow step
+ *
+ * If the fused callback already stored it in k[0] (ws->k0_ready), it is
+ * used as is. If the caller marked it as valid (ws->fsal), the derivative at
+ * the end of the previous step is reused (first same as last), otherwise the
+ * flow map is evaluated. The marks are consumed.
+ */
+static inline void hyb_flow_first(hyb_opts *opts, hyb_workspace *ws, hyb_float *dx, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  if (ws->k0_ready) {
+    if (dx != ws->k[0])
+      memcpy(dx, ws->k[0], ws->x_size * sizeof(hyb_float));
+  } else if (ws->fsal) {
+    memcpy(dx, ws->df1, ws->x_size * sizeof(hyb_float));
+  } else {
+    hyb_flow_eval(opts, ws, dx, x, u, p);
+  }
+  ws->k0_ready = hyb_false;
+  ws->fsal = hyb_false;
+}
+
+/**
+ * @brief Cubic Hermite interpolation of a step at the normalized time theta
+ *
+ * The interpolant uses the states and the derivatives at the two ends of the
+ * step. Flow time and jump time are not interpolated, but set exactly.
+ */
+static void hyb_hermite(hyb_float *xi, hyb_float theta, hyb_float h, size_t n, const hyb_float *x0, const hyb_float *f0, const hyb_float *x1, const hyb_float *f1) {
+  const hyb_float t2 = theta * theta;
+  const hyb_float t3 = t2 * theta;
+  const hyb_float h00 = 2.0 * t3 - 3.0 * t2 + 1.0;
+  const hyb_float h10 = (t3 - 2.0 * t2 + theta) * h;
+  const hyb_float h01 = 3.0 * t2 - 2.0 * t3;
+  const hyb_float h11 = (t3 - t2) * h;
+  xi[0] = x0[0] + theta * h;
+  xi[1] = x0[1];
+  for (size_t i = 2; i < n; i++)
+    xi[i] = h00 * x0[i] + h10 * f0[i] + h01 * x1[i] + h11 * f1[i];
+}
+
+/**
+ * @brief Locates the guard crossing inside a flow step from x to xp
+ *
+ * The crossing is searched with the Illinois variant of the regula falsi on
+ * the Hermite interpolant of the step. On exit xp contains the state at the
+ * end of the final bracket, that lies strictly inside the jump set (g < 0),
+ * so that the following jump step is not ambiguous for any HYB_JUMP_LOGIC.
+ * The derivatives at the ends of the step are f0 and f1, the workspace
+ * vectors xs and ev are used as scratch space.
+ */
+static void hyb_locate_event(hyb_opts *opts, hyb_workspace *ws, hyb_float *xp, hyb_float ga, hyb_float gb, const hyb_float *f0, const hyb_float *f1, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  const size_t n = ws->x_size;
+  const hyb_float h = ws->hs;
+  hyb_float *x1 = ws->ev, *xi = ws->xs;
+  memcpy(x1, xp, n * sizeof(hyb_float));
+
+  hyb_float a = 0.0, b = 1.0;
+  int side = 0;
+  for (size_t it = 0; it < HYB_EVENT_MAXITER && (b - a) > HYB_EVENT_TOL; it++) {
+    hyb_float c = (a * gb - b * ga) / (gb - ga);
+    if (!(c > a && c < b))
+      c = 0.5 * (a + b);
+    hyb_hermite(xi, c, h, n, x, f0, x1, f1);
+    hyb_float gc;
+    HYB_TIMED(ws, HYB_CB_G, gc = opts->G(xi[0], xi[1], xi + 2, hyb_u_flow(ws, u, xi[0]), p));
+    if (gc >= 0.0) {
+      a = c;
+      ga = gc;
+      if (side == -1)
+        gb *= 0.5;
+      side = -1;
+    } else {
+      b = c;
+      gb = gc;
+      memcpy(xp, xi, n * sizeof(hyb_float));
+      ws->theta = c;
+      if (side == 1)
+        ga *= 0.5;
+      side = 1;
+    }
+  }
+}
+
+/**
+ * @brief Performs a single step of the Runge Kutta 4
+ *
+ * Stages are stored in the first four vectors of the workspace. On exit the
+ * first stage contains the derivative at x. The stage updates run on the
+ * vector kernels of the workspace (see hyb_simd).
+ */
+static void hyb_rk4(hyb_opts *opts, hyb_workspace *ws, hyb_float *xp, hyb_float h, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  hyb_float *k1 = ws->k[0], *k2 = ws->k[1], *k3 = ws->k[2], *k4 = ws->k[3], *xs = ws->xs;
+
+  hyb_flow_first(opts, ws, k1, x, u, p);
+  hyb_axpy(ws, xs, x, 0.5 * h, k1);
+  hyb_flow_eval(opts, ws, k2, xs, u, p);
+  hyb_axpy(ws, xs, x, 0.5 * h, k2);
+  hyb_flow_eval(opts, ws, k3, xs, u, p);
+  hyb_axpy(ws, xs, x, h, k3);
+  hyb_flow_eval(opts, ws, k4, xs, u, p);
+  hyb_rk4_sum(ws, xp, x, h / 6.0);
+  ws->hs = h;
+}
+
+/**
+ * @brief Performs a single accepted step of the Dormand-Prince 5(4) pair
+ *
+ * The step starts from the length proposed in ws->h (limited by h_max) and
+ * it is reduced until the local error estimate satisfies the tolerances. The
+ * proposed length for the next step is stored back in ws->h. On exit the
+ * first stage contains the derivative at x and the last one at xp.
+ */
+static hyb_errorcode hyb_dopri5(hyb_opts *opts, hyb_workspace *ws, hyb_float *xp, hyb_float h_max, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  static const hyb_float
+    a21 = 1.0 / 5.0,
+    a31 = 3.0 / 40.0, a32 = 9.0 / 40.0,
+    a41 = 44.0 / 45.0, a42 = -56.0 / 15.0, a43 = 32.0 / 9.0,
+    a51 = 19372.0 / 6561.0, a52 = -25360.0 / 2187.0, a53 = 64448.0 / 6561.0, a54 = -212.0 / 729.0,
+    a61 = 9017.0 / 3168.0, a62 = -355.0 / 33.0, a63 = 46732.0 / 5247.0, a64 = 49.0 / 176.0, a65 = -5103.0 / 18656.0,
+    a71 = 35.0 / 384.0, a73 = 500.0 / 1113.0, a74 = 125.0 / 192.0, a75 = -2187.0 / 6784.0, a76 = 11.0 / 84.0,
+    e1 = 71.0 / 57600.0, e3 = -71.0 / 16695.0, e4 = 71.0 / 1920.0, e5 = -17253.0 / 339200.0, e6 = 22.0 / 525.0, e7 = -1.0 / 40.0;
+
+  const size_t n = ws->x_size;
+  const hyb_float atol = opts->atol > 0.0 ? opts->atol : HYB_DEFAULT_ATOL;
+  const hyb_float rtol = opts->rtol > 0.0 ? opts->rtol : HYB_DEFAULT_RTOL;
+  hyb_float *k1 = ws->k[0], *k2 = ws->k[1], *k3 = ws->k[2], *k4 = ws->k[3];
+  hyb_float *k5 = ws->k[4], *k6 = ws->k[5], *k7 = ws->k[6], *xs = ws->xs;
+
+  hyb_float h = ws->h > 0.0 ? ws->h : h_max;
+  hyb_flow_first(opts, ws, k1, x, u, p);
+  for (;;) {
+    const hyb_float hs = h < h_max ? h : h_max;
+    if (x[0] + hs == x[0]) {
+      HYB_COUNT(ws, failed);
+      return HYB_STEPSIZE;
+    }
+
+    for (size_t i = 0; i < n; i++)
+      xs[i] = x[i] + hs * a21 * k1[i];
+    hyb_flow_eval(opts, ws, k2, xs, u, p);
+    for (size_t i = 0; i < n; i++)
+      xs[i] = x[i] + hs * (a31 * k1[i] + a32 * k2[i]);
+    hyb_flow_eval(opts, ws, k3, xs, u, p);
+    for (size_t i = 0; i < n; i++)
+      xs[i] = x[i] + hs * (a41 * k1[i] + a42 * k2[i] + a43 * k3[i]);
+    hyb_flow_eval(opts, ws, k4, xs, u, p);
+    for (size_t i = 0; i < n; i++)
+      xs[i] = x[i] + hs * (a51 * k1[i] + a52 * k2[i] + a53 * k3[i] + a54 * k4[i]);
+    hyb_flow_eval(opts, ws, k5, xs, u, p);
+    for (size_t i = 0; i < n; i++)
+      xs[i] = x[i] + hs * (a61 * k1[i] + a62 * k2[i] + a63 * k3[i] + a64 * k4[i] + a65 * k5[i]);
+    hyb_flow_eval(opts, ws, k6, xs, u, p);
+    for (size_t i = 0; i < n; i++)
+      xp[i] = x[i] + hs * (a71 * k1[i] + a73 * k3[i] + a74 * k4[i] + a75 * k5[i] + a76 * k6[i]);
+    hyb_flow_eval(opts, ws, k7, xp, u, p);
+
+    /* Error norm on the state only: flow time and jump time are exact */
+    hyb_float err = 0.0;
+    for (size_t i = 2; i < n; i++) {
+      hyb_float sk = atol + rtol * (fabs(x[i]) > fabs(xp[i]) ? fabs(x[i]) : fabs(xp[i]));
+      hyb_float ei = hs * (e1 * k1[i] + e3 * k3[i] + e4 * k4[i] + e5 * k5[i] + e6 * k6[i] + e7 * k7[i]) / sk;
+      err += ei * ei;
+    }
+    err = n > 2 ? sqrt(err / (hyb_float)(n - 2)) : 0.0;
+
+    hyb_float fac = err > 0.0 ? 0.9 * pow(err, -0.2) : 5.0;
+    fac = fac < 0.2 ? 0.2 : (fac > 5.0 ? 5.0 : fac);
+    if (err <= 1.0) {
+      /* A step limited by h_max does not reduce the proposed length */
+      hyb_float h_next = hs * fac;
+      ws->h = (hs < h && h_next < h) ? h : h_next;
+      ws->hs = hs;
+      return HYB_SUCCESS;
+    }
+    HYB_COUNT(ws, rejected);
+    h = hs * (fac < 1.0 ? fac : 1.0);
+  }
+}
+
+/**
+ * @brief In place LU factorization with partial pivoting of a column-major n x n matrix
+ * @return hyb_false if the matrix is singular
+ */
+static hyb_bool hyb_lu_factor(hyb_float *a, size_t *piv, size_t n) {
+  for (size_t k = 0; k < n; k++) {
+    size_t pk = k;
+    hyb_float max = fabs(a[k + k * n]);
+    for (size_t r = k + 1; r < n; r++) {
+      if (fabs(a[r + k * n]) > max) {
+        max = fabs(a[r + k * n]);
+        pk = r;
+      }
+    }
+    piv[k] = pk;
+    if (max == 0.0)
+      return hyb_false;
+    if (pk != k) {
+      for (size_t c = 0; c < n; c++) {
+        hyb_float swap = a[k + c * n];
+        a[k + c * n] = a[pk + c * n];
+        a[pk + c * n] = swap;
+      }
+    }
+    const hyb_float inv = 1.0 / a[k + k * n];
+    for (size_t r = k + 1; r < n; r++)
+      a[r + k * n] *= inv;
+    for (size_t c = k + 1; c < n; c++) {
+      const hyb_float akc = a[k + c * n];
+      if (akc == 0.0)
+        continue;
+      for (size_t r = k + 1; r < n; r++)
+        a[r + c * n] -= a[r + k * n] * akc;
+    }
+  }
+  return hyb_true;
+}
+
+/**
+ * @brief Solves in place a x = b with the factors of hyb_lu_factor
+ */
+static void hyb_lu_solve(const hyb_float *a, const size_t *piv, size_t n, hyb_float *b) {
+  for (size_t k = 0; k < n; k++) {
+    if (piv[k] != k) {
+      hyb_float swap = b[k];
+      b[k] = b[piv[k]];
+      b[piv[k]] = swap;
+    }
+  }
+  for (size_t c = 0; c < n; c++) {
+    const hyb_float bc = b[c];
+    if (bc == 0.0)
+      continue;
+    for (size_t r = c + 1; r < n; r++)
+      b[r] -= a[r + c * n] * bc;
+  }
+  for (size_t c = n; c-- > 0;) {
+    b[c] /= a[c + c * n];
+    const hyb_float bc = b[c];
+    for (size_t r = 0; r < c; r++)
+      b[r] -= a[r + c * n] * bc;
+  }
+}
+
+/**
+ * @brief Updates the Jacobian and the LU factors of I - gamma h J for a ROS2 step
+ *
+ * The Jacobian is evaluated at x when it is not valid or too old, through
+ * hyb_opts::Fx or with forward differences (f0 is the flow map at x). The
+ * factorization is recomputed when the Jacobian or the step length change.
+ */
+static hyb_errorcode hyb_ros2_matrix(hyb_opts *opts, hyb_workspace *ws, hyb_float gh, const hyb_float *f0, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  const size_t n = opts->x_size;
+  hyb_float *jac = ws->jac, *lu = ws->lu;
+
+  if (ws->jac_age == 0 || ws->jac_age >= HYB_ROS2_MAX_AGE) {
+    u = hyb_u_flow(ws, u, x[0]);
+    if (opts->Fx) {
+      HYB_TIMED(ws, HYB_CB_FX, opts->Fx(jac, x[0], x[1], x + 2, u, p));
+    } else {
+      hyb_float *xd = ws->ev, *fd = ws->k[3];
+      memcpy(xd, x, (n + 2) * sizeof(hyb_float));
+      for (size_t c = 0; c < n; c++) {
+        const hyb_float xc = x[2 + c];
+        xd[2 + c] = xc + sqrt(HYB_EPSILON) * (fabs(xc) > 1.0 ? fabs(xc) : 1.0);
+        /* The step actually taken, after the rounding of the perturbed state */
+        const hyb_float d = xd[2 + c] - xc;
+        HYB_TIMED(ws, HYB_CB_F, opts->F(fd, xd[0], xd[1], xd + 2, u, p));
+        xd[2 + c] = xc;
+        for (size_t r = 0; r < n; r++)
+          jac[r + c * n] = (fd[r] - f0[r]) / d;
+      }
+    }
+    HYB_COUNT(ws, jacobians);
+    ws->jac_age = 0;
+    ws->h_lu = 0.0;
+  }
+
+  if (ws->h_lu != gh) {
+    for (size_t i = 0; i < n * n; i++)
+      lu[i] = -gh * jac[i];
+    for (size_t i = 0; i < n; i++)
+      lu[i + i * n] += 1.0;
+    HYB_COUNT(ws, factorizations);
+    if (!hyb_lu_factor(lu, ws->piv, n)) {
+      ws->jac_age = 0;
+      ws->h_lu = 0.0;
+      return HYB_SINGULAR;
+    }
+    ws->h_lu = gh;
+  }
+  ws->jac_age++;
+  return HYB_SUCCESS;
+}
+
+/**
+ * @brief Performs a single step of the Rosenbrock ROS2 W-method
+ *
+ * With M = I - gamma h J:
+ * \f{eqnarray*}
+ *  M k_1 &= f(x) \\
+ *  M k_2 &= f(x + h k_1) - 2 k_1 \\
+ *  x^+ &= x + \frac{3}{2} h k_1 + \frac{1}{2} h k_2
+ * \f}
+ * with gamma = 1 + 1 / sqrt(2). The linear systems involve only the state:
+ * the components of flow time and jump time are exact. On exit the first
+ * stage vector contains the derivative at x.
+ */
+static hyb_errorcode hyb_ros2(hyb_opts *opts, hyb_workspace *ws, hyb_float *xp, hyb_float h, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  static const hyb_float gamma = 1.0 + 0.70710678118654752440;
+  const size_t n = ws->x_size;
+  hyb_float *f0 = ws->k[0], *k1 = ws->k[1], *k2 = ws->k[2], *fs = ws->k[3], *xs = ws->xs;
+
+  if (!ws->jac)
+    return HYB_NULLPTR;
+  hyb_flow_first(opts, ws, f0, x, u, p);
+  hyb_errorcode ret = hyb_ros2_matrix(opts, ws, gamma * h, f0 + 2, x, u, p);
+  if (ret) {
+    HYB_COUNT(ws, failed);
+    return ret;
+  }
+
+  memcpy(k1, f0, n * sizeof(hyb_float));
+  hyb_lu_solve(ws->lu, ws->piv, n - 2, k1 + 2);
+  for (size_t i = 0; i < n; i++)
+    xs[i] = x[i] + h * k1[i];
+  hyb_flow_eval(opts, ws, fs, xs, u, p);
+  for (size_t i = 0; i < n; i++)
+    k2[i] = fs[i] - 2.0 * k1[i];
+  hyb_lu_solve(ws->lu, ws->piv, n - 2, k2 + 2);
+  for (size_t i = 0; i < n; i++)
+    xp[i] = x[i] + h * (1.5 * k1[i] + 0.5 * k2[i]);
+  ws->hs = h;
+  return HYB_SUCCESS;
+}
+
+/**
+ * @brief Performs a single flow step from x to xp, of length at most h
+ *
+ * The fixed step integrators advance exactly of h, the adaptive ones of an
+ * accepted step of length at most h. If a guard is provided and it crosses
+ * zero inside the step, the step is truncated at the crossing.
+ */
+static hyb_errorcode hyb_flow(hyb_opts *opts, hyb_workspace *ws, hyb_float *xp, hyb_float h, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  const hyb_float *f1 = NULL;
+  ws->t_flow = x[0];
+  ws->event = hyb_false;
+  ws->theta = 1.0;
+  if (opts->integrator == HYB_DOPRI5) {
+    hyb_errorcode ret = hyb_dopri5(opts, ws, xp, h, x, u, p);
+    if (ret)
+      return ret;
+    f1 = ws->k[6];
+  } else if (opts->integrator == HYB_ROS2) {
+    hyb_errorcode ret = hyb_ros2(opts, ws, xp, h, x, u, p);
+    if (ret)
+      return ret;
+  } else {
+    hyb_rk4(opts, ws, xp, h, x, u, p);
+  }
+
+  if (opts->G) {
+    hyb_float g0, g1;
+    HYB_TIMED(ws, HYB_CB_G, g0 = opts->G(x[0], x[1], x + 2, hyb_u_flow(ws, u, x[0]), p));
+    if (g0 >= 0.0) {
+      HYB_TIMED(ws, HYB_CB_G, g1 = opts->G(xp[0], xp[1], xp + 2, hyb_u_flow(ws, u, xp[0]), p));
+      if (g1 < 0.0) {
+        if (!f1) {
+          hyb_flow_eval(opts, ws, ws->k[4], xp, u, p);
+          f1 = ws->k[4];
+        }
+        hyb_locate_event(opts, ws, xp, g0, g1, ws->k[0], f1, x, u, p);
+        ws->event = hyb_true;
+        HYB_COUNT(ws, events);
+      }
+    }
+  }
+
+  if (ws->dense) {
+    /* The interpolant spans the whole step, also when truncated at an event */
+    const size_t n = ws->x_size;
+    if (!f1) {
+      hyb_flow_eval(opts, ws, ws->k[4], xp, u, p);
+      f1 = ws->k[4];
+    }
+    memcpy(ws->d0, x, n * sizeof(hyb_float));
+    memcpy(ws->df0, ws->k[0], n * sizeof(hyb_float));
+    memcpy(ws->d1, ws->event ? ws->ev : xp, n * sizeof(hyb_float));
+    memcpy(ws->df1, f1, n * sizeof(hyb_float));
+  }
+  return HYB_SUCCESS;
+}
+
+void hyb_dense(const hyb_workspace *ws, hyb_float t, hyb_float *x) {
+  const hyb_float h = ws->hs;
+  hyb_float theta = h > 0.0 ? (t - ws->d0[0]) / h : 0.0;
+  theta = theta < 0.0 ? 0.0 : (theta > ws->theta ? ws->theta : theta);
+  hyb_hermite(x, theta, h, ws->x_size, ws->d0, ws->df0, ws->d1, ws->df1);
+}
+
+hyb_errorcode hyb_input_attach(hyb_workspace *ws, const hyb_input *input) {
+  if (!ws)
+    return HYB_NULLPTR;
+  free(ws->u);
+  ws->u = NULL;
+  ws->input = NULL;
+  ws->u_val = NULL;
+  ws->u_k = 0;
+  if (!input)
+    return HYB_SUCCESS;
+  if (!input->u)
+    return HYB_NULLPTR;
+  if (input->length == 0 || (!input->t && !(input->dt > 0.0)))
+    return HYB_GENERIC;
+
+  ws->u = malloc((input->u_size ? input->u_size : 1) * sizeof(hyb_float));
+  if (!ws->u)
+    return HYB_EMALLOC;
+  ws->input = input;
+  return HYB_SUCCESS;
+}
+
+const hyb_float *hyb_input_value(hyb_workspace *ws, hyb_float t) {
+  if (!ws || !ws->input)
+    return NULL;
+  return hyb_input_eval(ws, t, hyb_false);
+}
+
+const hyb_float *hyb_input_flow(hyb_workspace *ws, const hyb_float *u, hyb_float t) {
+  return hyb_u_flow(ws, u, t);
+}
+
+hyb_errorcode hyb_advance(hyb_opts *opts, hyb_workspace *ws, hyb_bool it_jumps, hyb_float *xp, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
   if (it_jumps) {
     xp[0] = x[0];
     xp[1] = x[1] + 1.0;
-    opts->J(xp + 2, x[0], x[1], x + 2, u, p);
+    HYB_TIMED(ws, HYB_CB_J, opts->J(xp + 2, x[0], x[1], x + 2, hyb_u(ws, u, x[0]), p));
+    /* The Jacobian of the implicit integrator does not survive a jump */
+    ws->jac_age = 0;
+    ws->fsal = hyb_false;
+    ws->k0_ready = hyb_false;
+#ifdef HYB_STATS
+    ws->stats.jumps++;
+    if (++ws->stats.jump_chain > ws->stats.max_jump_chain)
+      ws->stats.max_jump_chain = ws->stats.jump_chain;
+#endif
+    return HYB_SUCCESS;
+  }
+  hyb_errorcode ret = hyb_flow(opts, ws, xp, opts->Ts, x, u, p);
+#ifdef HYB_STATS
+  if (!ret) {
+    ws->stats.flow_steps++;
+    ws->stats.jump_chain = 0;
+  }
+#endif
+  return ret;
+}
+
+hyb_errorcode hyb_step(hyb_opts *opts, hyb_workspace *ws, hyb_float *y, hyb_float *xp, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+
+  if (opts->fused) {
+    hyb_bool it_jumps = hyb_fused_eval(opts, ws, y, x, u, p);
+    if (x[0] < opts->T_horizon && x[1] < opts->J_horizon)
+      return hyb_advance(opts, ws, it_jumps, xp, x, u, p);
+    ws->k0_ready = hyb_false;
   } else {
-    rk4_opts rk4_o = { opts->Ts, (opts->x_size + 2), hyb_flow_map_wrapper };
-    rk4_errorcode rk4_ret = rk4(&rk4_o, xp, tau, x, u, p, HYB_SEND_OPTS(opts));
-    if (rk4_ret) {
-      return (hyb_errorcode)rk4_ret;
+    HYB_TIMED(ws, HYB_CB_Y, opts->Y(y, x[0], x[1], x + 2, hyb_u(ws, u, x[0]), p));
+  }
+
+  if (x[0] >= opts->T_horizon)
+    return HYB_TLIMIT;
+  if (x[1] >= opts->J_horizon)
+    return HYB_JLIMIT;
+
+  return hyb_advance(opts, ws, hyb_decide(opts, ws, x, u, p), xp, x, u, p);
+}
+
+hyb_errorcode hyb_sample_step(const hyb_opts *opts, hyb_workspace *ws, hyb_float *y, hyb_float *xp, const hyb_float *x, const hyb_float *u, const hyb_float **p, hyb_float dt) {
+  const size_t n = opts->x_size + 2;
+  hyb_float *z = ws->xa;
+  const hyb_bool sub_steps = (opts->G || opts->integrator != HYB_RK4 || dt != opts->Ts) ? hyb_true : hyb_false;
+  hyb_opts step_opts = *opts;
+  const hyb_float t_end = x[0] + dt;
+
+  memcpy(z, x, n * sizeof(hyb_float));
+  for (;;) {
+    if (sub_steps)
+      step_opts.Ts = (t_end - z[0] < opts->Ts) ? t_end - z[0] : opts->Ts;
+    hyb_errorcode ret = hyb_step(&step_opts, ws, y, xp, z, u, p);
+    if (ret != HYB_SUCCESS)
+      return ret;
+    if (z[1] == xp[1] && !(sub_steps && xp[0] < t_end - HYB_EVENT_TOL * dt))
+      return HYB_SUCCESS;
+    memcpy(z, xp, n * sizeof(hyb_float));
+  }
+}
+
+hyb_errorcode hyb_main_loop(hyb_opts *opts, hyb_float *y, hyb_float *xp, hyb_float tau, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  (void) tau;
+  hyb_workspace ws;
+  hyb_errorcode ret = hyb_workspace_init(&ws, opts);
+  if (ret)
+    return ret;
+
+  ret = hyb_step(opts, &ws, y, xp, x, u, p);
+  opts->h = ws.h;
+  hyb_workspace_free(&ws);
+  return ret;
+}
+
+hyb_errorcode hyb_simulate(hyb_opts *opts, hyb_workspace *ws, hyb_trajectory *traj, const hyb_float *x0, const hyb_float *u, size_t u_stride, const hyb_float **p) {
+  if (!opts || !traj || !x0)
+    return HYB_NULLPTR;
+
+  const size_t nx = opts->x_size + 2;
+  const size_t ny = opts->y_size;
+  const hyb_bool bounded = (traj->x || traj->y) ? hyb_true : hyb_false;
+  const hyb_bool with_y = (traj->y || traj->sink) ? hyb_true : hyb_false;
+
+  traj->samples = 0;
+  traj->jumps = 0;
+  if (bounded && traj->length == 0)
+    return HYB_BUFFER;
+
+  hyb_workspace own_ws;
+  if (!ws) {
+    hyb_errorcode ret = hyb_workspace_init(&own_ws, opts);
+    if (ret)
+      return ret;
+    ws = &own_ws;
+  }
+
+  /* The workspace provides what is not stored in the trajectory */
+  hyb_float *x = traj->x ? traj->x : ws->xa;
+  hyb_float *xp = traj->x ? traj->x + nx : ws->xb;
+  hyb_float *y = traj->y ? traj->y : ws->y;
+  memcpy(x, x0, nx * sizeof(hyb_float));
+
+  hyb_errorcode ret = HYB_SUCCESS;
+  hyb_bool jumped = hyb_false;
+  size_t k = 0;
+  for (;;) {
+    hyb_bool it_jumps = hyb_false;
+    if (opts->fused)
+      it_jumps = hyb_fused_eval(opts, ws, with_y ? y : NULL, x, u, p);
+    else if (with_y)
+      HYB_TIMED(ws, HYB_CB_Y, opts->Y(y, x[0], x[1], x + 2, hyb_u(ws, u, x[0]), p));
+    traj->samples = k + 1;
+    if (traj->sink) {
+      ret = traj->sink(x, with_y ? y : NULL, jumped, traj->data);
+      if (ret)
+        break;
+    }
+
+    if (x[0] >= opts->T_horizon || x[1] >= opts->J_horizon)
+      break;
+    if (bounded && k + 1 >= traj->length) {
+      ret = HYB_BUFFER;
+      break;
     }
+
+    jumped = opts->fused ? it_jumps : hyb_decide(opts, ws, x, u, p);
+    ret = hyb_advance(opts, ws, jumped, xp, x, u, p);
+    if (ret)
+      break;
+
+    k++;
+    if (jumped) {
+      if (traj->jump_idx && traj->jumps < traj->jumps_length)
+        traj->jump_idx[traj->jumps] = k;
+      traj->jumps++;
+    } else {
+      u += u_stride;
+    }
+
+    if (traj->x) {
+      x = xp;
+      xp += nx;
+    } else {
+      hyb_float *swap = x;
+      x = xp;
+      xp = swap;
+    }
+    if (traj->y)
+      y += ny;
   }
-  return HYB_SUCCESS;
+
+  /* A fused evaluation on the last sample is not followed by a flow step */
+  ws->k0_ready = hyb_false;
+  if (ws == &own_ws)
+    hyb_workspace_free(&own_ws);
+  return ret;
+}
+
+/**
+ * @brief Produces a sample of hyb_simulate_grid from the (interpolated) state xi
+ */
+static hyb_errorcode hyb_grid_sample(hyb_opts *opts, hyb_workspace *ws, hyb_trajectory *traj, hyb_bool with_y, const hyb_float *xi, const hyb_float *u, const hyb_float **p) {
+  const size_t nx = ws->x_size, k = traj->samples;
+  hyb_float *y = traj->y ? traj->y + k * ws->y_size : ws->y;
+
+  if (traj->x)
+    memcpy(traj->x + k * nx, xi, nx * sizeof(hyb_float));
+  if (with_y)
+    HYB_TIMED(ws, HYB_CB_Y, opts->Y(y, xi[0], xi[1], xi + 2, hyb_u(ws, u, xi[0]), p));
+  traj->samples = k + 1;
+  return traj->sink ? traj->sink(xi, with_y ? y : NULL, hyb_false, traj->data) : HYB_SUCCESS;
+}
+
+hyb_errorcode hyb_simulate_grid(hyb_opts *opts, hyb_workspace *ws, hyb_trajectory *traj, const hyb_float *grid, const hyb_float *x0, const hyb_float *u, size_t u_stride, const hyb_float **p) {
+  if (!opts || !traj || !grid || !x0)
+    return HYB_NULLPTR;
+
+  const size_t nx = opts->x_size + 2;
+  const hyb_bool with_y = (traj->y || traj->sink) ? hyb_true : hyb_false;
+  hyb_bool fsal = (!u || u_stride == 0) ? hyb_true : hyb_false;
+
+  traj->samples = 0;
+  traj->jumps = 0;
+
+  hyb_workspace own_ws;
+  if (!ws) {
+    hyb_errorcode ret = hyb_workspace_init(&own_ws, opts);
+    if (ret)
+      return ret;
+    ws = &own_ws;
+  }
+  /* The derivative at the end of a step is the limit from the left of the
+     input, that differs from the start of the next one with a zero order hold */
+  if (ws->input)
+    fsal = ws->input->hold != HYB_ZOH ? hyb_true : hyb_false;
+  ws->dense = hyb_true;
+  ws->fsal = hyb_false;
+
+  hyb_float *x = ws->xa, *xp = ws->xb;
+  memcpy(x, x0, nx * sizeof(hyb_float));
+
+  hyb_errorcode ret = HYB_SUCCESS;
+  while (traj->samples < traj->length) {
+    if (x[0] >= opts->T_horizon || x[1] >= opts->J_horizon)
+      break;
+
+    hyb_bool jumped = opts->fused ? hyb_fused_eval(opts, ws, NULL, x, u, p) : hyb_decide(opts, ws, x, u, p);
+    ret = hyb_advance(opts, ws, jumped, xp, x, u, p);
+    if (ret)
+      break;
+
+    if (jumped) {
+      if (traj->jump_idx && traj->jumps < traj->jumps_length)
+        traj->jump_idx[traj->jumps] = traj->samples;
+      traj->jumps++;
+    } else {
+      /* Samples in [t0, t1) of the kept step: a sample at the time of a jump
+         is produced by the following flow step, thus after the jump */
+      while (!ret && traj->samples < traj->length && grid[traj->samples] < xp[0]) {
+        hyb_dense(ws, grid[traj->samples], ws->xs);
+        ret = hyb_grid_sample(opts, ws, traj, with_y, ws->xs, u, p);
+      }
+      if (ret)
+        break;
+      /* With a constant input the end derivative starts the next step */
+      ws->fsal = (fsal && !ws->event) ? hyb_true : hyb_false;
+      u += u_stride;
+    }
+
+    hyb_float *swap = x;
+    x = xp;
+    xp = swap;
+  }
+
+  /* Samples at the final time of the simulation (on an horizon) */
+  while (!ret && traj->samples < traj->length && grid[traj->samples] <= x[0])
+    ret = hyb_grid_sample(opts, ws, traj, with_y, x, u, p);
+
+  ws->dense = hyb_false;
+  ws->fsal = hyb_false;
+  ws->k0_ready = hyb_false;
+  if (ws == &own_ws)
+    hyb_workspace_free(&own_ws);
+  return ret;
 }
 
 void hyb_flow_map_wrapper(hyb_float *dx, hyb_float tau, const hyb_float *x, const hyb_float *u, const hyb_float **p, void *vopts) {
+  (void) tau;
   dx[0] = 1.0;
   dx[1] = 0.0;
   HYB_GET_OPTS(vopts)->F(dx + 2, x[0], x[1], x + 2, u, p);
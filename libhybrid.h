@@ -61,8 +61,17 @@
 #endif
 typedef HYB_FLOAT_TYPE hyb_float; /**< Precision typedef, used in library */
 
-#define RK4_FLOAT_TYPE HYB_FLOAT_TYPE /**< Forcing consistent types */
-#include "librk4/librk4.h"
+#include <float.h>
+/**
+ * @brief Machine epsilon of hyb_float
+ *
+ * Base of the finite differences steps: a step derived from the epsilon of
+ * double does not perturb a float state.
+ */
+#define HYB_EPSILON (sizeof(hyb_float) == sizeof(float) ? FLT_EPSILON : \
+                     (sizeof(hyb_float) == sizeof(double) ? DBL_EPSILON : LDBL_EPSILON))
+
+#include <stdlib.h>
 
 /**
  * @brief libhybrid boolean type is actually an enum
@@ -82,7 +91,7 @@ typedef enum hyb_bool {
  * The function does not need to allocate nor free the output vector,
  * but may overflow if exceedes the dimension that is declared in the
  * hyb_opts structure. Please notice that this function will be discretized
- * in a Runge Kutta 4 integrator: librk4.h.
+ * by the integrator selected in hyb_opts (see hyb_integrator).
  * When accessing an element of the parameter, please remember that the
  * implementation keeps in mind a MATLAB-like interface. If the parameters
  * (in MATLAB) are passed like:
@@ -91,7 +100,7 @@ typedef enum hyb_bool {
  * @endcode
  * then, in the C code, p1, p2 and p3 may be accessed in p as:
  * @code
- * rk4_float p1, p2, p3;
+ * hyb_float p1, p2, p3;
  * p1 = p[0][0];
  * p2 = p[1][0];
  * p3 = p[1][1];
@@ -121,7 +130,7 @@ typedef void (*hyb_flow_map)(hyb_float *xdot, hyb_float t, hyb_float j, const hy
  * @endcode
  * then, in the C code, p1, p2 and p3 may be accessed in p as:
  * @code
- * rk4_float p1, p2, p3;
+ * hyb_float p1, p2, p3;
  * p1 = p[0][0];
  * p2 = p[1][0];
  * p3 = p[1][1];
@@ -151,7 +160,7 @@ typedef void (*hyb_jump_map)(hyb_float *xp, hyb_float t, hyb_float j, const hyb_
  * @endcode
  * then, in the C code, p1, p2 and p3 may be accessed in p as:
  * @code
- * rk4_float p1, p2, p3;
+ * hyb_float p1, p2, p3;
  * p1 = p[0][0];
  * p2 = p[1][0];
  * p3 = p[1][1];
@@ -180,7 +189,7 @@ typedef void (*hyb_jump_map)(hyb_float *xp, hyb_float t, hyb_float j, const hyb_
  * @endcode
  * then, in the C code, p1, p2 and p3 may be accessed in p as:
  * @code
- * rk4_float p1, p2, p3;
+ * hyb_float p1, p2, p3;
  * p1 = p[0][0];
  * p2 = p[1][0];
  * p3 = p[1][1];
@@ -208,7 +217,7 @@ typedef hyb_bool (*hyb_jump_set)(hyb_float t, hyb_float j, const hyb_float *x, c
  * @endcode
  * then, in the C code, p1, p2 and p3 may be accessed in p as:
  * @code
- * rk4_float p1, p2, p3;
+ * hyb_float p1, p2, p3;
  * p1 = p[0][0];
  * p2 = p[1][0];
  * p3 = p[1][1];
@@ -224,6 +233,77 @@ typedef hyb_bool (*hyb_flow_set)(hyb_float t, hyb_float j, const hyb_float *x, c
 
 typedef void (*hyb_out_map)(hyb_float *y, hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p);
 
+/**
+ * @brief Callback definition for the Jump Guard
+ *
+ * Optional callback that returns a signed distance from the jump set: it must
+ * be positive when the state is outside the jump set and zero or negative
+ * inside it (thus it must be consistent with the Jump Set callback).
+ * When a guard is provided, a flow step that drives the guard from a non
+ * negative value to a negative one is truncated at the crossing, which is
+ * located through root finding on a dense output interpolant of the step.
+ * The step ends just after the crossing, strictly inside the jump set, thus
+ * the next step will be a jump step, taken at the correct time.
+ * For the bouncing ball the guard is simply the height of the ball.
+ * @param t is the current time
+ * @param j is the  discrete time
+ * @param x a constant array with the current state
+ * @param u a constant array with current input
+ * @param p a pointer to arrays of parameters. This allows the compatibility with the
+ *          MATLAB System Identification Toolbox
+ * @return the signed distance from the jump set
+ */
+typedef hyb_float (*hyb_guard)(hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p);
+
+/**
+ * @brief Callback definition for a Jacobian
+ *
+ * The callback stores in the first pointer the Jacobian of one of the maps
+ * (flow, jump, guard or output) with respect to the state or to the
+ * parameters, evaluated in (t, j, x, u, p). The matrix is stored column-major
+ * (MATLAB-like): the element (r, c) is jac[r + c * rows]. Jacobians with
+ * respect to the parameters consider the scalar parameters in the order of
+ * the parameter arrays, thus for the parameters of the example:
+ * @code
+ * f(t, x, u, p1, [p2, p3])
+ * @endcode
+ * the column 0 is p1, the column 1 is p2 and the column 2 is p3.
+ * @param jac an array in which the result will be stored
+ * @param t is the current time
+ * @param j is the  discrete time
+ * @param x a constant array with the current state
+ * @param u a constant array with current input
+ * @param p a pointer to arrays of parameters. This allows the compatibility with the
+ *          MATLAB System Identification Toolbox
+ */
+typedef void (*hyb_jacobian)(hyb_float *jac, hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p);
+
+/**
+ * @brief Fused model evaluation function pointer
+ *
+ * Evaluates in a single call everything the engine needs at the start of a
+ * step: the output, the jump and flow sets and the flow map. Models in which
+ * these quantities share intermediate results can provide it to avoid the
+ * separate calls of the output map, the sets and the first stage of the
+ * integrator. When it is provided, it replaces Y, D and C in the step
+ * functions and the first flow map evaluation of each flow step. Y, D and C
+ * are still used by the functions that evaluate a single map (hyb_it_jumps).
+ * @param y an array in which the output will be stored, or NULL if the output
+ *          is not required
+ * @param d the jump set membership of x
+ * @param c the flow set membership of x, or NULL if it is not required
+ *          (HYB_JUMP_LOGIC 1)
+ * @param xdot an array in which the flow map at x will be stored. It is not
+ *             used if x is in the jump set, thus it may be skipped in that case
+ * @param t is the current time
+ * @param j is the  discrete time
+ * @param x a constant array with the current state
+ * @param u a constant array with current input
+ * @param p a pointer to arrays of parameters. This allows the compatibility with the
+ *          MATLAB System Identification Toolbox
+ */
+typedef void (*hyb_fused)(hyb_float *y, hyb_bool *d, hyb_bool *c, hyb_float *xdot, hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p);
+
 /**
  * @brief Jump logic implementation
  *
@@ -235,6 +315,71 @@ typedef void (*hyb_out_map)(hyb_float *y, hyb_float t, hyb_float j, const hyb_fl
 #define HYB_JUMP_LOGIC 1
 #endif
 
+/**
+ * @brief Integrator for the flow map
+ *
+ * The default integrator is the fixed step Runge Kutta 4, that
+ * advances of exactly Ts at each flow step. The Dormand-Prince 5(4) is an
+ * adaptive integrator with error control: each flow step is a single accepted
+ * step whose length is chosen by the integrator, limited by Ts, which thus
+ * becomes the maximum step length. The proposed step length is kept in
+ * the hyb_workspace across calls. The Rosenbrock ROS2 is a linearly implicit,
+ * L-stable, second order W-method for stiff flow maps: it advances of exactly
+ * Ts and solves two linear systems per step with the matrix I - gamma Ts J,
+ * where J is the Jacobian of the flow map (hyb_opts::Fx, or finite
+ * differences if not provided). Being a W-method, its order does not depend
+ * on the accuracy of J: the Jacobian and its LU factorization are kept in the
+ * workspace and reused for up to HYB_ROS2_MAX_AGE steps, and they are
+ * recomputed after every jump or change of the step length.
+ */
+typedef enum hyb_integrator {
+  HYB_RK4 = 0, /**< Fixed step Runge Kutta 4 (default) */
+  HYB_DOPRI5,  /**< Adaptive Dormand-Prince 5(4) */
+  HYB_ROS2     /**< Linearly implicit Rosenbrock 2 (stiff flow maps) */
+} hyb_integrator;
+
+#ifndef HYB_DEFAULT_ATOL
+#define HYB_DEFAULT_ATOL 1e-6 /**< Absolute tolerance used when hyb_opts::atol is zero */
+#endif
+
+#ifndef HYB_DEFAULT_RTOL
+#define HYB_DEFAULT_RTOL 1e-3 /**< Relative tolerance used when hyb_opts::rtol is zero */
+#endif
+
+#ifndef HYB_CACHE_LINE
+#define HYB_CACHE_LINE 64 /**< Alignment of the workspace vectors, in bytes */
+#endif
+
+#define HYB_WS_STAGES 7 /**< Number of stage vectors in the workspace (Dormand-Prince 5(4)) */
+
+/**
+ * @brief Instruction set of the stage kernels of the integrators
+ *
+ * The level is detected at runtime by hyb_workspace_init (x86 with GCC or
+ * Clang, double precision only) and stored in the workspace, where it may be
+ * lowered. All the levels give the same results: the kernels are compiled
+ * without fused multiply-add contraction, whatever the flags of the build
+ * (GCC or Clang). Define HYB_NO_SIMD to compile the scalar kernels only.
+ */
+typedef enum hyb_simd {
+  HYB_SIMD_NONE = 0, /**< Scalar loops */
+  HYB_SIMD_SSE2,     /**< 128 bit vectors */
+  HYB_SIMD_AVX2,     /**< 256 bit vectors */
+  HYB_SIMD_AVX512    /**< 512 bit vectors */
+} hyb_simd;
+
+#ifndef HYB_ROS2_MAX_AGE
+#define HYB_ROS2_MAX_AGE 10 /**< Number of ROS2 steps that reuse the same Jacobian */
+#endif
+
+#ifndef HYB_EVENT_TOL
+#define HYB_EVENT_TOL 1e-12 /**< Tolerance on the event time, relative to the step */
+#endif
+
+#ifndef HYB_EVENT_MAXITER
+#define HYB_EVENT_MAXITER 60 /**< Maximum number of iterations for event location */
+#endif
+
 /**
  * @brief Options structure for the hybrid system
  */
@@ -249,6 +394,13 @@ typedef struct hyb_opts {
   hyb_out_map Y; /**< Output map function pointer */
   hyb_jump_set D; /**< Jump set function pointer */
   hyb_flow_set C; /**< Flow set function pointer */
+  hyb_guard G; /**< Jump guard function pointer (optional, NULL disables event location) */
+  hyb_integrator integrator; /**< Flow integrator (default HYB_RK4) */
+  hyb_float atol; /**< Absolute tolerance for adaptive integrators */
+  hyb_float rtol; /**< Relative tolerance for adaptive integrators */
+  hyb_float h; /**< Initial step length for adaptive integrators (0 for Ts) */
+  hyb_jacobian Fx; /**< Flow map Jacobian with respect to the state (optional, x_size * x_size, used by HYB_ROS2 and sensitivities) */
+  hyb_fused fused; /**< Fused output, sets and flow map evaluation (optional, NULL uses Y, D, C and F) */
 } hyb_opts;
 
 #define HYB_GET_OPTS(S) ((hyb_opts *)S) /**< Converts the void pointer in option struct pointer. For internal use only */
@@ -261,9 +413,174 @@ typedef enum hyb_errorcode {
   HYB_GENERIC,     /**< Unknown error generated */
   HYB_TLIMIT,      /**< Reached time limit */
   HYB_JLIMIT,      /**< Reached step limit */
-  HYB_NOJUMP       /**< Invalid jump condition (Both c = 0 and d = 0). Not implemented */
+  HYB_NOJUMP,      /**< Invalid jump condition (Both c = 0 and d = 0). Not implemented */
+  HYB_BUFFER,      /**< Trajectory buffer exhausted before reaching an horizon */
+  HYB_STEPSIZE,    /**< Step length underflow in the adaptive integrator */
+  HYB_SINGULAR,    /**< Singular iteration matrix in the implicit integrator */
+  HYB_IO,          /**< Input / output error on a trajectory file */
+  HYB_ABORT        /**< Simulation stopped early by a cost bound (see hyb_accum) */
 } hyb_errorcode;
 
+/**
+ * @brief Callback definition for the trajectory sink
+ *
+ * The sink is called by hyb_simulate for each sample of the trajectory, right
+ * after the sample is produced. The pointers are valid only during the call:
+ * if the data must be kept, the sink has to copy them.
+ * @param x the augmented state of the sample (flow time, jump time, state)
+ * @param y the output of the sample, NULL if the output is not requested
+ * @param jumped hyb_true if the sample is the result of a jump step
+ * @param data user data, as set in the hyb_trajectory structure
+ * @return HYB_SUCCESS to continue the simulation. Any other value stops
+ *         the simulation and it is returned by hyb_simulate
+ */
+typedef hyb_errorcode (*hyb_sink)(const hyb_float *x, const hyb_float *y, hyb_bool jumped, void *data);
+
+/**
+ * @brief Trajectory descriptor for the whole horizon simulation
+ *
+ * The trajectory buffers are allocated by the caller and are filled by
+ * hyb_simulate. Samples are stored contiguously: the k-th augmented state
+ * starts at x + k * (x_size + 2) and the k-th output at y + k * y_size.
+ * The first sample is always the initial state. Any buffer may be NULL, in
+ * that case the relative quantity is not stored (and the output map is not
+ * evaluated at all if neither y nor sink are provided).
+ */
+typedef struct hyb_trajectory {
+  size_t length;       /**< Capacity of x and y, in samples. Ignored (unbounded) if both are NULL */
+  size_t samples;      /**< Number of produced samples (output) */
+  hyb_float *x;        /**< Augmented state buffer, (x_size + 2) * length elements */
+  hyb_float *y;        /**< Output buffer, y_size * length elements */
+  size_t jumps_length; /**< Capacity of jump_idx */
+  size_t jumps;        /**< Number of jumps performed (output). May exceed jumps_length */
+  size_t *jump_idx;    /**< Indexes of the samples produced by a jump step */
+  hyb_sink sink;       /**< Optional callback for each sample */
+  void *data;          /**< User data for the sink */
+} hyb_trajectory;
+
+/**
+ * @brief Callbacks of a model, as indexes of the hyb_stats counters
+ */
+typedef enum hyb_callback {
+  HYB_CB_F = 0, /**< Flow map */
+  HYB_CB_J,     /**< Jump map */
+  HYB_CB_Y,     /**< Output map */
+  HYB_CB_D,     /**< Jump set */
+  HYB_CB_C,     /**< Flow set */
+  HYB_CB_G,     /**< Jump guard */
+  HYB_CB_FUSED, /**< Fused model evaluation */
+  HYB_CB_FX,    /**< Flow map Jacobian */
+  HYB_CB_SIZE   /**< Number of callbacks */
+} hyb_callback;
+
+/**
+ * @brief Runtime statistics of a workspace
+ *
+ * The statistics are collected only if the library is compiled with the
+ * macro HYB_STATS defined (in all the compilation units that include this
+ * header): otherwise the workspace does not contain them and the hot path is
+ * not instrumented at all. They are accumulated by the stepping functions
+ * that receive a workspace (hyb_step, hyb_advance, hyb_simulate and the
+ * drivers built on them). Times are in ticks of the time stamp counter where
+ * available (x86, ARM64), in nanoseconds otherwise.
+ */
+typedef struct hyb_stats {
+  unsigned long long flow_steps;            /**< Accepted flow steps */
+  unsigned long long jumps;                 /**< Jump steps */
+  unsigned long long events;                /**< Flow steps truncated at an event */
+  unsigned long long rejected;              /**< Steps rejected by the adaptive integrator */
+  unsigned long long failed;                /**< Flow steps that failed (step length underflow, singular matrix) */
+  unsigned long long jacobians;             /**< Jacobian evaluations of the implicit integrator */
+  unsigned long long factorizations;        /**< LU factorizations of the implicit integrator */
+  unsigned long long calls[HYB_CB_SIZE];    /**< Calls of each callback */
+  unsigned long long ticks[HYB_CB_SIZE];    /**< Time spent in each callback */
+  unsigned long long jump_chain;            /**< Length of the current chain of consecutive jumps */
+  unsigned long long max_jump_chain;        /**< Longest chain of consecutive jumps */
+} hyb_stats;
+
+/**
+ * @brief Interpolation of a sampled input signal
+ */
+typedef enum hyb_hold {
+  HYB_ZOH = 0, /**< Zero order hold: the sample holds until the next one */
+  HYB_FOH,     /**< First order hold: linear interpolation between samples */
+  HYB_CUBIC    /**< Cubic Hermite interpolation with centered difference slopes (Catmull-Rom) */
+} hyb_hold;
+
+/**
+ * @brief Sampled input signal
+ *
+ * Describes a caller owned matrix of input samples, that is never copied:
+ * the k-th sample starts at u + k * stride and is taken at the time t[k]
+ * (strictly increasing), or at t0 + k * dt if t is NULL. Before the first
+ * sample and after the last one the input is held constant. Attached to a
+ * workspace (see hyb_input_attach), it is evaluated at the time of each
+ * callback call, thus at the stage times of the integrator.
+ */
+typedef struct hyb_input {
+  const hyb_float *u; /**< Input samples */
+  const hyb_float *t; /**< Sample times, length elements (NULL for a uniform sampling) */
+  hyb_float t0;       /**< Time of the first sample (uniform sampling) */
+  hyb_float dt;       /**< Sampling period (uniform sampling) */
+  size_t u_size;      /**< Input size */
+  size_t length;      /**< Number of samples */
+  size_t stride;      /**< Distance between two consecutive samples (0 for u_size) */
+  hyb_hold hold;      /**< Interpolation between the samples */
+} hyb_input;
+
+/**
+ * @brief Workspace for the integration of a model
+ *
+ * The workspace contains all the vectors needed by the stepping functions,
+ * allocated once in a single block. Each vector is padded to a cache line
+ * and placed so that the state (after flow time and jump time) starts on a
+ * cache line boundary, for the vector kernels. It is created once
+ * per model instance through hyb_workspace_init and released through
+ * hyb_workspace_free: stepping functions that receive a workspace do not
+ * perform any heap allocation. A workspace must not be shared between
+ * threads. All the members are for internal use only: after a flow step the
+ * stage vectors hold the stages of the integrator (the first one is always
+ * the derivative at the initial state).
+ */
+typedef struct hyb_workspace {
+  size_t x_size;               /**< Augmented state size (x_size + 2) */
+  size_t y_size;               /**< Output size */
+  hyb_float *k[HYB_WS_STAGES]; /**< Stage derivatives */
+  hyb_float *xs;               /**< Stage state */
+  hyb_float *ev;               /**< Event location scratch state */
+  hyb_float *xa;               /**< Scratch state for the drivers */
+  hyb_float *xb;               /**< Scratch state for the drivers */
+  hyb_float *d0;               /**< Dense output: state at the start of the last flow step */
+  hyb_float *df0;              /**< Dense output: derivative at the start of the last flow step */
+  hyb_float *d1;               /**< Dense output: state at the end of the last (not truncated) flow step */
+  hyb_float *df1;              /**< Dense output: derivative at the end of the last (not truncated) flow step */
+  hyb_float *y;                /**< Scratch output for the drivers */
+  hyb_float h;                 /**< Proposed step length of adaptive integrators */
+  hyb_float hs;                /**< Length of the last flow step, before event truncation */
+  hyb_float theta;             /**< Fraction of the last flow step that is kept (1 without events) */
+  hyb_bool event;              /**< hyb_true if the last flow step was truncated at an event, ev holds its end */
+  hyb_bool dense;              /**< If hyb_true, flow steps keep the dense output interpolant (see hyb_dense) */
+  hyb_bool fsal;               /**< If hyb_true, the next flow step starts from df1 instead of evaluating the flow map */
+  hyb_bool k0_ready;           /**< If hyb_true, k[0] holds the flow map at the start of the next flow step (fused callback) */
+  hyb_float *jac;              /**< Flow map Jacobian, x_size * x_size (HYB_ROS2 only, otherwise NULL) */
+  hyb_float *lu;               /**< LU factors of I - gamma h jac (HYB_ROS2 only) */
+  size_t *piv;                 /**< Pivoting of the LU factors (HYB_ROS2 only) */
+  hyb_float h_lu;              /**< Step length of the LU factors */
+  size_t jac_age;              /**< Steps performed with the current Jacobian, 0 if it is not valid */
+  const hyb_input *input;      /**< Attached input signal, NULL to use the input arguments */
+  hyb_float *u;                /**< Interpolated input, u_size (allocated by hyb_input_attach) */
+  const hyb_float *u_val;      /**< Input at u_t, NULL if not evaluated */
+  hyb_float u_t;               /**< Time of u_val */
+  hyb_bool u_left;             /**< hyb_true if u_val is the limit from the left */
+  hyb_float t_flow;            /**< Initial time of the current flow step */
+  size_t u_k;                  /**< Sample interval of the last input evaluation */
+  hyb_simd simd;               /**< Instruction set of the stage kernels */
+#ifdef HYB_STATS
+  hyb_stats stats;             /**< Runtime statistics */
+#endif
+  void *block;                 /**< Allocated memory block */
+} hyb_workspace;
+
 /**
  * @brief Hybrid system main loop
  *
@@ -273,10 +590,14 @@ typedef enum hyb_errorcode {
  *     * if jump is requsted, it enters a loop of update until no jump should be performed
  *     * else the execution continues
  * 3. The
+ *
+ * This function allocates a temporary workspace at each call: in loops,
+ * prefer hyb_step with a workspace that lives across calls. The proposed step
+ * length of adaptive integrators is kept in hyb_opts::h between calls.
  * @param opts pointer to an option structure
  * @param y vector that will contain the next output. It must be already allocated
  * @param xp vector that will contain the next state (already integrated in case of flowing step). It must be already allocated
- * @param tau integration engine time
+ * @param tau integration engine time (unused, kept for compatibility)
  * @param x current state
  * @param u current input
  * @param p parameter vector
@@ -285,13 +606,282 @@ typedef enum hyb_errorcode {
 hyb_errorcode hyb_main_loop(hyb_opts *opts, hyb_float *y, hyb_float *xp, hyb_float tau, const hyb_float *x, const hyb_float *u, const hyb_float **p);
 
 /**
- * @brief Internal callback for discretization step
+ * @brief Evaluates the jump decision for the current state
+ *
+ * Evaluates the jump set (and the flow set, if required) and combines them
+ * following the logic selected through HYB_JUMP_LOGIC. It is the decision
+ * used by hyb_main_loop and by all the drivers of the library.
+ * @param opts pointer to an option structure
+ * @param x current augmented state (flow time, jump time, state)
+ * @param u current input
+ * @param p parameter vector
+ * @return hyb_true if the next step is a jump step
+ */
+hyb_bool hyb_it_jumps(hyb_opts *opts, const hyb_float *x, const hyb_float *u, const hyb_float **p);
+
+/**
+ * @brief Whole horizon simulation driver
+ *
+ * Runs the hybrid system from the initial state until the time horizon or the
+ * jump horizon is reached, using the same step logic of hyb_main_loop. The
+ * states are integrated directly in the trajectory buffer, thus there is no
+ * copy between steps and the output map is evaluated only once per sample.
+ * The input vector is advanced by u_stride elements after each flow step
+ * (a jump step does not consume input), so that a sampled input stays
+ * synchronized with the flow time. Use u_stride = 0 for a constant input.
+ * If an input signal is attached to the workspace (hyb_input_attach), u and
+ * u_stride are ignored.
+ * @param opts pointer to an option structure
+ * @param ws workspace initialized for the model. If NULL, a temporary
+ *        workspace is allocated for the call
+ * @param traj trajectory descriptor, with buffers already allocated
+ * @param x0 initial augmented state (flow time, jump time, state)
+ * @param u input vector (or matrix of input samples, one per column)
+ * @param u_stride distance between two consecutive input samples
+ * @param p parameter vector
+ * @return HYB_SUCCESS if an horizon is reached, HYB_BUFFER if the trajectory
+ *         is full before reaching an horizon, or the error of the failing step
+ */
+hyb_errorcode hyb_simulate(hyb_opts *opts, hyb_workspace *ws, hyb_trajectory *traj, const hyb_float *x0, const hyb_float *u, size_t u_stride, const hyb_float **p);
+
+/**
+ * @brief Whole horizon simulation, sampled on an arbitrary time grid
+ *
+ * The integration proceeds with the step of the integrator, while states and
+ * outputs are produced at the times of the grid through the dense output of
+ * the flow steps (see hyb_dense), thus the sampling does not constrain the
+ * integration step. The grid must be non decreasing and hold traj->length
+ * times: the k-th sample of the trajectory is the state at grid[k]. A grid
+ * time that coincides with a jump gives the state after the jump(s). The
+ * sink, if any, is called for each sample (jumped is always hyb_false) and
+ * traj->jump_idx holds the number of samples produced before each jump.
+ * The simulation stops once the whole grid is sampled or on an horizon: in
+ * that case traj->samples may be less than traj->length. The input follows
+ * the convention of hyb_simulate; when it is constant (u_stride = 0) the
+ * derivative at the end of a flow step is reused at the start of the next.
+ * An input signal attached to the workspace replaces u and u_stride.
+ * @param opts pointer to an option structure
+ * @param ws workspace initialized for the model (NULL for a temporary one)
+ * @param traj trajectory descriptor: length, buffers (optional) and sink (optional)
+ * @param grid sample times, traj->length elements
+ * @param x0 initial augmented state (flow time, jump time, state)
+ * @param u input vector (or matrix of input samples, one per column)
+ * @param u_stride distance between two consecutive input samples
+ * @param p parameter vector
+ * @return HYB_SUCCESS, or the error code of a callback or of the integrator
+ */
+hyb_errorcode hyb_simulate_grid(hyb_opts *opts, hyb_workspace *ws, hyb_trajectory *traj, const hyb_float *grid, const hyb_float *x0, const hyb_float *u, size_t u_stride, const hyb_float **p);
+
+/**
+ * @brief Evaluates the dense output of the last flow step
+ *
+ * When ws->dense is set, each flow step keeps a cubic Hermite interpolant
+ * built from the states and the derivatives at its ends. The function
+ * evaluates it at the flow time t: times outside the step (or beyond the
+ * event that truncated it) are clamped to its ends. The jump time is the one
+ * of the step.
+ * @param ws the workspace of the last flow step
+ * @param t flow time
+ * @param x the interpolated augmented state (output)
+ */
+void hyb_dense(const hyb_workspace *ws, hyb_float t, hyb_float *x);
+
+/**
+ * @brief Tolerance on the sample times of an input signal
+ *
+ * Relative to the sampling interval: times closer than this to a sample time
+ * are considered on the sample, so that a flow step that ends on a sample
+ * time accumulated with rounding errors still takes the hold of the samples
+ * it integrates.
+ */
+#ifndef HYB_INPUT_TOL
+#define HYB_INPUT_TOL 1e-9
+#endif
+
+/**
+ * @brief Attaches a sampled input signal to a workspace
+ *
+ * While attached, the stepping functions and the drivers that receive the
+ * workspace ignore their input argument: each callback receives the input
+ * interpolated at its own time. The flow map at the stages of a flow step
+ * that starts from t0 sees the input on (t0, t1] as the limit from the left,
+ * so that a zero order hold input that changes at t1 is not applied before
+ * the step that starts from t1. For full accuracy with a zero order hold
+ * input, its sample times should be multiples of the flow step Ts. The
+ * signal description and its samples must remain valid while attached.
+ * @param ws the workspace
+ * @param input the input signal, or NULL to detach the current one
+ * @return HYB_SUCCESS, HYB_NULLPTR (no workspace, samples or times),
+ *         HYB_GENERIC (no samples or non positive period) or HYB_EMALLOC
+ */
+hyb_errorcode hyb_input_attach(hyb_workspace *ws, const hyb_input *input);
+
+/**
+ * @brief Evaluates the input signal attached to a workspace
+ * @param ws the workspace, with an attached input
+ * @param t time
+ * @return the input at t (from the right), valid until the next evaluation,
+ *         or NULL if no input is attached. It may point directly to the
+ *         samples of the signal
+ */
+const hyb_float *hyb_input_value(hyb_workspace *ws, hyb_float t);
+
+/**
+ * @brief Initializes a workspace for a model
+ *
+ * The vectors are sized on the option structure, that must not change its
+ * sizes (nor switch to HYB_ROS2, that needs the Jacobian storage) as long as
+ * the workspace is in use.
+ * @param ws the workspace to initialize
+ * @param opts pointer to the option structure of the model
+ * @return HYB_SUCCESS, HYB_NULLPTR or HYB_EMALLOC
+ */
+hyb_errorcode hyb_workspace_init(hyb_workspace *ws, const hyb_opts *opts);
+
+/**
+ * @brief Releases a workspace
+ * @param ws the workspace to release
+ */
+void hyb_workspace_free(hyb_workspace *ws);
+
+/**
+ * @brief Reads the runtime statistics of a workspace
+ * @param ws the workspace
+ * @param stats the statistics (output). Zeroed if statistics are not compiled
+ * @return HYB_SUCCESS, HYB_NULLPTR, or HYB_GENERIC if the library is compiled
+ *         without HYB_STATS
+ */
+hyb_errorcode hyb_stats_get(const hyb_workspace *ws, hyb_stats *stats);
+
+/**
+ * @brief Resets the runtime statistics of a workspace
+ * @param ws the workspace
+ */
+void hyb_stats_reset(hyb_workspace *ws);
+
+#define HYB_CHECKPOINT_VERSION 1 /**< Version of the checkpoint format */
+
+/**
+ * @brief Size in bytes of a checkpoint of a workspace
+ * @param ws the workspace
+ * @return the size of the blob for hyb_checkpoint_save
+ */
+size_t hyb_checkpoint_size(const hyb_workspace *ws);
+
+/**
+ * @brief Saves the state of a simulation in a checkpoint
+ *
+ * The checkpoint is a versioned, self-checking blob with the augmented state
+ * x and everything in the workspace that influences the following steps: the
+ * step length history of the adaptive integrators, the Jacobian and the LU
+ * factors of the implicit one, the dense output of the last flow step and
+ * the statistics (if compiled). A simulation that restarts from a restored
+ * checkpoint, with the same options, inputs and parameters, reproduces the
+ * original one bit for bit. Since the options are not part of the checkpoint,
+ * a restored simulation may continue with extended horizons, and a single
+ * checkpoint may be restored in many workspaces to branch continuations. In
+ * hyb_simulate the checkpoint can be taken from the sink (passing the
+ * workspace through the sink data), with x the sample received by the sink:
+ * the simulation is resumed calling hyb_simulate from the restored x.
+ * @param ws the workspace
+ * @param x the augmented state (flow time, jump time, state)
+ * @param blob the destination buffer
+ * @param size size of the destination buffer (at least hyb_checkpoint_size)
+ * @return HYB_SUCCESS, HYB_NULLPTR or HYB_BUFFER if the buffer is too small
+ */
+hyb_errorcode hyb_checkpoint_save(const hyb_workspace *ws, const hyb_float *x, void *blob, size_t size);
+
+/**
+ * @brief Restores a checkpoint in a workspace
+ *
+ * The workspace must be initialized for the same model (same sizes and, to
+ * restore the implicit integrator state, the same integrator).
+ * @param ws the workspace
+ * @param x the augmented state (output)
+ * @param blob the checkpoint
+ * @param size size of the checkpoint buffer
+ * @return HYB_SUCCESS, HYB_NULLPTR, or HYB_GENERIC if the blob is corrupted,
+ *         of a different version or precision, or for a different model
+ */
+hyb_errorcode hyb_checkpoint_load(hyb_workspace *ws, hyb_float *x, const void *blob, size_t size);
+
+/**
+ * @brief Hybrid system step, allocation free
+ *
+ * Performs the same operations of hyb_main_loop, using the vectors of the
+ * workspace. It never returns HYB_EMALLOC.
+ * @param opts pointer to an option structure
+ * @param ws workspace initialized for the model
+ * @param y vector that will contain the next output. It must be already allocated
+ * @param xp vector that will contain the next state. It must be already allocated
+ * @param x current state
+ * @param u current input (ignored if an input signal is attached to ws)
+ * @param p parameter vector
+ * @return an exit codes, as described in hyb_errorcode
+ */
+hyb_errorcode hyb_step(hyb_opts *opts, hyb_workspace *ws, hyb_float *y, hyb_float *xp, const hyb_float *x, const hyb_float *u, const hyb_float **p);
+
+/**
+ * @brief Advances the model of one sample, absorbing the jumps
+ *
+ * This is the System Identification step: jumps are not returned, and the
+ * function exits only when a flow step has covered the whole sample of length
+ * dt. With event location or an adaptive integrator (or a sample length
+ * different from Ts) a flow step may stop before the end of the sample: in that
+ * case the loop continues with a shorter maximum step until the sample is
+ * covered. The output is the one evaluated at the beginning of the last flow
+ * step. The scratch state is the workspace buffer xa.
+ * @param opts pointer to an option structure
+ * @param ws workspace initialized for the model
+ * @param y output vector of size y_size
+ * @param xp state at the end of the sample
+ * @param x state at the beginning of the sample
+ * @param u input vector for the sample
+ * @param p parameter vector
+ * @param dt sample length
+ * @return an error code (HYB_SUCCESS if no error)
+ */
+hyb_errorcode hyb_sample_step(const hyb_opts *opts, hyb_workspace *ws, hyb_float *y, hyb_float *xp, const hyb_float *x, const hyb_float *u, const hyb_float **p, hyb_float dt);
+
+/**
+ * @brief Performs a single jump or flow step, without output nor horizon checks
+ *
+ * Building block for drivers: the jump decision is taken by the caller
+ * (usually through hyb_it_jumps). A jump step applies the jump map, a flow
+ * step integrates for Ts with the selected integrator (and event location).
+ * @param opts pointer to an option structure
+ * @param ws workspace initialized for the model
+ * @param it_jumps hyb_true for a jump step, hyb_false for a flow step
+ * @param xp vector that will contain the next state. It must be already allocated
+ * @param x current state
+ * @param u current input
+ * @param p parameter vector
+ * @return an exit codes, as described in hyb_errorcode
+ */
+hyb_errorcode hyb_advance(hyb_opts *opts, hyb_workspace *ws, hyb_bool it_jumps, hyb_float *xp, const hyb_float *x, const hyb_float *u, const hyb_float **p);
+
+/**
+ * @brief Input of the callbacks inside the last flow step
+ *
+ * Building block for drivers that evaluate the model along a flow step taken
+ * by hyb_advance: the input is evaluated as the integrator does (from the
+ * left after the start of the step).
+ * @param ws workspace of the last flow step
+ * @param u input passed to hyb_advance
+ * @param t time inside the step
+ * @return u if no input signal is attached to the workspace, the value of
+ *         the attached signal at t otherwise (valid until the next evaluation)
+ */
+const hyb_float *hyb_input_flow(hyb_workspace *ws, const hyb_float *u, hyb_float t);
+
+/**
+ * @brief Augmented flow map in the form of the former librk4 callback
  *
- * @warning This is for internal use only, do not use directly.
- * This callback has been implemented in order to respond to rk4_ode
- * requirements.
+ * @deprecated The library integrates the flow map directly and no longer
+ * uses this callback, nor librk4. It is kept only for source compatibility
+ * and it will be removed.
  * @param dx output of the callback
- * @param tau hybrid time step, is probably different with respect to the evolution time
+ * @param tau hybrid time step (unused)
  * @param x the current state, contains time and jump state
  * @param u the current control
  * @param p the parameter vector of vectors
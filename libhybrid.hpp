@@ -0,0 +1,308 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2018 - Matteo Ragni, Matteo Cocetti - University of Trento
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#ifndef LIBHYBRID_HPP_
+#define LIBHYBRID_HPP_
+
+/**
+ * @file libhybrid.hpp
+ * @author Matteo Ragni, Matteo Cocetti
+ *
+ * Header only C++ front-end. The model is a functor type and the sizes are
+ * compile time constants, thus the model maps are inlined in the Runge Kutta
+ * 4 step and the stage loops can be unrolled by the compiler. The jump logic
+ * is a template policy instead of the HYB_JUMP_LOGIC macro.
+ *
+ * A model is a default constructible type with the following members
+ * (X is std::array<hyb_float, NX>, Y is std::array<hyb_float, NY>, U and P
+ * are the input and parameter types chosen by the user):
+ * @code
+ * struct Model {
+ *   void flow(X &xdot, hyb_float t, hyb_float j, const X &x, const U &u, const P &p) const;
+ *   void jump(X &xp, hyb_float t, hyb_float j, const X &x, const U &u, const P &p) const;
+ *   void output(Y &y, hyb_float t, hyb_float j, const X &x, const U &u, const P &p) const;
+ *   bool jump_set(hyb_float t, hyb_float j, const X &x, const U &u, const P &p) const;
+ *   bool flow_set(hyb_float t, hyb_float j, const X &x, const U &u, const P &p) const;
+ * };
+ * @endcode
+ * If U is const hyb_float * and P is const hyb_float **, the same model can be
+ * exported through the C interface with hybrid::c_options, for example to be
+ * used by the MEX wrapper (compiled with HYB_MODEL_EXTERN):
+ * @code
+ * extern "C" {
+ *   hyb_opts options = hybrid::c_options<Model, 2, 1>(1e-3, 30.0, 30.0);
+ * }
+ * @endcode
+ */
+
+#include <array>
+#include <cstddef>
+
+extern "C" {
+#include "libhybrid.h"
+}
+
+namespace hybrid {
+
+/**
+ * @brief Jump logic with precedence on the jump map (HYB_JUMP_LOGIC 1)
+ */
+struct JumpPrecedence {
+  template <class Model, class X, class U, class P>
+  static bool jumps(const Model &m, hyb_float t, hyb_float j, const X &x, const U &u, const P &p) {
+    return m.jump_set(t, j, x, u, p);
+  }
+};
+
+/**
+ * @brief Jump logic with precedence on the flow map (HYB_JUMP_LOGIC 2)
+ */
+struct FlowPrecedence {
+  template <class Model, class X, class U, class P>
+  static bool jumps(const Model &m, hyb_float t, hyb_float j, const X &x, const U &u, const P &p) {
+    return m.jump_set(t, j, x, u, p) && !m.flow_set(t, j, x, u, p);
+  }
+};
+
+/**
+ * @brief Augmented state: flow time, jump time and state
+ *
+ * The layout is the same of the augmented vectors of the C interface, but
+ * conversions must be performed through from_c and to_c.
+ */
+template <std::size_t NX>
+struct State {
+  hyb_float t;                   /**< Flow time */
+  hyb_float j;                   /**< Jump time */
+  std::array<hyb_float, NX> x;   /**< State */
+
+  /** @brief Builds the state from an augmented C vector */
+  static State from_c(const hyb_float *v) {
+    State s;
+    s.t = v[0];
+    s.j = v[1];
+    for (std::size_t i = 0; i < NX; i++)
+      s.x[i] = v[i + 2];
+    return s;
+  }
+
+  /** @brief Copies the state in an augmented C vector */
+  void to_c(hyb_float *v) const {
+    v[0] = t;
+    v[1] = j;
+    for (std::size_t i = 0; i < NX; i++)
+      v[i + 2] = x[i];
+  }
+};
+
+/**
+ * @brief Hybrid system with compile time sizes and inlined model
+ * @tparam Model the model functor type
+ * @tparam NX state size
+ * @tparam NY output size
+ * @tparam JumpLogic jump logic policy (JumpPrecedence or FlowPrecedence)
+ */
+template <class Model, std::size_t NX, std::size_t NY, class JumpLogic = JumpPrecedence>
+class System {
+ public:
+  typedef std::array<hyb_float, NX> X;  /**< State type */
+  typedef std::array<hyb_float, NY> Y;  /**< Output type */
+  typedef hybrid::State<NX> State;      /**< Augmented state type */
+
+  /**
+   * @brief Builds the system
+   * @param Ts integration step
+   * @param T_horizon maximum continuous time horizon
+   * @param J_horizon maximum discrete step horizon
+   * @param model the model instance
+   */
+  System(hyb_float Ts, hyb_float T_horizon, hyb_float J_horizon, const Model &model = Model())
+    : model_(model), Ts_(Ts), T_horizon_(T_horizon), J_horizon_(J_horizon) {}
+
+  /** @brief Access to the model instance */
+  const Model &model() const { return model_; }
+
+  /**
+   * @brief Single step, same semantic of hyb_main_loop
+   * @param y output in the current state
+   * @param xp next state
+   * @param x current state
+   * @param u current input
+   * @param p parameters
+   * @return HYB_SUCCESS, HYB_TLIMIT or HYB_JLIMIT
+   */
+  template <class U, class P>
+  hyb_errorcode step(Y &y, State &xp, const State &x, const U &u, const P &p) const {
+    model_.output(y, x.t, x.j, x.x, u, p);
+    if (x.t >= T_horizon_)
+      return HYB_TLIMIT;
+    if (x.j >= J_horizon_)
+      return HYB_JLIMIT;
+    advance(JumpLogic::jumps(model_, x.t, x.j, x.x, u, p), xp, x, u, p);
+    return HYB_SUCCESS;
+  }
+
+  /**
+   * @brief Whole horizon simulation, same semantic of hyb_simulate
+   *
+   * The sink is called for each sample as sink(x, y, jumped) and it must
+   * return false to stop the simulation.
+   * @param x0 initial state
+   * @param u input (constant)
+   * @param p parameters
+   * @param sink callable that receives the samples
+   * @return the final state
+   */
+  template <class U, class P, class Sink>
+  State simulate(const State &x0, const U &u, const P &p, Sink &&sink) const {
+    State x = x0, xp;
+    Y y;
+    bool jumped = false;
+    for (;;) {
+      model_.output(y, x.t, x.j, x.x, u, p);
+      if (!sink(static_cast<const State &>(x), static_cast<const Y &>(y), jumped))
+        break;
+      if (x.t >= T_horizon_ || x.j >= J_horizon_)
+        break;
+      jumped = JumpLogic::jumps(model_, x.t, x.j, x.x, u, p);
+      advance(jumped, xp, x, u, p);
+      x = xp;
+    }
+    return x;
+  }
+
+ private:
+  /** @brief Jump or Runge Kutta 4 flow step */
+  template <class U, class P>
+  void advance(bool jumps, State &xp, const State &x, const U &u, const P &p) const {
+    if (jumps) {
+      xp.t = x.t;
+      xp.j = x.j + 1.0;
+      model_.jump(xp.x, x.t, x.j, x.x, u, p);
+      return;
+    }
+    const hyb_float h = Ts_;
+    X k1, k2, k3, k4, xs;
+    model_.flow(k1, x.t, x.j, x.x, u, p);
+    for (std::size_t i = 0; i < NX; i++)
+      xs[i] = x.x[i] + 0.5 * h * k1[i];
+    model_.flow(k2, x.t + 0.5 * h, x.j, xs, u, p);
+    for (std::size_t i = 0; i < NX; i++)
+      xs[i] = x.x[i] + 0.5 * h * k2[i];
+    model_.flow(k3, x.t + 0.5 * h, x.j, xs, u, p);
+    for (std::size_t i = 0; i < NX; i++)
+      xs[i] = x.x[i] + h * k3[i];
+    model_.flow(k4, x.t + h, x.j, xs, u, p);
+    for (std::size_t i = 0; i < NX; i++)
+      xp.x[i] = x.x[i] + h / 6.0 * (k1[i] + 2.0 * k2[i] + 2.0 * k3[i] + k4[i]);
+    xp.t = x.t + h;
+    xp.j = x.j;
+  }
+
+  Model model_;          /**< Model instance */
+  hyb_float Ts_;         /**< Integration step */
+  hyb_float T_horizon_;  /**< Maximum continuous time horizon */
+  hyb_float J_horizon_;  /**< Maximum discrete step horizon */
+};
+
+/**
+ * @brief C callbacks generated from a model type, for the C interface
+ *
+ * The model must be default constructible and must accept
+ * const hyb_float * inputs and const hyb_float ** parameters.
+ */
+template <class Model, std::size_t NX, std::size_t NY>
+struct CAdapter {
+  typedef std::array<hyb_float, NX> X;  /**< State type */
+  typedef std::array<hyb_float, NY> Y;  /**< Output type */
+
+  /** @brief Copies a C state in a fixed size array */
+  static X load(const hyb_float *x) {
+    X v;
+    for (std::size_t i = 0; i < NX; i++)
+      v[i] = x[i];
+    return v;
+  }
+
+  /** @brief Flow map trampoline */
+  static void F(hyb_float *xdot, hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+    X out;
+    Model().flow(out, t, j, load(x), u, p);
+    for (std::size_t i = 0; i < NX; i++)
+      xdot[i] = out[i];
+  }
+
+  /** @brief Jump map trampoline */
+  static void J(hyb_float *xp, hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+    X out;
+    Model().jump(out, t, j, load(x), u, p);
+    for (std::size_t i = 0; i < NX; i++)
+      xp[i] = out[i];
+  }
+
+  /** @brief Output map trampoline */
+  static void Yf(hyb_float *y, hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+    Y out;
+    Model().output(out, t, j, load(x), u, p);
+    for (std::size_t i = 0; i < NY; i++)
+      y[i] = out[i];
+  }
+
+  /** @brief Jump set trampoline */
+  static hyb_bool D(hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+    return Model().jump_set(t, j, load(x), u, p) ? hyb_true : hyb_false;
+  }
+
+  /** @brief Flow set trampoline */
+  static hyb_bool C(hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+    return Model().flow_set(t, j, load(x), u, p) ? hyb_true : hyb_false;
+  }
+};
+
+/**
+ * @brief Builds the C option structure for a model type
+ * @param Ts integration step
+ * @param T_horizon maximum continuous time horizon
+ * @param J_horizon maximum discrete step horizon
+ * @return an option structure usable with all the C drivers
+ */
+template <class Model, std::size_t NX, std::size_t NY>
+hyb_opts c_options(hyb_float Ts, hyb_float T_horizon, hyb_float J_horizon) {
+  typedef CAdapter<Model, NX, NY> A;
+  hyb_opts opts = hyb_opts();
+  opts.y_size = NY;
+  opts.x_size = NX;
+  opts.Ts = Ts;
+  opts.T_horizon = T_horizon;
+  opts.J_horizon = J_horizon;
+  opts.F = A::F;
+  opts.J = A::J;
+  opts.Y = A::Yf;
+  opts.D = A::D;
+  opts.C = A::C;
+  return opts;
+}
+
+} /* namespace hybrid */
+
+#endif /* LIBHYBRID_HPP_ */
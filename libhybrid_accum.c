@@ -0,0 +1,135 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2018 - Matteo Ragni, Matteo Cocetti - University of Trento
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/**
+ * @file libhybrid_accum.c
+ * @author Matteo Ragni, Matteo Cocetti
+ */
+
+#include "libhybrid_accum.h"
+#include <math.h>
+
+/**
+ * @brief Initial value of a reduction
+ */
+static hyb_float hyb_accum_start(hyb_accum_kind kind) {
+  switch (kind) {
+  case HYB_ACC_MIN:
+  case HYB_ACC_FIRST_JUMP:
+    return HUGE_VAL;
+  case HYB_ACC_MAX:
+    return -HUGE_VAL;
+  default:
+    return 0.0;
+  }
+}
+
+void hyb_accum_init(hyb_accum *a, hyb_accum_kind kind, size_t index, hyb_bool output) {
+  if (!a)
+    return;
+  a->kind = kind;
+  a->index = index;
+  a->output = output;
+  a->bound = NAN;
+  a->value = hyb_accum_start(kind);
+  a->count = 0;
+  a->ref_t = NULL;
+  a->ref_y = NULL;
+  a->ref_length = 0;
+  a->ref_stride = 0;
+  a->cursor = 0;
+  a->j0 = 0.0;
+  a->update = NULL;
+  a->data = NULL;
+}
+
+void hyb_accum_reset(hyb_accum_set *set) {
+  if (!set)
+    return;
+  for (size_t i = 0; i < set->n; i++) {
+    hyb_accum *a = &set->acc[i];
+    a->value = hyb_accum_start(a->kind);
+    a->count = 0;
+    a->cursor = 0;
+  }
+}
+
+/**
+ * @brief Accumulates the squared error of a sample that matches the next reference time
+ */
+static void hyb_accum_sse(hyb_accum *a, hyb_float t, hyb_float v) {
+  const hyb_float tol = HYB_EVENT_TOL * (fabs(t) > 1.0 ? fabs(t) : 1.0);
+  while (a->cursor < a->ref_length && a->ref_t[a->cursor] < t - tol)
+    a->cursor++;
+  if (a->cursor == a->ref_length || a->ref_t[a->cursor] > t + tol)
+    return;
+  const hyb_float e = v - a->ref_y[a->cursor * (a->ref_stride ? a->ref_stride : 1)];
+  a->value += e * e;
+  a->count++;
+  a->cursor++;
+}
+
+hyb_errorcode hyb_accum_sink(const hyb_float *x, const hyb_float *y, hyb_bool jumped, void *data) {
+  hyb_accum_set *set = (hyb_accum_set *)data;
+  hyb_errorcode ret = HYB_SUCCESS;
+
+  for (size_t i = 0; i < set->n; i++) {
+    hyb_accum *a = &set->acc[i];
+    const hyb_float *v = a->output ? y : x;
+    if (!v && a->kind != HYB_ACC_CUSTOM)
+      continue;
+    switch (a->kind) {
+    case HYB_ACC_SSE:
+      if (a->ref_t && a->ref_y)
+        hyb_accum_sse(a, x[0], v[a->index]);
+      break;
+    case HYB_ACC_MIN:
+      if (v[a->index] < a->value)
+        a->value = v[a->index];
+      a->count++;
+      break;
+    case HYB_ACC_MAX:
+      if (v[a->index] > a->value)
+        a->value = v[a->index];
+      a->count++;
+      break;
+    case HYB_ACC_FIRST_JUMP:
+      if (a->cursor == 0) {
+        a->j0 = x[1];
+        a->cursor = 1;
+      }
+      if (a->count == 0 && (jumped || x[1] != a->j0)) {
+        a->value = x[0];
+        a->count++;
+      }
+      break;
+    case HYB_ACC_CUSTOM:
+      if (a->update)
+        a->update(a, x, y, jumped);
+      break;
+    }
+    if (!isnan(a->bound) && a->count > 0 &&
+        (a->kind == HYB_ACC_MIN ? a->value < a->bound : a->value > a->bound))
+      ret = HYB_ABORT;
+  }
+  return ret;
+}
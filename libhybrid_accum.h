@@ -0,0 +1,151 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2018 - Matteo Ragni, Matteo Cocetti - University of Trento
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef LIBHYBRID_ACCUM_H_
+#define LIBHYBRID_ACCUM_H_
+
+/**
+ * @file libhybrid_accum.h
+ * @author Matteo Ragni, Matteo Cocetti
+ *
+ * Streaming reductions of a simulation. Identification and sweeps usually
+ * need a small summary of each run (a cost against measured data, the range
+ * of a state, the time of the first jump): the accumulators reduce the
+ * samples while they are produced, through the sink of the trajectory
+ * (hyb_trajectory::sink), thus the trajectory is never stored and the memory
+ * does not depend on the number of steps. An accumulator with a bound stops
+ * the simulation as soon as its value exceeds it, returning HYB_ABORT, so
+ * that bad candidates are discarded early. Usage:
+ * @code
+ * hyb_accum acc[2];
+ * hyb_accum_init(&acc[0], HYB_ACC_SSE, 0, hyb_true);   // output 0 against the reference
+ * acc[0].ref_t = t_meas; acc[0].ref_y = y_meas; acc[0].ref_length = n_meas;
+ * acc[0].bound = best_cost;
+ * hyb_accum_init(&acc[1], HYB_ACC_FIRST_JUMP, 0, hyb_false);
+ * hyb_accum_set set = { acc, 2 };
+ * hyb_trajectory traj = { 0 };
+ * traj.length = n_meas;                                // grid length, no buffers
+ * traj.sink = hyb_accum_sink;
+ * traj.data = &set;
+ * ret = hyb_simulate_grid(&opts, &ws, &traj, t_meas, x0, u, 0, p);
+ * @endcode
+ */
+
+#include "libhybrid.h"
+
+/**
+ * @brief Reductions of the accumulators
+ */
+typedef enum hyb_accum_kind {
+  HYB_ACC_SSE = 0,    /**< Sum of the squared errors of a component against a reference */
+  HYB_ACC_MIN,        /**< Minimum of a component */
+  HYB_ACC_MAX,        /**< Maximum of a component */
+  HYB_ACC_FIRST_JUMP, /**< Flow time of the first jump (HUGE_VAL if there is no jump, see hyb_accum) */
+  HYB_ACC_CUSTOM      /**< User defined, through hyb_accum::update */
+} hyb_accum_kind;
+
+typedef struct hyb_accum hyb_accum;
+
+/**
+ * @brief Callback definition for a user defined accumulator
+ * @param a the accumulator, that holds the value
+ * @param x the augmented state of the sample
+ * @param y the output of the sample
+ * @param jumped hyb_true if the sample is the result of a jump step
+ */
+typedef void (*hyb_accum_update)(hyb_accum *a, const hyb_float *x, const hyb_float *y, hyb_bool jumped);
+
+/**
+ * @brief Streaming accumulator
+ *
+ * Initialize through hyb_accum_init, then set the reference (HYB_ACC_SSE),
+ * the bound and the update function (HYB_ACC_CUSTOM) as needed. The bound
+ * is disabled with NAN (the default), thus any finite value, zero included,
+ * is a valid bound.
+ *
+ * The reference of HYB_ACC_SSE is streamed with a cursor: the error is
+ * accumulated for the samples whose flow time matches the next reference
+ * time (within HYB_EVENT_TOL relative to the time), each reference sample
+ * being used once. Simulations on the reference times (hyb_simulate_grid
+ * with grid = ref_t), or fixed step simulations with Ts equal to the
+ * reference sampling and without event location, match all the reference
+ * samples. Samples between the reference times are skipped.
+ *
+ * HYB_ACC_FIRST_JUMP takes the exact jump time from the samples of the jump
+ * steps (hyb_simulate). Drivers that do not produce them (hyb_simulate_grid)
+ * give the time of the first sample after the jump.
+ */
+struct hyb_accum {
+  hyb_accum_kind kind;     /**< Reduction */
+  size_t index;            /**< Reduced component: index in the output or in the augmented state */
+  hyb_bool output;         /**< hyb_true to reduce the output, hyb_false the augmented state */
+  hyb_float bound;         /**< The simulation is aborted when the value exceeds the bound, or falls below it for HYB_ACC_MIN (NAN disables) */
+  hyb_float value;         /**< Result of the reduction */
+  size_t count;            /**< Number of reduced samples */
+  const hyb_float *ref_t;  /**< Reference times (HYB_ACC_SSE), strictly increasing */
+  const hyb_float *ref_y;  /**< Reference values, ref_y[k * ref_stride] at ref_t[k] */
+  size_t ref_length;       /**< Number of reference samples */
+  size_t ref_stride;       /**< Distance between two reference values (0 for 1) */
+  size_t cursor;           /**< Next reference sample. For internal use only */
+  hyb_float j0;            /**< Jump time of the first sample. For internal use only */
+  hyb_accum_update update; /**< Update function (HYB_ACC_CUSTOM) */
+  void *data;              /**< User data for the update function */
+};
+
+/**
+ * @brief Set of accumulators fed by the same simulation
+ *
+ * Pass it as hyb_trajectory::data, with hyb_accum_sink as sink.
+ */
+typedef struct hyb_accum_set {
+  hyb_accum *acc; /**< Accumulators */
+  size_t n;       /**< Number of accumulators */
+} hyb_accum_set;
+
+/**
+ * @brief Initializes an accumulator, without reference and without bound
+ * @param a the accumulator
+ * @param kind the reduction
+ * @param index the reduced component
+ * @param output hyb_true if index refers to the output, hyb_false to the augmented state
+ */
+void hyb_accum_init(hyb_accum *a, hyb_accum_kind kind, size_t index, hyb_bool output);
+
+/**
+ * @brief Resets the values of a set of accumulators, to reuse them for a new run
+ *
+ * The reference, the bound and the update function are kept.
+ * @param set the accumulators
+ */
+void hyb_accum_reset(hyb_accum_set *set);
+
+/**
+ * @brief Trajectory sink that feeds a set of accumulators (see hyb_sink)
+ * @param x the augmented state of the sample
+ * @param y the output of the sample
+ * @param jumped hyb_true if the sample is the result of a jump step
+ * @param data the hyb_accum_set
+ * @return HYB_SUCCESS, or HYB_ABORT if an accumulator exceeds its bound
+ */
+hyb_errorcode hyb_accum_sink(const hyb_float *x, const hyb_float *y, hyb_bool jumped, void *data);
+
+#endif /* LIBHYBRID_ACCUM_H_ */
@@ -0,0 +1,287 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2018 - Matteo Ragni, Matteo Cocetti - University of Trento
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/**
+ * @file libhybrid_automaton.c
+ * @author Matteo Ragni, Matteo Cocetti
+ */
+
+#include "libhybrid_automaton.h"
+#include "libhybrid_stats.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+hyb_errorcode hyb_automaton_init(hyb_automaton *a, const hyb_opts *opts, const hyb_mode *modes, size_t n_modes, const hyb_transition *transitions, size_t n_transitions) {
+  if (!a || !opts || !modes || (n_transitions && !transitions))
+    return HYB_NULLPTR;
+  memset(a, 0, sizeof(hyb_automaton));
+  if (n_modes == 0)
+    return HYB_GENERIC;
+  for (size_t m = 0; m < n_modes; m++) {
+    if (!modes[m].F || (!modes[m].Y && !opts->Y))
+      return HYB_NULLPTR;
+  }
+  for (size_t e = 0; e < n_transitions; e++) {
+    if (transitions[e].from >= n_modes || transitions[e].to >= n_modes)
+      return HYB_GENERIC;
+    if (!transitions[e].reset)
+      return HYB_NULLPTR;
+  }
+
+  a->out = (size_t *)calloc(n_modes + 1 + n_transitions, sizeof(size_t));
+  if (!a->out)
+    return HYB_EMALLOC;
+  a->edge = a->out + n_modes + 1;
+
+  /* Counting sort by source mode, stable to keep the priority of the table */
+  for (size_t e = 0; e < n_transitions; e++)
+    a->out[transitions[e].from + 1]++;
+  for (size_t m = 0; m < n_modes; m++)
+    a->out[m + 1] += a->out[m];
+  for (size_t e = 0; e < n_transitions; e++)
+    a->edge[a->out[transitions[e].from]++] = e;
+  for (size_t m = n_modes; m > 0; m--)
+    a->out[m] = a->out[m - 1];
+  a->out[0] = 0;
+
+  a->modes = n_modes;
+  a->mode_table = modes;
+  a->transitions = transitions;
+  a->opts = *opts;
+  a->opts.fused = NULL;
+  a->flow_mode = n_modes;
+  return HYB_SUCCESS;
+}
+
+void hyb_automaton_free(hyb_automaton *a) {
+  if (!a)
+    return;
+  free(a->out);
+  memset(a, 0, sizeof(hyb_automaton));
+}
+
+/**
+ * @brief Output of the current mode
+ */
+static inline void hyb_automaton_output(hyb_automaton *a, hyb_workspace *ws, hyb_float *y, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  const hyb_mode *m = a->mode_table + a->mode;
+  const hyb_out_map Y = m->Y ? m->Y : a->opts.Y;
+  (void) ws;
+  HYB_TIMED(ws, HYB_CB_Y, Y(y, x[0], x[1], x + 2, u, p));
+}
+
+/**
+ * @brief Transition taken from the current mode, NULL for a flow step
+ *
+ * The guards of the transitions are accounted as jump sets in the statistics.
+ */
+static const hyb_transition *hyb_automaton_decide(const hyb_automaton *a, hyb_workspace *ws, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  const hyb_mode *m = a->mode_table + a->mode;
+  hyb_bool b;
+  (void) ws;
+  #if HYB_JUMP_LOGIC == 2
+    if (m->C) {
+      HYB_TIMED(ws, HYB_CB_C, b = m->C(x[0], x[1], x + 2, u, p));
+      if (b)
+        return NULL;
+    }
+  #endif
+  if (m->D) {
+    HYB_TIMED(ws, HYB_CB_D, b = m->D(x[0], x[1], x + 2, u, p));
+    if (!b)
+      return NULL;
+  }
+
+  for (size_t e = a->out[a->mode]; e < a->out[a->mode + 1]; e++) {
+    const hyb_transition *tr = a->transitions + a->edge[e];
+    if (!tr->guard)
+      return tr;
+    HYB_TIMED(ws, HYB_CB_D, b = tr->guard(x[0], x[1], x + 2, u, p));
+    if (b)
+      return tr;
+  }
+  return NULL;
+}
+
+/**
+ * @brief Jump through the transition tr, or flow step in the current mode
+ */
+static hyb_errorcode hyb_automaton_advance(hyb_automaton *a, hyb_workspace *ws, const hyb_transition *tr, hyb_float *xp, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  if (tr) {
+    a->opts.J = tr->reset;
+    hyb_errorcode ret = hyb_advance(&a->opts, ws, hyb_true, xp, x, u, p);
+    if (!ret)
+      a->mode = tr->to;
+    return ret;
+  }
+
+  const hyb_mode *m = a->mode_table + a->mode;
+  if (a->flow_mode != a->mode) {
+    /* The derivative and the Jacobian kept by the workspace belong to another mode */
+    ws->fsal = hyb_false;
+    ws->k0_ready = hyb_false;
+    ws->jac_age = 0;
+    a->flow_mode = a->mode;
+  }
+  a->opts.F = m->F;
+  a->opts.G = m->G;
+  a->opts.Fx = m->Fx;
+  return hyb_advance(&a->opts, ws, hyb_false, xp, x, u, p);
+}
+
+hyb_errorcode hyb_automaton_step(hyb_automaton *a, hyb_workspace *ws, hyb_float *y, hyb_float *xp, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  if (ws->input)
+    u = hyb_input_value(ws, x[0]);
+
+  hyb_automaton_output(a, ws, y, x, u, p);
+
+  if (x[0] >= a->opts.T_horizon)
+    return HYB_TLIMIT;
+  if (x[1] >= a->opts.J_horizon)
+    return HYB_JLIMIT;
+
+  return hyb_automaton_advance(a, ws, hyb_automaton_decide(a, ws, x, u, p), xp, x, u, p);
+}
+
+hyb_errorcode hyb_automaton_simulate(hyb_automaton *a, hyb_workspace *ws, hyb_trajectory *traj, size_t *modes, const hyb_float *x0, const hyb_float *u, size_t u_stride, const hyb_float **p) {
+  if (!a || !traj || !x0)
+    return HYB_NULLPTR;
+
+  const size_t nx = a->opts.x_size + 2;
+  const size_t ny = a->opts.y_size;
+  const hyb_bool bounded = (traj->x || traj->y || modes) ? hyb_true : hyb_false;
+  const hyb_bool with_y = (traj->y || traj->sink) ? hyb_true : hyb_false;
+
+  traj->samples = 0;
+  traj->jumps = 0;
+  if (bounded && traj->length == 0)
+    return HYB_BUFFER;
+
+  hyb_workspace own_ws;
+  if (!ws) {
+    hyb_errorcode ret = hyb_workspace_init(&own_ws, &a->opts);
+    if (ret)
+      return ret;
+    ws = &own_ws;
+  }
+
+  hyb_float *x = traj->x ? traj->x : ws->xa;
+  hyb_float *xp = traj->x ? traj->x + nx : ws->xb;
+  hyb_float *y = traj->y ? traj->y : ws->y;
+  memcpy(x, x0, nx * sizeof(hyb_float));
+
+  hyb_errorcode ret = HYB_SUCCESS;
+  hyb_bool jumped = hyb_false;
+  size_t k = 0;
+  for (;;) {
+    const hyb_float *uk = ws->input ? hyb_input_value(ws, x[0]) : u;
+    if (with_y)
+      hyb_automaton_output(a, ws, y, x, uk, p);
+    if (modes)
+      modes[k] = a->mode;
+    traj->samples = k + 1;
+    if (traj->sink) {
+      ret = traj->sink(x, with_y ? y : NULL, jumped, traj->data);
+      if (ret)
+        break;
+    }
+
+    if (x[0] >= a->opts.T_horizon || x[1] >= a->opts.J_horizon)
+      break;
+    if (bounded && k + 1 >= traj->length) {
+      ret = HYB_BUFFER;
+      break;
+    }
+
+    const hyb_transition *tr = hyb_automaton_decide(a, ws, x, uk, p);
+    ret = hyb_automaton_advance(a, ws, tr, xp, x, uk, p);
+    if (ret)
+      break;
+
+    k++;
+    jumped = tr ? hyb_true : hyb_false;
+    if (jumped) {
+      if (traj->jump_idx && traj->jumps < traj->jumps_length)
+        traj->jump_idx[traj->jumps] = k;
+      traj->jumps++;
+    } else {
+      u += u_stride;
+    }
+
+    if (traj->x) {
+      x = xp;
+      xp += nx;
+    } else {
+      hyb_float *swap = x;
+      x = xp;
+      xp = swap;
+    }
+    if (traj->y)
+      y += ny;
+  }
+
+  if (ws == &own_ws)
+    hyb_workspace_free(&own_ws);
+  return ret;
+}
+
+/**
+ * @brief Modes in front of the checkpoint of the workspace
+ */
+typedef struct hyb_automaton_checkpoint {
+  uint64_t mode;      /**< hyb_automaton::mode */
+  uint64_t flow_mode; /**< hyb_automaton::flow_mode */
+} hyb_automaton_checkpoint;
+
+size_t hyb_automaton_checkpoint_size(const hyb_workspace *ws) {
+  return ws ? sizeof(hyb_automaton_checkpoint) + hyb_checkpoint_size(ws) : 0;
+}
+
+hyb_errorcode hyb_automaton_checkpoint_save(const hyb_automaton *a, const hyb_workspace *ws, const hyb_float *x, void *blob, size_t size) {
+  if (!a || !ws || !x || !blob)
+    return HYB_NULLPTR;
+  if (size < hyb_automaton_checkpoint_size(ws))
+    return HYB_BUFFER;
+  hyb_automaton_checkpoint ck;
+  ck.mode = a->mode;
+  ck.flow_mode = a->flow_mode;
+  memcpy(blob, &ck, sizeof(ck));
+  return hyb_checkpoint_save(ws, x, (unsigned char *)blob + sizeof(ck), size - sizeof(ck));
+}
+
+hyb_errorcode hyb_automaton_checkpoint_load(hyb_automaton *a, hyb_workspace *ws, hyb_float *x, const void *blob, size_t size) {
+  if (!a || !ws || !x || !blob)
+    return HYB_NULLPTR;
+  hyb_automaton_checkpoint ck;
+  if (size < sizeof(ck))
+    return HYB_GENERIC;
+  memcpy(&ck, blob, sizeof(ck));
+  if (ck.mode >= a->modes || ck.flow_mode > a->modes)
+    return HYB_GENERIC;
+  hyb_errorcode ret = hyb_checkpoint_load(ws, x, (const unsigned char *)blob + sizeof(ck), size - sizeof(ck));
+  if (ret)
+    return ret;
+  a->mode = (size_t)ck.mode;
+  a->flow_mode = (size_t)ck.flow_mode;
+  return HYB_SUCCESS;
+}
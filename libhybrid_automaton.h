@@ -0,0 +1,190 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2018 - Matteo Ragni, Matteo Cocetti - University of Trento
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#ifndef LIBHYBRID_AUTOMATON_H_
+#define LIBHYBRID_AUTOMATON_H_
+
+/**
+ * @file libhybrid_automaton.h
+ * @author Matteo Ragni, Matteo Cocetti
+ *
+ * Hybrid automata with many discrete modes. Each mode has its own flow map,
+ * output map and sets, and the jumps are the edges of a transition table,
+ * each with its guard and its reset map. The current mode is kept by the
+ * automaton next to the augmented state (flow time, jump time, state), that
+ * is unchanged: the callbacks of a mode do not need to switch on a mode
+ * variable stored in x. The transitions are indexed by source mode, thus a
+ * step evaluates only the guards of the edges that leave the current mode.
+ * Flow steps use the integrator of the option structure (with the event
+ * location of the mode guard, if any), and run on the workspace of the model.
+ */
+
+#include "libhybrid.h"
+
+/**
+ * @brief Mode of a hybrid automaton
+ *
+ * Only the flow map is mandatory. The jump set D is an optional early test:
+ * when it is given and false, the guards of the mode are not evaluated.
+ */
+typedef struct hyb_mode {
+  hyb_flow_map F;   /**< Flow map of the mode */
+  hyb_out_map Y;    /**< Output map of the mode (NULL for hyb_opts::Y) */
+  hyb_flow_set C;   /**< Flow set of the mode (HYB_JUMP_LOGIC 2 only, NULL if it is the complement of the guards) */
+  hyb_jump_set D;   /**< Jump set of the mode (optional, NULL for the union of the guards) */
+  hyb_guard G;      /**< Jump guard for event location (optional, negative outside the mode) */
+  hyb_jacobian Fx;  /**< Jacobian of the flow map (optional, see hyb_opts::Fx) */
+} hyb_mode;
+
+/**
+ * @brief Transition of a hybrid automaton
+ *
+ * The transition is enabled when its guard is true. When more than one
+ * transition leaving a mode is enabled, the first one in the table is taken.
+ */
+typedef struct hyb_transition {
+  size_t from;            /**< Source mode */
+  size_t to;              /**< Destination mode */
+  hyb_jump_set guard;     /**< Guard of the transition (NULL if always enabled) */
+  hyb_jump_map reset;     /**< Reset map of the state */
+} hyb_transition;
+
+/**
+ * @brief Hybrid automaton
+ *
+ * The structure must be initialized through hyb_automaton_init and released
+ * through hyb_automaton_free. The tables are kept by reference. The member
+ * mode may be accessed directly, the remaining are for internal use only.
+ */
+typedef struct hyb_automaton {
+  size_t mode;                       /**< Current mode */
+  size_t modes;                      /**< Number of modes */
+  const hyb_mode *mode_table;        /**< Modes, modes elements */
+  const hyb_transition *transitions; /**< Transition table */
+  size_t *out;                       /**< First edge leaving each mode, modes + 1 elements. For internal use only */
+  size_t *edge;                      /**< Transitions sorted by source mode. For internal use only */
+  size_t flow_mode;                  /**< Mode of the last flow step. For internal use only */
+  hyb_opts opts;                     /**< Options with the maps of the current step. For internal use only */
+} hyb_automaton;
+
+/**
+ * @brief Initializes a hybrid automaton
+ *
+ * Builds the index of the transitions by source mode. The sizes, the step,
+ * the horizons and the integrator are taken from the option structure,
+ * whose maps are not used (but for the output map of modes without one).
+ * The fused callback is not supported by the automaton. The initial mode is 0.
+ * @param a the automaton to initialize
+ * @param opts pointer to the option structure of the model
+ * @param modes table of the modes
+ * @param n_modes number of modes
+ * @param transitions table of the transitions
+ * @param n_transitions number of transitions
+ * @return HYB_SUCCESS, HYB_NULLPTR (missing flow or reset map), HYB_GENERIC
+ *         (mode index out of range) or HYB_EMALLOC
+ */
+hyb_errorcode hyb_automaton_init(hyb_automaton *a, const hyb_opts *opts, const hyb_mode *modes, size_t n_modes, const hyb_transition *transitions, size_t n_transitions);
+
+/**
+ * @brief Releases a hybrid automaton
+ * @param a the automaton to release
+ */
+void hyb_automaton_free(hyb_automaton *a);
+
+/**
+ * @brief Hybrid automaton step, allocation free
+ *
+ * Performs the operations of hyb_step with the maps of the current mode: the
+ * output is evaluated, then the step is a jump through the first enabled
+ * transition leaving the mode (following HYB_JUMP_LOGIC), that updates the
+ * mode, or a flow step with the flow map of the mode.
+ * @param a the automaton
+ * @param ws workspace initialized for the model
+ * @param y vector that will contain the next output. It must be already allocated
+ * @param xp vector that will contain the next state. It must be already allocated
+ * @param x current state
+ * @param u current input (ignored if an input signal is attached to ws)
+ * @param p parameter vector
+ * @return an exit codes, as described in hyb_errorcode
+ */
+hyb_errorcode hyb_automaton_step(hyb_automaton *a, hyb_workspace *ws, hyb_float *y, hyb_float *xp, const hyb_float *x, const hyb_float *u, const hyb_float **p);
+
+/**
+ * @brief Whole horizon simulation of a hybrid automaton
+ *
+ * Same as hyb_simulate, starting from the current mode of the automaton. On
+ * return the automaton is in the mode of the last sample.
+ * @param a the automaton
+ * @param ws workspace initialized for the model (NULL for a temporary one)
+ * @param traj trajectory descriptor, with buffers already allocated
+ * @param modes mode of each sample (optional, traj->length elements)
+ * @param x0 initial augmented state (flow time, jump time, state)
+ * @param u input vector (or matrix of input samples, one per column)
+ * @param u_stride distance between two consecutive input samples
+ * @param p parameter vector
+ * @return HYB_SUCCESS if an horizon is reached, HYB_BUFFER if the trajectory
+ *         is full before reaching an horizon, or the error of the failing step
+ */
+hyb_errorcode hyb_automaton_simulate(hyb_automaton *a, hyb_workspace *ws, hyb_trajectory *traj, size_t *modes, const hyb_float *x0, const hyb_float *u, size_t u_stride, const hyb_float **p);
+
+/**
+ * @brief Size in bytes of a checkpoint of an automaton
+ * @param ws the workspace
+ * @return the size of the blob for hyb_automaton_checkpoint_save
+ */
+size_t hyb_automaton_checkpoint_size(const hyb_workspace *ws);
+
+/**
+ * @brief Saves the state of an automaton simulation in a checkpoint
+ *
+ * The checkpoint of the workspace (see hyb_checkpoint_save) does not know
+ * the automaton: this one holds also the current mode, and the mode the
+ * cached derivative and Jacobian belong to, thus the restored automaton
+ * continues as the original one. The same holds for the trajectories: the
+ * mode of each sample is returned apart (modes of hyb_automaton_simulate),
+ * and it must be saved with the samples to restart from one of them.
+ * @param a the automaton
+ * @param ws the workspace
+ * @param x the augmented state (flow time, jump time, state)
+ * @param blob the destination buffer
+ * @param size size of the destination buffer (at least hyb_automaton_checkpoint_size)
+ * @return HYB_SUCCESS, HYB_NULLPTR or HYB_BUFFER if the buffer is too small
+ */
+hyb_errorcode hyb_automaton_checkpoint_save(const hyb_automaton *a, const hyb_workspace *ws, const hyb_float *x, void *blob, size_t size);
+
+/**
+ * @brief Restores a checkpoint of an automaton
+ *
+ * The automaton must be initialized with the same tables, and the workspace
+ * for the same model (see hyb_checkpoint_load).
+ * @param a the automaton
+ * @param ws the workspace
+ * @param x the augmented state (output)
+ * @param blob the checkpoint
+ * @param size size of the checkpoint buffer
+ * @return HYB_SUCCESS, HYB_NULLPTR, or HYB_GENERIC if the blob is corrupted,
+ *         for a different model or with a mode out of range
+ */
+hyb_errorcode hyb_automaton_checkpoint_load(hyb_automaton *a, hyb_workspace *ws, hyb_float *x, const void *blob, size_t size);
+
+#endif /* LIBHYBRID_AUTOMATON_H_ */
@@ -0,0 +1,529 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2018 - Matteo Ragni, Matteo Cocetti - University of Trento
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+/**
+ * @file libhybrid_bench.c
+ * @author Matteo Ragni, Matteo Cocetti
+ *
+ * Standalone benchmark of the library (MATLAB is not required). A catalogue
+ * of reference models is simulated to the horizon with each driver of the
+ * library, and for each pair the program reports the time per step, the flow
+ * map evaluations per second, the jumps per second and the peak resident
+ * memory of the process. Compile and run with:
+ * @code
+ * cc -O2 -std=c99 libhybrid_bench.c libhybrid.c -lm -o libhybrid_bench
+ * ./libhybrid_bench [--json] [--repeat N] [--model NAME] [--driver NAME] [--integrator rk4|dopri5|ros2]
+ * @endcode
+ * With --json the results are written as a single JSON object, to be stored
+ * and compared across releases. Each measure is the best of N repetitions.
+ * New models and drivers are added to the bench_models and bench_drivers tables.
+ */
+
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L /**< clock_gettime is POSIX, not C99 */
+#endif
+
+#include "libhybrid.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <sys/resource.h>
+
+/**
+ * @brief Number of flow map evaluations, incremented by the models
+ */
+static unsigned long long bench_evals = 0;
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Bouncing ball: x = [height, velocity]
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+static void ball_F(hyb_float *xdot, hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  (void) t; (void) j; (void) u; (void) p;
+  bench_evals++;
+  xdot[0] = x[1];
+  xdot[1] = -9.81;
+}
+
+static void ball_J(hyb_float *xp, hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  (void) t; (void) j; (void) u; (void) p;
+  xp[0] = 0;
+  xp[1] = -0.8 * x[1];
+}
+
+static hyb_bool ball_D(hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  (void) t; (void) j; (void) u; (void) p;
+  return (x[0] <= 0 && x[1] <= 0) ? hyb_true : hyb_false;
+}
+
+static hyb_bool ball_C(hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  (void) t; (void) j; (void) u; (void) p;
+  return x[0] >= 0 ? hyb_true : hyb_false;
+}
+
+static hyb_float ball_G(hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  (void) t; (void) j; (void) u; (void) p;
+  return x[0];
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Chattering relay: x = [s, q]. The drift pushes s against the switching
+ * surface from both sides, and the hysteresis RELAY_EPS is tiny, thus the
+ * model jumps after almost every flow step (Zeno-like behaviour).
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#define RELAY_EPS 1e-6 /**< Hysteresis of the relay */
+
+static void relay_F(hyb_float *xdot, hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  (void) t; (void) j; (void) u; (void) p;
+  bench_evals++;
+  xdot[0] = 0.3 - x[1];
+  xdot[1] = 0;
+}
+
+static void relay_J(hyb_float *xp, hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  (void) t; (void) j; (void) u; (void) p;
+  xp[0] = x[0];
+  xp[1] = -x[1];
+}
+
+static hyb_float relay_G(hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  (void) t; (void) j; (void) u; (void) p;
+  return x[1] * x[0] + RELAY_EPS;
+}
+
+static hyb_bool relay_D(hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  return relay_G(t, j, x, u, p) <= 0 ? hyb_true : hyb_false;
+}
+
+static hyb_bool relay_C(hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  return relay_G(t, j, x, u, p) >= 0 ? hyb_true : hyb_false;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Large linear flow: LINEAR_N diffusion states and a timer. Every
+ * LINEAR_PERIOD the timer resets and a few states (one every LINEAR_KICK)
+ * receive an impulse, thus jumps are sparse and touch few states.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#define LINEAR_N      1000 /**< Number of diffusion states */
+#define LINEAR_PERIOD 0.05 /**< Period of the impulses */
+#define LINEAR_KICK   100  /**< Distance between kicked states */
+
+static void linear_F(hyb_float *xdot, hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  (void) t; (void) j; (void) u; (void) p;
+  bench_evals++;
+  xdot[0] = 100.0 * (x[1] - 2.0 * x[0]) - 0.1 * x[0];
+  for (size_t i = 1; i < LINEAR_N - 1; i++)
+    xdot[i] = 100.0 * (x[i-1] - 2.0 * x[i] + x[i+1]) - 0.1 * x[i];
+  xdot[LINEAR_N-1] = 100.0 * (x[LINEAR_N-2] - 2.0 * x[LINEAR_N-1]) - 0.1 * x[LINEAR_N-1];
+  xdot[LINEAR_N] = 1.0;
+}
+
+static void linear_J(hyb_float *xp, hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  (void) t; (void) j; (void) u; (void) p;
+  memcpy(xp, x, LINEAR_N * sizeof(hyb_float));
+  for (size_t i = 0; i < LINEAR_N; i += LINEAR_KICK)
+    xp[i] += 1.0;
+  xp[LINEAR_N] = 0;
+}
+
+static hyb_float linear_G(hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  (void) t; (void) j; (void) u; (void) p;
+  return LINEAR_PERIOD - x[LINEAR_N];
+}
+
+static hyb_bool linear_D(hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  return linear_G(t, j, x, u, p) <= 0 ? hyb_true : hyb_false;
+}
+
+static hyb_bool linear_C(hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  return linear_G(t, j, x, u, p) >= 0 ? hyb_true : hyb_false;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Switched linear system: x = [x1, x2, q, timer]. Each of the SWITCHED_MODES
+ * modes has its own dynamic matrix (alternating stable and unstable foci),
+ * and the mode advances cyclically after a dwell time SWITCHED_DWELL.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#define SWITCHED_MODES 4    /**< Number of modes */
+#define SWITCHED_DWELL 0.01 /**< Dwell time in each mode */
+
+static const hyb_float switched_A[SWITCHED_MODES][4] = {
+  { -0.1,  1.0, -10.0, -0.1 },
+  {  0.1, 10.0,  -1.0,  0.1 },
+  { -0.5,  2.0,  -2.0, -0.5 },
+  {  0.2,  5.0,  -0.5, -0.3 }
+};
+
+static void switched_F(hyb_float *xdot, hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  (void) t; (void) j; (void) u; (void) p;
+  bench_evals++;
+  const hyb_float *A = switched_A[(size_t) x[2] % SWITCHED_MODES];
+  xdot[0] = A[0] * x[0] + A[1] * x[1];
+  xdot[1] = A[2] * x[0] + A[3] * x[1];
+  xdot[2] = 0;
+  xdot[3] = 1.0;
+}
+
+static void switched_J(hyb_float *xp, hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  (void) t; (void) j; (void) u; (void) p;
+  xp[0] = x[0];
+  xp[1] = x[1];
+  xp[2] = (hyb_float) (((size_t) x[2] + 1) % SWITCHED_MODES);
+  xp[3] = 0;
+}
+
+static hyb_float switched_G(hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  (void) t; (void) j; (void) u; (void) p;
+  return SWITCHED_DWELL - x[3];
+}
+
+static hyb_bool switched_D(hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  return switched_G(t, j, x, u, p) <= 0 ? hyb_true : hyb_false;
+}
+
+static hyb_bool switched_C(hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  return switched_G(t, j, x, u, p) >= 0 ? hyb_true : hyb_false;
+}
+
+/**
+ * @brief Output map shared by all the models: the first state
+ */
+static void bench_Y(hyb_float *y, hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  (void) t; (void) j; (void) u; (void) p;
+  y[0] = x[0];
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Catalogue
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/**
+ * @brief A reference model of the benchmark
+ */
+typedef struct bench_model {
+  const char *name;  /**< Name of the model */
+  hyb_opts opts;     /**< Options (the integrator is selected at runtime) */
+  void (*init)(hyb_float *x); /**< Initial state (t = 0, j = 0 are set by the benchmark) */
+} bench_model;
+
+static void ball_init(hyb_float *x) {
+  x[0] = 1.0;
+  x[1] = 0.0;
+}
+
+static void relay_init(hyb_float *x) {
+  x[0] = 0.01;
+  x[1] = 1.0;
+}
+
+static void linear_init(hyb_float *x) {
+  for (size_t i = 0; i < LINEAR_N; i++)
+    x[i] = sin(3.14159265358979323846 * (hyb_float) i / LINEAR_N);
+  x[LINEAR_N] = 0;
+}
+
+static void switched_init(hyb_float *x) {
+  x[0] = 1.0;
+  x[1] = 0.0;
+  x[2] = 0.0;
+  x[3] = 0.0;
+}
+
+static bench_model bench_models[] = {
+  { "bouncing_ball", { .y_size = 1, .x_size = 2, .Ts = 1e-3, .T_horizon = 3.5, .J_horizon = 1e3,
+      .F = ball_F, .J = ball_J, .Y = bench_Y, .D = ball_D, .C = ball_C, .G = ball_G }, ball_init },
+  { "relay_chattering", { .y_size = 1, .x_size = 2, .Ts = 1e-3, .T_horizon = 1.0, .J_horizon = 2e4,
+      .F = relay_F, .J = relay_J, .Y = bench_Y, .D = relay_D, .C = relay_C, .G = relay_G }, relay_init },
+  { "linear_1000", { .y_size = 1, .x_size = LINEAR_N + 1, .Ts = 1e-3, .T_horizon = 1.0, .J_horizon = 1e3,
+      .F = linear_F, .J = linear_J, .Y = bench_Y, .D = linear_D, .C = linear_C, .G = linear_G }, linear_init },
+  { "switched_4_modes", { .y_size = 1, .x_size = 4, .Ts = 1e-3, .T_horizon = 10.0, .J_horizon = 1e4,
+      .F = switched_F, .J = switched_J, .Y = bench_Y, .D = switched_D, .C = switched_C, .G = switched_G }, switched_init }
+};
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Drivers
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/**
+ * @brief Counters of a single run
+ */
+typedef struct bench_counts {
+  unsigned long long steps; /**< Steps (flow and jump) */
+  unsigned long long jumps; /**< Jump steps */
+} bench_counts;
+
+/**
+ * @brief A driver runs the model from x0 to the horizon
+ */
+typedef hyb_errorcode (*bench_run)(hyb_opts *opts, const hyb_float *x0, bench_counts *counts);
+
+/**
+ * @brief Returns HYB_SUCCESS if the code is a regular end of the simulation
+ */
+static hyb_errorcode bench_horizon(hyb_errorcode ret) {
+  return (ret == HYB_TLIMIT || ret == HYB_JLIMIT) ? HYB_SUCCESS : ret;
+}
+
+/**
+ * @brief Loop on hyb_main_loop (a temporary workspace for each step)
+ */
+static hyb_errorcode bench_main_loop(hyb_opts *opts, const hyb_float *x0, bench_counts *counts) {
+  const size_t nx = opts->x_size + 2;
+  hyb_float *x = malloc(2 * nx * sizeof(hyb_float));
+  hyb_float *xp = x + nx;
+  hyb_float y[1];
+  hyb_errorcode ret;
+  if (!x)
+    return HYB_EMALLOC;
+  memcpy(x, x0, nx * sizeof(hyb_float));
+  while ((ret = hyb_main_loop(opts, y, xp, 0, x, NULL, NULL)) == HYB_SUCCESS) {
+    counts->steps++;
+    counts->jumps += (xp[1] != x[1]);
+    hyb_float *swap = x;
+    x = xp;
+    xp = swap;
+  }
+  free(x < xp ? x : xp);
+  return bench_horizon(ret);
+}
+
+/**
+ * @brief Loop on hyb_step with a workspace that lives across the steps
+ */
+static hyb_errorcode bench_step(hyb_opts *opts, const hyb_float *x0, bench_counts *counts) {
+  const size_t nx = opts->x_size + 2;
+  hyb_workspace ws;
+  hyb_float y[1];
+  hyb_errorcode ret = hyb_workspace_init(&ws, opts);
+  if (ret)
+    return ret;
+  hyb_float *x = ws.xa, *xp = ws.xb;
+  memcpy(x, x0, nx * sizeof(hyb_float));
+  while ((ret = hyb_step(opts, &ws, y, xp, x, NULL, NULL)) == HYB_SUCCESS) {
+    counts->steps++;
+    counts->jumps += (xp[1] != x[1]);
+    hyb_float *swap = x;
+    x = xp;
+    xp = swap;
+  }
+  hyb_workspace_free(&ws);
+  return bench_horizon(ret);
+}
+
+/**
+ * @brief hyb_simulate to the horizon, without storing the trajectory
+ */
+static hyb_errorcode bench_simulate(hyb_opts *opts, const hyb_float *x0, bench_counts *counts) {
+  hyb_workspace ws;
+  hyb_trajectory traj;
+  hyb_errorcode ret = hyb_workspace_init(&ws, opts);
+  if (ret)
+    return ret;
+  memset(&traj, 0, sizeof(traj));
+  ret = hyb_simulate(opts, &ws, &traj, x0, NULL, 0, NULL);
+  counts->steps = traj.samples - 1;
+  counts->jumps = traj.jumps;
+  hyb_workspace_free(&ws);
+  return ret;
+}
+
+/**
+ * @brief A driver of the library under benchmark
+ */
+typedef struct bench_driver {
+  const char *name; /**< Name of the driver */
+  bench_run run;    /**< Run function */
+} bench_driver;
+
+static const bench_driver bench_drivers[] = {
+  { "main_loop", bench_main_loop },
+  { "step", bench_step },
+  { "simulate", bench_simulate }
+};
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Measure and report
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/**
+ * @brief Result of a model / driver pair
+ */
+typedef struct bench_result {
+  const char *model;        /**< Model name */
+  const char *driver;       /**< Driver name */
+  hyb_errorcode status;     /**< Exit status of the driver */
+  bench_counts counts;      /**< Steps and jumps of a run */
+  unsigned long long evals; /**< Flow map evaluations of a run */
+  double seconds;           /**< Best wall time of the runs */
+  long peak_rss_kb;         /**< Peak resident memory of the process after the runs */
+} bench_result;
+
+/**
+ * @brief Monotonic time in seconds
+ */
+static double bench_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (double) ts.tv_sec + 1e-9 * (double) ts.tv_nsec;
+}
+
+/**
+ * @brief Peak resident memory of the process in KiB (ru_maxrss is in bytes on macOS)
+ */
+static long bench_peak_rss(void) {
+  struct rusage ru;
+  if (getrusage(RUSAGE_SELF, &ru))
+    return -1;
+#ifdef __APPLE__
+  return ru.ru_maxrss / 1024;
+#else
+  return ru.ru_maxrss;
+#endif
+}
+
+/**
+ * @brief Runs a model with a driver repeat times, and keeps the best time
+ */
+static bench_result bench_measure(bench_model *model, const bench_driver *driver, hyb_integrator integrator, int repeat) {
+  bench_result res;
+  const size_t nx = model->opts.x_size + 2;
+  hyb_float *x0 = calloc(nx, sizeof(hyb_float));
+
+  memset(&res, 0, sizeof(res));
+  res.model = model->name;
+  res.driver = driver->name;
+  if (!x0) {
+    res.status = HYB_EMALLOC;
+    return res;
+  }
+  model->init(x0 + 2);
+  for (int r = 0; r < repeat; r++) {
+    bench_counts counts = { 0, 0 };
+    model->opts.integrator = integrator;
+    model->opts.h = 0;
+    bench_evals = 0;
+    double start = bench_now();
+    res.status = driver->run(&model->opts, x0, &counts);
+    double elapsed = bench_now() - start;
+    if (res.status)
+      break;
+    if (r == 0 || elapsed < res.seconds)
+      res.seconds = elapsed;
+    res.counts = counts;
+    res.evals = bench_evals;
+  }
+  res.peak_rss_kb = bench_peak_rss();
+  free(x0);
+  return res;
+}
+
+static void bench_print_header(int json, const char *integrator) {
+  if (json)
+    printf("{\n  \"benchmark\": \"libhybrid\",\n  \"integrator\": \"%s\",\n  \"results\": [", integrator);
+  else
+    printf("%-18s %-10s %10s %8s %12s %14s %14s %10s\n", "model", "driver", "steps", "jumps",
+           "ns/step", "F evals/s", "jumps/s", "RSS [KiB]");
+}
+
+static void bench_print(int json, int first, const bench_result *res) {
+  const double steps = (double) res->counts.steps;
+  const double ns_step = steps > 0 ? 1e9 * res->seconds / steps : 0;
+  const double evals_s = res->seconds > 0 ? (double) res->evals / res->seconds : 0;
+  const double jumps_s = res->seconds > 0 ? (double) res->counts.jumps / res->seconds : 0;
+  if (json) {
+    printf("%s\n    { \"model\": \"%s\", \"driver\": \"%s\", \"status\": %d, \"steps\": %llu, "
+           "\"jumps\": %llu, \"f_evals\": %llu, \"seconds\": %.9g, \"ns_per_step\": %.6g, "
+           "\"f_evals_per_s\": %.6g, \"jumps_per_s\": %.6g, \"peak_rss_kb\": %ld }",
+           first ? "" : ",", res->model, res->driver, (int) res->status, res->counts.steps,
+           res->counts.jumps, res->evals, res->seconds, ns_step, evals_s, jumps_s, res->peak_rss_kb);
+  } else if (res->status) {
+    printf("%-18s %-10s failed with error code %d\n", res->model, res->driver, (int) res->status);
+  } else {
+    printf("%-18s %-10s %10llu %8llu %12.1f %14.4g %14.4g %10ld\n", res->model, res->driver,
+           res->counts.steps, res->counts.jumps, ns_step, evals_s, jumps_s, res->peak_rss_kb);
+  }
+}
+
+/**
+ * @brief Integrator from its command line name
+ */
+static hyb_integrator bench_integrator(const char *name) {
+  if (!strcmp(name, "dopri5"))
+    return HYB_DOPRI5;
+  if (!strcmp(name, "ros2"))
+    return HYB_ROS2;
+  return HYB_RK4;
+}
+
+static void bench_usage(const char *name) {
+  fprintf(stderr, "usage: %s [--json] [--repeat N] [--model NAME] [--driver NAME] [--integrator rk4|dopri5|ros2]\n", name);
+}
+
+int main(int argc, char *argv[]) {
+  int json = 0, repeat = 3, first = 1, failed = 0;
+  const char *model = NULL, *driver = NULL, *integrator = "rk4";
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--json")) {
+      json = 1;
+    } else if (!strcmp(argv[i], "--repeat") && i + 1 < argc) {
+      repeat = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--model") && i + 1 < argc) {
+      model = argv[++i];
+    } else if (!strcmp(argv[i], "--driver") && i + 1 < argc) {
+      driver = argv[++i];
+    } else if (!strcmp(argv[i], "--integrator") && i + 1 < argc) {
+      integrator = argv[++i];
+    } else {
+      bench_usage(argv[0]);
+      return 2;
+    }
+  }
+  if (repeat < 1 || (strcmp(integrator, "rk4") && strcmp(integrator, "dopri5") && strcmp(integrator, "ros2"))) {
+    bench_usage(argv[0]);
+    return 2;
+  }
+
+  bench_print_header(json, integrator);
+  for (size_t m = 0; m < sizeof(bench_models) / sizeof(bench_models[0]); m++) {
+    if (model && strcmp(model, bench_models[m].name))
+      continue;
+    for (size_t d = 0; d < sizeof(bench_drivers) / sizeof(bench_drivers[0]); d++) {
+      if (driver && strcmp(driver, bench_drivers[d].name))
+        continue;
+      bench_result res = bench_measure(&bench_models[m], &bench_drivers[d], bench_integrator(integrator), repeat);
+      bench_print(json, first, &res);
+      fflush(stdout);
+      failed |= (res.status != HYB_SUCCESS);
+      first = 0;
+    }
+  }
+  if (json)
+    printf("\n  ]\n}\n");
+  return failed;
+}
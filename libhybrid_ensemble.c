@@ -0,0 +1,238 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2018 - Matteo Ragni, Matteo Cocetti - University of Trento
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+/**
+ * @file libhybrid_ensemble.c
+ * @author Matteo Ragni, Matteo Cocetti
+ */
+
+#include "libhybrid_ensemble.h"
+#include <stdlib.h>
+#include <string.h>
+
+hyb_errorcode hyb_ensemble_init(hyb_ensemble *e, const hyb_opts *opts, size_t lanes, const hyb_float ***p) {
+  if (!e || !opts || !p)
+    return HYB_NULLPTR;
+  memset(e, 0, sizeof(hyb_ensemble));
+  /* Lanes advance only with the Runge Kutta 4, through Y, D, C and F */
+  if (lanes == 0 || opts->integrator != HYB_RK4 || opts->fused)
+    return HYB_GENERIC;
+
+  const size_t nx = opts->x_size + 2;
+  const size_t soa = nx * lanes;
+  /* The second lane vector holds a state or an output */
+  const size_t nl = nx + (opts->y_size > nx ? opts->y_size : nx);
+  /* x, four stages and stage state, then lane steps and two lane vectors */
+  e->x = (hyb_float *)calloc(6 * soa + lanes + nl, sizeof(hyb_float));
+  e->status = (hyb_errorcode *)calloc(lanes, sizeof(hyb_errorcode));
+  e->jumps = (hyb_bool *)calloc(lanes, sizeof(hyb_bool));
+  if (!e->x || !e->status || !e->jumps) {
+    hyb_ensemble_free(e);
+    return HYB_EMALLOC;
+  }
+
+  e->lanes = lanes;
+  e->x_size = nx;
+  e->p = p;
+  for (size_t s = 0; s < 4; s++)
+    e->k[s] = e->x + (s + 1) * soa;
+  e->xs = e->x + 5 * soa;
+  e->h = e->x + 6 * soa;
+  e->lane = e->h + lanes;
+  return HYB_SUCCESS;
+}
+
+void hyb_ensemble_free(hyb_ensemble *e) {
+  if (!e)
+    return;
+  free(e->x);
+  free(e->status);
+  free(e->jumps);
+  memset(e, 0, sizeof(hyb_ensemble));
+}
+
+void hyb_ensemble_set_state(hyb_ensemble *e, size_t l, const hyb_float *x) {
+  for (size_t i = 0; i < e->x_size; i++)
+    e->x[i * e->lanes + l] = x[i];
+  e->status[l] = HYB_SUCCESS;
+}
+
+void hyb_ensemble_get_state(const hyb_ensemble *e, size_t l, hyb_float *x) {
+  for (size_t i = 0; i < e->x_size; i++)
+    x[i] = e->x[i * e->lanes + l];
+}
+
+/**
+ * @brief Gathers a lane from a structure-of-arrays buffer
+ */
+static inline void hyb_ensemble_gather(hyb_float *dst, const hyb_float *src, size_t n, size_t lanes, size_t l) {
+  for (size_t i = 0; i < n; i++)
+    dst[i] = src[i * lanes + l];
+}
+
+/**
+ * @brief Scatters a lane into a structure-of-arrays buffer
+ */
+static inline void hyb_ensemble_scatter(hyb_float *dst, const hyb_float *src, size_t n, size_t lanes, size_t l) {
+  for (size_t i = 0; i < n; i++)
+    dst[i * lanes + l] = src[i];
+}
+
+void hyb_ensemble_output(hyb_opts *opts, hyb_ensemble *e, hyb_float *y, const hyb_float *u) {
+  const size_t L = e->lanes;
+  hyb_float *xl = e->lane;
+  hyb_float *yl = e->lane + e->x_size;
+  for (size_t l = 0; l < L; l++) {
+    hyb_ensemble_gather(xl, e->x, e->x_size, L, l);
+    opts->Y(yl, xl[0], xl[1], xl + 2, u, e->p[l]);
+    hyb_ensemble_scatter(y, yl, opts->y_size, L, l);
+  }
+}
+
+/**
+ * @brief Evaluates the augmented flow map for all the lanes
+ *
+ * Masked lanes (zero step) are skipped when the lane-wise flow map is used,
+ * their derivative is set to zero.
+ */
+static void hyb_ensemble_flow(hyb_opts *opts, hyb_ensemble *e, hyb_float *k, const hyb_float *xs, const hyb_float *u) {
+  const size_t L = e->lanes;
+  const size_t nx = e->x_size;
+
+  for (size_t l = 0; l < L; l++) {
+    k[l] = 1.0;
+    k[L + l] = 0.0;
+  }
+  if (e->F) {
+    e->F(k + 2 * L, xs, xs + L, xs + 2 * L, u, e->p, L);
+    for (size_t l = 0; l < L; l++) {
+      if (e->h[l] != 0.0)
+        continue;
+      for (size_t i = 2; i < nx; i++)
+        k[i * L + l] = 0.0;
+    }
+    return;
+  }
+
+  hyb_float *xl = e->lane;
+  hyb_float *kl = e->lane + nx;
+  for (size_t l = 0; l < L; l++) {
+    if (e->h[l] == 0.0) {
+      for (size_t i = 2; i < nx; i++)
+        k[i * L + l] = 0.0;
+      continue;
+    }
+    hyb_ensemble_gather(xl, xs, nx, L, l);
+    opts->F(kl + 2, xl[0], xl[1], xl + 2, u, e->p[l]);
+    hyb_ensemble_scatter(k + 2 * L, kl + 2, nx - 2, L, l);
+  }
+}
+
+/**
+ * @brief Stage update xs = x + a h k, for all the lanes
+ */
+static void hyb_ensemble_stage(hyb_float * restrict xs, const hyb_float * restrict x, const hyb_float * restrict k, const hyb_float * restrict h, hyb_float a, size_t nx, size_t L) {
+  for (size_t i = 0; i < nx; i++) {
+    const size_t o = i * L;
+    for (size_t l = 0; l < L; l++)
+      xs[o + l] = x[o + l] + a * h[l] * k[o + l];
+  }
+}
+
+size_t hyb_ensemble_step(hyb_opts *opts, hyb_ensemble *e, const hyb_float *u) {
+  const size_t L = e->lanes;
+  const size_t nx = e->x_size;
+  hyb_float *xl = e->lane;
+  hyb_float *xp = e->lane + nx;
+  size_t active = 0;
+  size_t jumping = 0;
+
+  /* Horizons and jump mask: the only lane-wise branching part of the step */
+  for (size_t l = 0; l < L; l++) {
+    e->jumps[l] = hyb_false;
+    e->h[l] = 0.0;
+    if (e->status[l] != HYB_SUCCESS)
+      continue;
+    hyb_ensemble_gather(xl, e->x, nx, L, l);
+    if (xl[0] >= opts->T_horizon) {
+      e->status[l] = HYB_TLIMIT;
+      continue;
+    }
+    if (xl[1] >= opts->J_horizon) {
+      e->status[l] = HYB_JLIMIT;
+      continue;
+    }
+    active++;
+    if (hyb_it_jumps(opts, xl, u, e->p[l])) {
+      e->jumps[l] = hyb_true;
+      jumping++;
+    } else {
+      e->h[l] = opts->Ts;
+    }
+  }
+
+  /* Flow: all lanes together, masked lanes have zero step */
+  if (active > jumping) {
+    hyb_float *x = e->x, *xs = e->xs;
+    hyb_float **k = e->k;
+    hyb_ensemble_flow(opts, e, k[0], x, u);
+    hyb_ensemble_stage(xs, x, k[0], e->h, 0.5, nx, L);
+    hyb_ensemble_flow(opts, e, k[1], xs, u);
+    hyb_ensemble_stage(xs, x, k[1], e->h, 0.5, nx, L);
+    hyb_ensemble_flow(opts, e, k[2], xs, u);
+    hyb_ensemble_stage(xs, x, k[2], e->h, 1.0, nx, L);
+    hyb_ensemble_flow(opts, e, k[3], xs, u);
+
+    const hyb_float * restrict k1 = k[0], * restrict k2 = k[1];
+    const hyb_float * restrict k3 = k[2], * restrict k4 = k[3];
+    const hyb_float * restrict h = e->h;
+    hyb_float * restrict xr = x;
+    for (size_t i = 0; i < nx; i++) {
+      const size_t o = i * L;
+      for (size_t l = 0; l < L; l++)
+        xr[o + l] += h[l] / 6.0 * (k1[o + l] + 2.0 * k2[o + l] + 2.0 * k3[o + l] + k4[o + l]);
+    }
+  }
+
+  /* Jump: only the masked lanes are visited */
+  for (size_t l = 0; jumping && l < L; l++) {
+    if (!e->jumps[l])
+      continue;
+    hyb_ensemble_gather(xl, e->x, nx, L, l);
+    xp[0] = xl[0];
+    xp[1] = xl[1] + 1.0;
+    opts->J(xp + 2, xl[0], xl[1], xl + 2, u, e->p[l]);
+    hyb_ensemble_scatter(e->x, xp, nx, L, l);
+    jumping--;
+  }
+
+  return active;
+}
+
+hyb_errorcode hyb_ensemble_run(hyb_opts *opts, hyb_ensemble *e, const hyb_float *u) {
+  if (!opts || !e || !e->x)
+    return HYB_NULLPTR;
+  while (hyb_ensemble_step(opts, e, u))
+    ;
+  return HYB_SUCCESS;
+}
@@ -0,0 +1,150 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2018 - Matteo Ragni, Matteo Cocetti - University of Trento
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#ifndef LIBHYBRID_ENSEMBLE_H_
+#define LIBHYBRID_ENSEMBLE_H_
+
+/**
+ * @file libhybrid_ensemble.h
+ * @author Matteo Ragni, Matteo Cocetti
+ *
+ * Batched simulation of many trajectories of the same model (Monte Carlo
+ * studies, parameter sweeps). The trajectories (lanes) are stored in a
+ * structure-of-arrays layout: the i-th component of the augmented state of
+ * lane l is stored in x[i * lanes + l]. All the lanes are advanced together
+ * through the Runge Kutta 4 stages, thus the stage arithmetic runs on
+ * contiguous arrays and it is vectorized by the compiler. Lanes that jump or
+ * that have reached an horizon are masked with a zero integration step, and
+ * only them are visited to apply the jump map. The ensemble uses fixed
+ * steps only: the jump guard (hyb_opts::G) is not used for event location,
+ * and only the HYB_RK4 integrator without fused callback is supported.
+ */
+
+#include "libhybrid.h"
+
+/**
+ * @brief Callback definition for the batched Flow Map
+ *
+ * Optional callback that evaluates the flow map for all the lanes of an
+ * ensemble in a single call. All the arrays are in structure-of-arrays
+ * layout: the i-th component of lane l is x[i * lanes + l] (and the same
+ * holds for xdot). Inactive lanes may be evaluated as well, their result is
+ * discarded.
+ * @param xdot an array in which the result will be stored (x_size * lanes)
+ * @param t flow times of the lanes
+ * @param j jump times of the lanes
+ * @param x states of the lanes (x_size * lanes)
+ * @param u the common input
+ * @param p parameter vectors of the lanes
+ * @param lanes the number of lanes
+ */
+typedef void (*hyb_flow_map_batch)(hyb_float *xdot, const hyb_float *t, const hyb_float *j, const hyb_float *x, const hyb_float *u, const hyb_float ***p, size_t lanes);
+
+/**
+ * @brief Ensemble of trajectories in structure-of-arrays layout
+ *
+ * The structure must be initialized through hyb_ensemble_init and released
+ * through hyb_ensemble_free. The members x, status and F may be accessed
+ * directly, the remaining are for internal use only.
+ */
+typedef struct hyb_ensemble {
+  size_t lanes;           /**< Number of trajectories */
+  size_t x_size;          /**< Augmented state size (x_size + 2) */
+  hyb_float *x;           /**< Augmented states, x[i * lanes + l] */
+  const hyb_float ***p;   /**< Parameter vector of each lane */
+  hyb_errorcode *status;  /**< HYB_SUCCESS while running, HYB_TLIMIT or HYB_JLIMIT when done */
+  hyb_flow_map_batch F;   /**< Optional batched flow map. NULL uses hyb_opts::F lane by lane */
+  hyb_float *k[4];        /**< Runge Kutta stages. For internal use only */
+  hyb_float *xs;          /**< Stage state. For internal use only */
+  hyb_float *h;           /**< Integration step of each lane (0 for masked lanes). For internal use only */
+  hyb_float *lane;        /**< Gather/scatter space for lane-wise callbacks. For internal use only */
+  hyb_bool *jumps;        /**< Jump mask. For internal use only */
+} hyb_ensemble;
+
+/**
+ * @brief Allocates the storage of an ensemble
+ *
+ * All the states are initialized to zero and all the lanes are active.
+ * @param e the ensemble to initialize
+ * @param opts pointer to the option structure of the model
+ * @param lanes number of trajectories
+ * @param p parameter vector of each lane (lanes elements, kept by reference)
+ * @return HYB_SUCCESS, HYB_NULLPTR, HYB_EMALLOC, or HYB_GENERIC for zero lanes,
+ *         an integrator other than HYB_RK4 or a fused callback
+ */
+hyb_errorcode hyb_ensemble_init(hyb_ensemble *e, const hyb_opts *opts, size_t lanes, const hyb_float ***p);
+
+/**
+ * @brief Releases the storage of an ensemble
+ * @param e the ensemble to release
+ */
+void hyb_ensemble_free(hyb_ensemble *e);
+
+/**
+ * @brief Sets the augmented state of a lane and reactivates it
+ * @param e the ensemble
+ * @param l the lane index
+ * @param x augmented state (flow time, jump time, state)
+ */
+void hyb_ensemble_set_state(hyb_ensemble *e, size_t l, const hyb_float *x);
+
+/**
+ * @brief Copies the augmented state of a lane in a contiguous vector
+ * @param e the ensemble
+ * @param l the lane index
+ * @param x output augmented state (flow time, jump time, state)
+ */
+void hyb_ensemble_get_state(const hyb_ensemble *e, size_t l, hyb_float *x);
+
+/**
+ * @brief Evaluates the output map for all the lanes
+ * @param opts pointer to the option structure of the model
+ * @param e the ensemble
+ * @param y output in structure-of-arrays layout (y_size * lanes)
+ * @param u the common input
+ */
+void hyb_ensemble_output(hyb_opts *opts, hyb_ensemble *e, hyb_float *y, const hyb_float *u);
+
+/**
+ * @brief Advances all the active lanes of a single step
+ *
+ * Each lane performs either a jump step or a flow step, exactly as in
+ * hyb_main_loop. Lanes that reach an horizon are deactivated and their status
+ * is set accordingly.
+ * @param opts pointer to the option structure of the model
+ * @param e the ensemble
+ * @param u the common input
+ * @return the number of lanes that are still active
+ */
+size_t hyb_ensemble_step(hyb_opts *opts, hyb_ensemble *e, const hyb_float *u);
+
+/**
+ * @brief Advances the ensemble until all the lanes reach an horizon
+ * @param opts pointer to the option structure of the model
+ * @param e the ensemble
+ * @param u the common input
+ * @return HYB_SUCCESS or HYB_NULLPTR
+ */
+hyb_errorcode hyb_ensemble_run(hyb_opts *opts, hyb_ensemble *e, const hyb_float *u);
+
+#endif /* LIBHYBRID_ENSEMBLE_H_ */
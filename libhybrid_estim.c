@@ -0,0 +1,559 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2018 - Matteo Ragni, Matteo Cocetti - University of Trento
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/**
+ * @file libhybrid_estim.c
+ * @author Matteo Ragni, Matteo Cocetti
+ */
+
+#include "libhybrid_estim.h"
+#include "libhybrid_parallel.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+#define HYB_ESTIM_LAMBDA_MAX 1e16 /**< Damping beyond which the iterations stop */
+
+/**
+ * @brief Shooting segment: the samples [begin, end) of a dataset
+ */
+typedef struct hyb_estim_segment {
+  size_t data;   /**< Dataset */
+  size_t begin;  /**< First sample */
+  size_t end;    /**< One past the last sample */
+  hyb_bool last; /**< hyb_true for the last segment of the dataset (no continuity defect) */
+  size_t rows;   /**< Residuals of the segment */
+  size_t row0;   /**< First residual of the segment */
+} hyb_estim_segment;
+
+/**
+ * @brief Shared state of an estimation
+ *
+ * The unknowns z are the scalar parameters followed by the initial state of
+ * each segment. The Jacobian is stored by segment: the block of a segment has
+ * its rows and the columns of the parameters and of its initial state
+ * (column major, at jac + row0 * (np + nx)).
+ */
+typedef struct hyb_estim {
+  const hyb_opts *opts;     /**< Model */
+  const hyb_dataset *data;  /**< Datasets */
+  hyb_estim_segment *seg;   /**< Segments */
+  size_t segments;          /**< Number of segments */
+  size_t *first;            /**< First segment of each dataset */
+  size_t nx;                /**< State size */
+  size_t np;                /**< Number of scalar parameters */
+  size_t n_p;               /**< Number of parameter arrays */
+  const size_t *p_size;     /**< Size of each parameter array */
+  size_t n;                 /**< Number of unknowns */
+  size_t rows;              /**< Number of residuals */
+  size_t max_rows;          /**< Residuals of the longest segment */
+  hyb_float wc;             /**< Weight of the continuity defects */
+  hyb_float fd;             /**< Relative step of the finite differences */
+  hyb_bool *fixed;          /**< hyb_true for the unknowns that are not estimated */
+  const hyb_float *z;       /**< Point of the evaluation */
+  hyb_float *r;             /**< Residuals of the evaluation */
+  hyb_float *jac;           /**< Jacobian blocks of the evaluation */
+  hyb_float *x_end;         /**< State at the end of each segment of the evaluation */
+  hyb_bool jacobian;        /**< hyb_true to compute the Jacobian, from the residuals already in r */
+  hyb_errorcode *status;    /**< Result of each task */
+  size_t threads;           /**< Number of threads */
+  hyb_workspace *ws;        /**< Workspace of each thread */
+  size_t *simulations;      /**< Simulated segments of each thread */
+  hyb_float *scratch;       /**< Scratch of each thread (see hyb_estim_scratch) */
+  size_t scratch_size;      /**< Elements of the scratch of a thread */
+  const hyb_float **pptr;   /**< Parameter arrays of each thread, n_p elements each */
+} hyb_estim;
+
+/**
+ * @brief Scratch of a thread: parameters, perturbed unknowns, two states and residuals
+ */
+static inline hyb_float *hyb_estim_scratch(const hyb_estim *e, size_t th) {
+  return e->scratch + th * e->scratch_size;
+}
+
+/**
+ * @brief Simulates a segment and computes its residuals
+ *
+ * The segment starts from the state s with the parameters theta. The output
+ * errors are written in r, followed by the weighted continuity defect with
+ * s_next (if not NULL). If x_end is not NULL, it receives the state at the
+ * end of the segment.
+ */
+static hyb_errorcode hyb_estim_simulate(hyb_estim *e, size_t th, const hyb_estim_segment *sg, const hyb_float *theta, const hyb_float *s, const hyb_float *s_next, hyb_float *r, hyb_float *x_end) {
+  const hyb_opts *opts = e->opts;
+  const hyb_dataset *d = e->data + sg->data;
+  const size_t nx = e->nx, ny = opts->y_size;
+  hyb_float *pv = hyb_estim_scratch(e, th);
+  hyb_float *x = pv + e->np + e->np + nx;
+  hyb_float *xp = x + nx + 2;
+  const hyb_float **p = e->pptr + th * e->n_p;
+
+  memcpy(pv, theta, e->np * sizeof(hyb_float));
+  for (size_t a = 0, o = 0; a < e->n_p; o += e->p_size[a], a++)
+    p[a] = pv + o;
+
+  x[0] = d->t[sg->begin];
+  x[1] = d->x0[1];
+  memcpy(x + 2, s, nx * sizeof(hyb_float));
+  for (size_t k = sg->begin; k < sg->end; k++) {
+    const hyb_float dt = k + 1 < d->length ? d->t[k + 1] - d->t[k] : (k > 0 ? d->t[k] - d->t[k - 1] : opts->Ts);
+    const hyb_float *u = d->u ? d->u + k * d->u_stride : NULL;
+    hyb_float *yk = r + (k - sg->begin) * ny;
+    hyb_errorcode ret = hyb_sample_step(opts, e->ws + th, yk, xp, x, u, p, dt);
+    if (ret)
+      return ret;
+    for (size_t i = 0; i < ny; i++)
+      yk[i] -= d->y[k * ny + i];
+    hyb_float *swap = x;
+    x = xp;
+    xp = swap;
+  }
+  e->simulations[th]++;
+
+  if (s_next) {
+    hyb_float *c = r + (sg->end - sg->begin) * ny;
+    for (size_t i = 0; i < nx; i++)
+      c[i] = e->wc * (x[2 + i] - s_next[i]);
+  }
+  if (x_end)
+    memcpy(x_end, x + 2, nx * sizeof(hyb_float));
+  return HYB_SUCCESS;
+}
+
+/**
+ * @brief Residuals (and Jacobian block) of a segment, as a parallel task
+ */
+static void hyb_estim_task(size_t i, size_t th, void *data) {
+  hyb_estim *e = (hyb_estim *)data;
+  const hyb_estim_segment *sg = e->seg + i;
+  const size_t np = e->np, nx = e->nx, nc = np + nx;
+  const hyb_float *s = e->z + np + i * nx;
+  const hyb_float *s_next = sg->last ? NULL : s + nx;
+  hyb_float *r = e->r + sg->row0;
+
+  if (!e->jacobian) {
+    e->status[i] = hyb_estim_simulate(e, th, sg, e->z, s, s_next, r, e->x_end + i * nx);
+    return;
+  }
+
+  /* Forward differences on the parameters and on the initial state of the segment */
+  hyb_float *zt = hyb_estim_scratch(e, th) + np;
+  hyb_float *rt = zt + nc + 2 * (nx + 2);
+  hyb_float *J = e->jac + sg->row0 * nc;
+  e->status[i] = HYB_SUCCESS;
+  for (size_t c = 0; c < nc; c++) {
+    const size_t zi = c < np ? c : np + i * nx + (c - np);
+    hyb_float *col = J + c * sg->rows;
+    if (e->fixed[zi]) {
+      memset(col, 0, sg->rows * sizeof(hyb_float));
+      continue;
+    }
+    memcpy(zt, e->z, np * sizeof(hyb_float));
+    memcpy(zt + np, s, nx * sizeof(hyb_float));
+    const hyb_float v = zt[c];
+    zt[c] = v + e->fd * (fabs(v) > 1.0 ? fabs(v) : 1.0);
+    const hyb_float h = zt[c] - v;
+    if (hyb_estim_simulate(e, th, sg, zt, zt + np, s_next, rt, NULL)) {
+      /* No information from a failed simulation */
+      memset(col, 0, sg->rows * sizeof(hyb_float));
+      continue;
+    }
+    for (size_t k = 0; k < sg->rows; k++)
+      col[k] = (rt[k] - r[k]) / h;
+  }
+}
+
+/**
+ * @brief Initial states of the segments of a dataset, as a parallel task
+ *
+ * Simulates the dataset from its initial state, taking the state at the end
+ * of each segment as the initial state of the following one.
+ */
+static void hyb_estim_init_task(size_t d, size_t th, void *data) {
+  hyb_estim *e = (hyb_estim *)data;
+  hyb_float *z = (hyb_float *)e->z;
+  size_t i = e->first[d];
+  memcpy(z + e->np + i * e->nx, e->data[d].x0 + 2, e->nx * sizeof(hyb_float));
+  e->status[d] = HYB_SUCCESS;
+  for (; !e->seg[i].last; i++) {
+    hyb_float *s = z + e->np + i * e->nx;
+    e->status[d] = hyb_estim_simulate(e, th, e->seg + i, z, s, NULL, e->r + e->seg[i].row0, s + e->nx);
+    if (e->status[d])
+      return;
+  }
+}
+
+/**
+ * @brief Runs a task on all the segments (or datasets) and returns the first error
+ */
+static hyb_errorcode hyb_estim_run(hyb_estim *e, size_t n, hyb_task task) {
+  hyb_errorcode ret = hyb_parallel_for(n, e->threads, task, e);
+  for (size_t i = 0; !ret && i < n; i++)
+    ret = e->status[i];
+  return ret;
+}
+
+/**
+ * @brief Half the sum of the squared residuals
+ */
+static hyb_float hyb_estim_cost(const hyb_estim *e, const hyb_float *r) {
+  hyb_float c = 0.0;
+  for (size_t k = 0; k < e->rows; k++)
+    c += r[k] * r[k];
+  return 0.5 * c;
+}
+
+/**
+ * @brief Restarts the segments whose continuity defect jumped at the trial zt
+ *
+ * A jump that moves across the end of a segment makes its defect
+ * discontinuous (the end state is on the other side of the jump), a change
+ * that a Levenberg-Marquardt step cannot follow. The discrete move is to
+ * restart the following segment from the end of the previous one. r and rt
+ * are the residuals at the current point and at the trial.
+ * @return the number of restarted segments
+ */
+static size_t hyb_estim_restart(const hyb_estim *e, hyb_float *zt, const hyb_float *r, const hyb_float *rt) {
+  const size_t nx = e->nx;
+  size_t moved = 0;
+  for (size_t i = 0; i < e->segments; i++) {
+    const hyb_estim_segment *sg = e->seg + i;
+    if (sg->last)
+      continue;
+    hyb_float dc = 0.0, dt = 0.0;
+    for (size_t q = 0, k = sg->row0 + sg->rows - nx; q < nx; q++, k++) {
+      dc = fabs(r[k]) > dc ? fabs(r[k]) : dc;
+      dt = fabs(rt[k]) > dt ? fabs(rt[k]) : dt;
+    }
+    if (dt > 10.0 * dc + sqrt(HYB_EPSILON) * e->wc) {
+      memcpy(zt + e->np + (i + 1) * nx, e->x_end + i * nx, nx * sizeof(hyb_float));
+      moved++;
+    }
+  }
+  return moved;
+}
+
+/**
+ * @brief Normal equations A = J' J, g = J' r from the Jacobian blocks
+ *
+ * A is column major, n x n. The continuity defect of a segment depends on
+ * the initial state of the following one with derivative -wc I.
+ */
+static void hyb_estim_normal(const hyb_estim *e, hyb_float *A, hyb_float *g) {
+  const size_t n = e->n, np = e->np, nx = e->nx, nc = np + nx;
+  memset(A, 0, n * n * sizeof(hyb_float));
+  memset(g, 0, n * sizeof(hyb_float));
+  for (size_t i = 0; i < e->segments; i++) {
+    const hyb_estim_segment *sg = e->seg + i;
+    const hyb_float *J = e->jac + sg->row0 * nc;
+    const hyb_float *r = e->r + sg->row0;
+    const size_t m = sg->rows;
+    for (size_t a = 0; a < nc; a++) {
+      const size_t za = a < np ? a : np + i * nx + (a - np);
+      const hyb_float *Ja = J + a * m;
+      for (size_t b = a; b < nc; b++) {
+        const size_t zb = b < np ? b : np + i * nx + (b - np);
+        const hyb_float *Jb = J + b * m;
+        hyb_float v = 0.0;
+        for (size_t k = 0; k < m; k++)
+          v += Ja[k] * Jb[k];
+        A[za + zb * n] += v;
+        if (za != zb)
+          A[zb + za * n] += v;
+      }
+      hyb_float v = 0.0;
+      for (size_t k = 0; k < m; k++)
+        v += Ja[k] * r[k];
+      g[za] += v;
+    }
+    if (sg->last)
+      continue;
+    const size_t c0 = m - nx;
+    const size_t zn = np + (i + 1) * nx;
+    for (size_t q = 0; q < nx; q++) {
+      for (size_t a = 0; a < nc; a++) {
+        const size_t za = a < np ? a : np + i * nx + (a - np);
+        const hyb_float v = -e->wc * J[a * m + c0 + q];
+        A[za + (zn + q) * n] += v;
+        A[(zn + q) + za * n] += v;
+      }
+      A[(zn + q) * (n + 1)] += e->wc * e->wc;
+      g[zn + q] -= e->wc * r[c0 + q];
+    }
+  }
+}
+
+/**
+ * @brief Cholesky factorization in place (lower triangle, column major)
+ * @return hyb_false if the matrix is not positive definite
+ */
+static hyb_bool hyb_estim_cholesky(hyb_float *a, size_t n) {
+  for (size_t j = 0; j < n; j++) {
+    hyb_float d = a[j * (n + 1)];
+    for (size_t k = 0; k < j; k++)
+      d -= a[j + k * n] * a[j + k * n];
+    if (!(d > 0.0))
+      return hyb_false;
+    d = sqrt(d);
+    a[j * (n + 1)] = d;
+    for (size_t i = j + 1; i < n; i++) {
+      hyb_float v = a[i + j * n];
+      for (size_t k = 0; k < j; k++)
+        v -= a[i + k * n] * a[j + k * n];
+      a[i + j * n] = v / d;
+    }
+  }
+  return hyb_true;
+}
+
+/**
+ * @brief Solves in place l l' x = b with the factor of hyb_estim_cholesky
+ */
+static void hyb_estim_cholesky_solve(const hyb_float *l, size_t n, hyb_float *b) {
+  for (size_t i = 0; i < n; i++) {
+    for (size_t k = 0; k < i; k++)
+      b[i] -= l[i + k * n] * b[k];
+    b[i] /= l[i * (n + 1)];
+  }
+  for (size_t i = n; i-- > 0;) {
+    for (size_t k = i + 1; k < n; k++)
+      b[i] -= l[k + i * n] * b[k];
+    b[i] /= l[i * (n + 1)];
+  }
+}
+
+/**
+ * @brief Releases the storage of an estimation
+ */
+static void hyb_estim_free(hyb_estim *e) {
+  if (e->ws) {
+    for (size_t t = 0; t < e->threads; t++)
+      hyb_workspace_free(e->ws + t);
+  }
+  free(e->ws);
+  free(e->seg);
+  free(e->first);
+  free(e->fixed);
+  free(e->status);
+  free(e->simulations);
+  free(e->scratch);
+  free((void *)e->pptr);
+}
+
+hyb_errorcode hyb_estimate(const hyb_opts *opts, const hyb_estim_opts *eopts, hyb_dataset *data, size_t n_data, hyb_float **p, size_t n_p, const size_t *p_size, hyb_estim_result *result) {
+  if (!opts || !data || (n_p && (!p || !p_size)))
+    return HYB_NULLPTR;
+  for (size_t d = 0; d < n_data; d++) {
+    if (!data[d].t || !data[d].y || !data[d].x0 || data[d].length == 0)
+      return HYB_NULLPTR;
+  }
+
+  hyb_estim_opts eo;
+  memset(&eo, 0, sizeof(eo));
+  if (eopts)
+    eo = *eopts;
+  const size_t seg_len = eo.segment ? eo.segment : 50;
+  const size_t max_iter = eo.max_iter ? eo.max_iter : 100;
+  const hyb_float ftol = eo.ftol > 0.0 ? eo.ftol : 1e-10;
+  const hyb_float xtol = eo.xtol > 0.0 ? eo.xtol : 1e-10;
+  hyb_float lambda = eo.lambda > 0.0 ? eo.lambda : 1e-3;
+
+  hyb_estim e;
+  memset(&e, 0, sizeof(e));
+  e.opts = opts;
+  e.data = data;
+  e.nx = opts->x_size;
+  e.n_p = n_p;
+  e.p_size = p_size;
+  for (size_t a = 0; a < n_p; a++)
+    e.np += p_size[a];
+  e.wc = eo.continuity > 0.0 ? eo.continuity : 1.0;
+  e.fd = eo.fd_step > 0.0 ? eo.fd_step : sqrt(HYB_EPSILON);
+  e.threads = hyb_parallel_threads(eo.threads);
+
+  for (size_t d = 0; d < n_data; d++)
+    e.segments += (data[d].length + seg_len - 1) / seg_len;
+  const size_t nx = e.nx, np = e.np, ny = opts->y_size;
+  e.n = np + e.segments * nx;
+
+  e.seg = (hyb_estim_segment *)calloc(e.segments, sizeof(hyb_estim_segment));
+  e.first = (size_t *)calloc(n_data ? n_data : 1, sizeof(size_t));
+  e.fixed = (hyb_bool *)calloc(e.n, sizeof(hyb_bool));
+  e.status = (hyb_errorcode *)calloc(e.segments, sizeof(hyb_errorcode));
+  e.simulations = (size_t *)calloc(e.threads, sizeof(size_t));
+  e.ws = (hyb_workspace *)calloc(e.threads, sizeof(hyb_workspace));
+  e.pptr = (const hyb_float **)calloc(e.threads * (n_p ? n_p : 1), sizeof(hyb_float *));
+  if (!e.seg || !e.first || !e.fixed || !e.status || !e.simulations || !e.ws || !e.pptr) {
+    hyb_estim_free(&e);
+    return HYB_EMALLOC;
+  }
+
+  /* Segments, residual layout and unknowns that are not estimated */
+  for (size_t d = 0, i = 0; d < n_data; d++) {
+    e.first[d] = i;
+    for (size_t b = 0; b < data[d].length; b += seg_len, i++) {
+      hyb_estim_segment *sg = e.seg + i;
+      sg->data = d;
+      sg->begin = b;
+      sg->end = b + seg_len < data[d].length ? b + seg_len : data[d].length;
+      sg->last = sg->end == data[d].length ? hyb_true : hyb_false;
+      sg->rows = (sg->end - sg->begin) * ny + (sg->last ? 0 : nx);
+      sg->row0 = e.rows;
+      e.rows += sg->rows;
+      if (sg->rows > e.max_rows)
+        e.max_rows = sg->rows;
+    }
+    for (size_t q = 0; eo.free_x0 && q < nx; q++)
+      e.fixed[np + e.first[d] * nx + q] = eo.free_x0[q] ? hyb_false : hyb_true;
+  }
+  for (size_t c = 0; eo.free_p && c < np; c++)
+    e.fixed[c] = eo.free_p[c] ? hyb_false : hyb_true;
+
+  const size_t nc = np + nx;
+  e.scratch_size = np + nc + 2 * (nx + 2) + e.max_rows;
+  e.scratch = (hyb_float *)malloc(e.threads * e.scratch_size * sizeof(hyb_float));
+  /* Unknowns (current and trial), residuals (current and trial), Jacobian,
+     normal equations, their factor, the right hand side and the end states */
+  hyb_float *mem = (hyb_float *)malloc((2 * e.n + 2 * e.rows + e.rows * nc + 2 * e.n * e.n + e.n + e.segments * nx) * sizeof(hyb_float));
+  if (!e.scratch || !mem) {
+    free(mem);
+    hyb_estim_free(&e);
+    return HYB_EMALLOC;
+  }
+  hyb_float *z = mem, *zt = z + e.n;
+  hyb_float *r = zt + e.n, *rt = r + e.rows;
+  hyb_float *A = rt + e.rows + e.rows * nc, *M = A + e.n * e.n, *g = M + e.n * e.n;
+  e.jac = rt + e.rows;
+  e.x_end = g + e.n;
+
+  hyb_errorcode ret = HYB_SUCCESS;
+  for (size_t t = 0; !ret && t < e.threads; t++)
+    ret = hyb_workspace_init(e.ws + t, opts);
+
+  /* Initial point: parameters and states along the simulation of each dataset */
+  for (size_t a = 0, o = 0; a < n_p; o += p_size[a], a++)
+    memcpy(z + o, p[a], p_size[a] * sizeof(hyb_float));
+  e.z = z;
+  e.r = r;
+  if (!ret)
+    ret = hyb_estim_run(&e, n_data, hyb_estim_init_task);
+  e.jacobian = hyb_false;
+  if (!ret)
+    ret = hyb_estim_run(&e, e.segments, hyb_estim_task);
+  e.jacobian = hyb_true;
+  if (!ret)
+    ret = hyb_estim_run(&e, e.segments, hyb_estim_task);
+
+  hyb_float cost = ret ? 0.0 : hyb_estim_cost(&e, r);
+  const hyb_float cost0 = cost;
+  size_t it = 0;
+  for (hyb_bool done = ret ? hyb_true : hyb_false; !done && it < max_iter; it++) {
+    hyb_estim_normal(&e, A, g);
+    for (;;) {
+      /* Damped normal equations, with identity rows for the fixed unknowns */
+      memcpy(M, A, e.n * e.n * sizeof(hyb_float));
+      for (size_t j = 0; j < e.n; j++) {
+        zt[j] = -g[j];
+        if (e.fixed[j]) {
+          for (size_t k = 0; k < e.n; k++)
+            M[j + k * e.n] = M[k + j * e.n] = 0.0;
+          M[j * (e.n + 1)] = 1.0;
+          zt[j] = 0.0;
+        } else {
+          M[j * (e.n + 1)] += lambda * (A[j * (e.n + 1)] > 0.0 ? A[j * (e.n + 1)] : 1.0);
+        }
+      }
+      if (!hyb_estim_cholesky(M, e.n)) {
+        lambda *= 10.0;
+        if (lambda > HYB_ESTIM_LAMBDA_MAX) {
+          done = hyb_true;
+          break;
+        }
+        continue;
+      }
+      hyb_estim_cholesky_solve(M, e.n, zt);
+
+      hyb_float step = 0.0, norm = 0.0;
+      for (size_t j = 0; j < e.n; j++) {
+        step = fabs(zt[j]) > step ? fabs(zt[j]) : step;
+        norm = fabs(z[j]) > norm ? fabs(z[j]) : norm;
+        zt[j] += z[j];
+      }
+
+      e.z = zt;
+      e.r = rt;
+      e.jacobian = hyb_false;
+      hyb_float cost_t = hyb_estim_run(&e, e.segments, hyb_estim_task) ? INFINITY : hyb_estim_cost(&e, rt);
+      if (cost_t >= cost && cost_t < INFINITY && hyb_estim_restart(&e, zt, r, rt))
+        cost_t = hyb_estim_run(&e, e.segments, hyb_estim_task) ? INFINITY : hyb_estim_cost(&e, rt);
+      if (cost_t < cost) {
+        hyb_float *swap = z;
+        z = zt;
+        zt = swap;
+        swap = r;
+        r = rt;
+        rt = swap;
+        done = (cost - cost_t <= ftol * cost || step <= xtol * (norm + xtol)) ? hyb_true : hyb_false;
+        cost = cost_t;
+        lambda = lambda > 1e-12 ? 0.1 * lambda : lambda;
+        break;
+      }
+      lambda *= 10.0;
+      if (lambda > HYB_ESTIM_LAMBDA_MAX || step <= xtol * (norm + xtol)) {
+        done = hyb_true;
+        break;
+      }
+    }
+    e.z = z;
+    e.r = r;
+    if (!done) {
+      e.jacobian = hyb_true;
+      hyb_estim_run(&e, e.segments, hyb_estim_task);
+    }
+  }
+
+  if (result) {
+    memset(result, 0, sizeof(hyb_estim_result));
+    result->iterations = it;
+    result->cost0 = cost0;
+    result->cost = cost;
+    for (size_t t = 0; t < e.threads; t++)
+      result->simulations += e.simulations[t];
+    for (size_t i = 0; i < e.segments; i++) {
+      for (size_t q = 0; !e.seg[i].last && q < nx; q++) {
+        const hyb_float dq = fabs(r[e.seg[i].row0 + e.seg[i].rows - nx + q]) / e.wc;
+        result->defect = dq > result->defect ? dq : result->defect;
+      }
+    }
+  }
+  if (!ret) {
+    for (size_t a = 0, o = 0; a < n_p; o += p_size[a], a++)
+      memcpy(p[a], z + o, p_size[a] * sizeof(hyb_float));
+    for (size_t d = 0; d < n_data; d++)
+      memcpy(data[d].x0 + 2, z + np + e.first[d] * nx, nx * sizeof(hyb_float));
+  }
+
+  free(mem);
+  hyb_estim_free(&e);
+  return ret;
+}
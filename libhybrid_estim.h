@@ -0,0 +1,116 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2018 - Matteo Ragni, Matteo Cocetti - University of Trento
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#ifndef LIBHYBRID_ESTIM_H_
+#define LIBHYBRID_ESTIM_H_
+
+/**
+ * @file libhybrid_estim.h
+ * @author Matteo Ragni, Matteo Cocetti
+ *
+ * Parameter estimation through multiple shooting. Each dataset is split in
+ * segments of consecutive samples, and the initial state of each segment is
+ * an unknown of the problem next to the parameters. The residuals are the
+ * output errors of all the samples and the continuity defects between the end
+ * of a segment and the initial state of the following one. Since each
+ * simulation covers only a segment, the cost is far less rough than the one
+ * of a simulation from the initial state (the jumps of a segment do not move
+ * the whole remaining trajectory), and the segments are simulated in
+ * parallel (see hyb_parallel_for). The problem is solved with
+ * Levenberg-Marquardt, with a Jacobian by forward differences: each segment
+ * depends only on the parameters and on its own initial state, thus its
+ * block is computed by the thread that simulates it. The samples advance as
+ * in the System Identification wrapper (see hyb_sample_step), and the
+ * continuity is imposed as a weighted residual (the defects at the solution
+ * are reported).
+ */
+
+#include "libhybrid.h"
+
+/**
+ * @brief Identification dataset
+ *
+ * The k-th sample is taken at the time t[k], the measured output is
+ * y + k * y_size and the input held during the sample is u + k * u_stride.
+ */
+typedef struct hyb_dataset {
+  size_t length;      /**< Number of samples */
+  const hyb_float *t; /**< Sample times, strictly increasing */
+  const hyb_float *y; /**< Measured outputs, y_size * length elements */
+  const hyb_float *u; /**< Inputs (NULL for a model without input) */
+  size_t u_stride;    /**< Distance between the inputs of two samples (0 for a constant input) */
+  hyb_float *x0;      /**< Initial augmented state: guess on input, estimate on output */
+} hyb_dataset;
+
+/**
+ * @brief Options of the estimator
+ *
+ * Zero members take the default value.
+ */
+typedef struct hyb_estim_opts {
+  size_t segment;          /**< Samples per shooting segment (default 50) */
+  size_t max_iter;         /**< Maximum number of iterations (default 100) */
+  size_t threads;          /**< Number of threads (default: online processors) */
+  hyb_float continuity;    /**< Weight of the continuity defects (default 1) */
+  hyb_float lambda;        /**< Initial damping (default 1e-3) */
+  hyb_float ftol;          /**< Tolerance on the relative decrease of the cost (default 1e-10) */
+  hyb_float xtol;          /**< Tolerance on the relative length of the step (default 1e-10) */
+  hyb_float fd_step;       /**< Relative step of the finite differences (default sqrt(HYB_EPSILON)) */
+  const hyb_bool *free_p;  /**< Estimated parameters, one per scalar parameter (NULL for all) */
+  const hyb_bool *free_x0; /**< Estimated components of the initial states, x_size elements (NULL for all) */
+} hyb_estim_opts;
+
+/**
+ * @brief Summary of an estimation
+ */
+typedef struct hyb_estim_result {
+  size_t iterations;   /**< Performed iterations */
+  size_t simulations;  /**< Simulated segments */
+  hyb_float cost0;     /**< Initial cost (half the sum of the squared residuals) */
+  hyb_float cost;      /**< Final cost */
+  hyb_float defect;    /**< Largest continuity defect at the solution */
+} hyb_estim_result;
+
+/**
+ * @brief Estimates the parameters and the initial states of a model
+ *
+ * The parameters are the arrays of the MATLAB System Identification
+ * convention: the scalar parameters are taken in the order of the arrays.
+ * The initial states of the segments after the first are initialized by a
+ * simulation from the initial state with the initial parameters. The jump
+ * time of each segment starts from the one of x0 of its dataset.
+ * @param opts pointer to the option structure of the model (read only)
+ * @param eopts options of the estimator (NULL for the defaults)
+ * @param data datasets: the initial states are updated with the estimates
+ * @param n_data number of datasets
+ * @param p parameter arrays: initial guess on input, estimate on output
+ * @param n_p number of parameter arrays
+ * @param p_size number of elements of each parameter array
+ * @param result summary of the estimation (optional)
+ * @return HYB_SUCCESS, HYB_NULLPTR, HYB_EMALLOC, or the error of the
+ *         simulation from the initial guess. Errors of the simulations of the
+ *         trial points only reject the trial
+ */
+hyb_errorcode hyb_estimate(const hyb_opts *opts, const hyb_estim_opts *eopts, hyb_dataset *data, size_t n_data, hyb_float **p, size_t n_p, const size_t *p_size, hyb_estim_result *result);
+
+#endif /* LIBHYBRID_ESTIM_H_ */
@@ -0,0 +1,122 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2018 - Matteo Ragni, Matteo Cocetti - University of Trento
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/**
+ * @file libhybrid_model.c
+ * @author Matteo Ragni, Matteo Cocetti
+ */
+
+#include "libhybrid_model.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Checks the option structure of a model, once for the instance
+ */
+static hyb_errorcode hyb_model_validate(const hyb_opts *opts) {
+  if (!opts->F || !opts->J)
+    return HYB_NULLPTR;
+  if (!opts->fused) {
+    if (!opts->Y || !opts->D)
+      return HYB_NULLPTR;
+#if HYB_JUMP_LOGIC == 2
+    if (!opts->C)
+      return HYB_NULLPTR;
+#endif
+  }
+  if (opts->x_size == 0 || !(opts->Ts > 0) || !(opts->T_horizon >= 0) || !(opts->J_horizon >= 0))
+    return HYB_GENERIC;
+  return HYB_SUCCESS;
+}
+
+hyb_errorcode hyb_model_create(hyb_model **m, const hyb_opts *opts, size_t n_p, const size_t *p_size) {
+  if (!m)
+    return HYB_NULLPTR;
+  *m = NULL;
+  if (!opts || (n_p && !p_size))
+    return HYB_NULLPTR;
+  hyb_errorcode ret = hyb_model_validate(opts);
+  if (ret)
+    return ret;
+
+  /* Instance, parameter pointers, sizes and values in a single block */
+  size_t n_values = 0;
+  for (size_t i = 0; i < n_p; i++)
+    n_values += p_size[i];
+  hyb_model *model = (hyb_model *)calloc(1, sizeof(hyb_model) + n_p * (sizeof(hyb_float *) + sizeof(size_t)) + n_values * sizeof(hyb_float));
+  if (!model)
+    return HYB_EMALLOC;
+  model->opts = *opts;
+  ret = hyb_workspace_init(&model->ws, &model->opts);
+  if (ret) {
+    free(model);
+    return ret;
+  }
+
+  hyb_float **p = (hyb_float **)(model + 1);
+  size_t *size = (size_t *)(p + n_p);
+  hyb_float *v = (hyb_float *)(size + n_p);
+  for (size_t i = 0; i < n_p; i++) {
+    p[i] = v;
+    size[i] = p_size[i];
+    v += p_size[i];
+  }
+  model->n_p = n_p;
+  model->p_size = size;
+  model->p = p;
+  *m = model;
+  return HYB_SUCCESS;
+}
+
+void hyb_model_destroy(hyb_model *m) {
+  if (!m)
+    return;
+  hyb_workspace_free(&m->ws);
+  free(m);
+}
+
+hyb_errorcode hyb_model_set_param(hyb_model *m, size_t i, const hyb_float *v) {
+  if (!m || !v)
+    return HYB_NULLPTR;
+  if (i >= m->n_p)
+    return HYB_GENERIC;
+  memcpy(m->p[i], v, m->p_size[i] * sizeof(hyb_float));
+  return HYB_SUCCESS;
+}
+
+hyb_errorcode hyb_model_step(hyb_model *m, hyb_float *y, hyb_float *xp, const hyb_float *x, const hyb_float *u) {
+  if (!m)
+    return HYB_NULLPTR;
+  return hyb_step(&m->opts, &m->ws, y, xp, x, u, (const hyb_float **)m->p);
+}
+
+hyb_errorcode hyb_model_sample(hyb_model *m, hyb_float *y, hyb_float *xp, const hyb_float *x, const hyb_float *u, hyb_float dt) {
+  if (!m)
+    return HYB_NULLPTR;
+  return hyb_sample_step(&m->opts, &m->ws, y, xp, x, u, (const hyb_float **)m->p, dt);
+}
+
+hyb_errorcode hyb_model_simulate(hyb_model *m, hyb_trajectory *traj, const hyb_float *x0, const hyb_float *u, size_t u_stride) {
+  if (!m)
+    return HYB_NULLPTR;
+  return hyb_simulate(&m->opts, &m->ws, traj, x0, u, u_stride, (const hyb_float **)m->p);
+}
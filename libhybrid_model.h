@@ -0,0 +1,119 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2018 - Matteo Ragni, Matteo Cocetti - University of Trento
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef LIBHYBRID_MODEL_H_
+#define LIBHYBRID_MODEL_H_
+
+/**
+ * @file libhybrid_model.h
+ * @author Matteo Ragni, Matteo Cocetti
+ *
+ * Reentrant model instances. An instance owns a private copy of the option
+ * structure, its workspace and its parameter table, thus several instances
+ * (of the same model or of different models) may live in the same process,
+ * and independent instances may be advanced concurrently on different
+ * threads. The options are validated once, when the instance is created:
+ * the step functions only forward to the core drivers.
+ */
+
+#include "libhybrid.h"
+
+/**
+ * @brief Model instance
+ *
+ * The instance is allocated by hyb_model_create, as a single block, and
+ * released by hyb_model_destroy. The options may be modified between steps,
+ * as long as the sizes and the integrator are left unchanged. The parameter
+ * arrays p[i] (p_size[i] elements each) may be written directly.
+ */
+typedef struct hyb_model {
+  hyb_opts opts;        /**< Private copy of the options of the model */
+  hyb_workspace ws;     /**< Workspace of the instance */
+  size_t n_p;           /**< Number of parameter arrays */
+  const size_t *p_size; /**< Number of elements of each parameter array */
+  hyb_float **p;        /**< Parameter arrays, zero initialized */
+} hyb_model;
+
+/**
+ * @brief Creates a model instance
+ *
+ * Copies and validates the options, initializes the workspace and allocates
+ * the parameter table.
+ * @param m pointer that receives the new instance (NULL on failure)
+ * @param opts pointer to the option structure of the model
+ * @param n_p number of parameter arrays
+ * @param p_size number of elements of each parameter array (n_p elements)
+ * @return HYB_SUCCESS, HYB_NULLPTR (missing pointer or callback), HYB_GENERIC
+ *         (invalid sizes, step or horizons) or HYB_EMALLOC
+ */
+hyb_errorcode hyb_model_create(hyb_model **m, const hyb_opts *opts, size_t n_p, const size_t *p_size);
+
+/**
+ * @brief Releases a model instance
+ * @param m the instance to release (may be NULL)
+ */
+void hyb_model_destroy(hyb_model *m);
+
+/**
+ * @brief Copies the values of a parameter array in the instance
+ * @param m the instance
+ * @param i index of the parameter array
+ * @param v the values (p_size[i] elements)
+ * @return HYB_SUCCESS, HYB_NULLPTR or HYB_GENERIC (index out of range)
+ */
+hyb_errorcode hyb_model_set_param(hyb_model *m, size_t i, const hyb_float *v);
+
+/**
+ * @brief Performs a single step of the instance (see hyb_step)
+ * @param m the instance
+ * @param y vector that will contain the next output
+ * @param xp vector that will contain the next state
+ * @param x current state
+ * @param u current input
+ * @return an exit codes, as described in hyb_errorcode
+ */
+hyb_errorcode hyb_model_step(hyb_model *m, hyb_float *y, hyb_float *xp, const hyb_float *x, const hyb_float *u);
+
+/**
+ * @brief Advances the instance of one sample, absorbing the jumps (see hyb_sample_step)
+ * @param m the instance
+ * @param y output vector of size y_size
+ * @param xp state at the end of the sample
+ * @param x state at the beginning of the sample
+ * @param u input vector for the sample
+ * @param dt sample length
+ * @return an error code (HYB_SUCCESS if no error)
+ */
+hyb_errorcode hyb_model_sample(hyb_model *m, hyb_float *y, hyb_float *xp, const hyb_float *x, const hyb_float *u, hyb_float dt);
+
+/**
+ * @brief Simulates the instance over the whole horizon (see hyb_simulate)
+ * @param m the instance
+ * @param traj trajectory descriptor
+ * @param x0 initial augmented state
+ * @param u input samples
+ * @param u_stride distance between two input samples (0 for a constant input)
+ * @return an exit codes, as described in hyb_errorcode
+ */
+hyb_errorcode hyb_model_simulate(hyb_model *m, hyb_trajectory *traj, const hyb_float *x0, const hyb_float *u, size_t u_stride);
+
+#endif /* LIBHYBRID_MODEL_H_ */
@@ -0,0 +1,223 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2018 - Matteo Ragni, Matteo Cocetti - University of Trento
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+/**
+ * @file libhybrid_parallel.c
+ * @author Matteo Ragni, Matteo Cocetti
+ */
+
+#include "libhybrid_parallel.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <unistd.h>
+
+/**
+ * @brief Range of tasks owned by a thread, packed as (begin << 32) | end
+ *
+ * The owner pops from the front, thieves steal from the back. Both update
+ * the packed range with a compare and swap, thus they never take the same
+ * task. Each range lives on its own cache line.
+ */
+typedef struct hyb_range {
+  _Atomic uint64_t r; /**< Packed range */
+  char pad[HYB_CACHE_LINE - sizeof(uint64_t)]; /**< Padding against false sharing */
+} hyb_range;
+
+/**
+ * @brief Shared state of a parallel execution
+ */
+typedef struct hyb_pool {
+  size_t threads;    /**< Number of threads */
+  hyb_range *ranges; /**< Range of each thread */
+  hyb_task task;     /**< Task callback */
+  void *data;        /**< User data */
+} hyb_pool;
+
+/**
+ * @brief Arguments of a worker thread
+ */
+typedef struct hyb_worker {
+  hyb_pool *pool; /**< Shared state */
+  size_t id;      /**< Thread index */
+} hyb_worker;
+
+#define HYB_RANGE(B, E) (((uint64_t)(B) << 32) | (uint64_t)(E)) /**< Packs a range */
+#define HYB_RANGE_BEGIN(R) ((size_t)((R) >> 32)) /**< Begin of a packed range */
+#define HYB_RANGE_END(R) ((size_t)((R) & 0xffffffffu)) /**< End of a packed range */
+
+size_t hyb_parallel_threads(size_t threads) {
+  if (threads)
+    return threads;
+  long online = sysconf(_SC_NPROCESSORS_ONLN);
+  return online > 0 ? (size_t)online : 1;
+}
+
+/**
+ * @brief Pops the first task of a range. Returns hyb_false if it is empty
+ */
+static hyb_bool hyb_range_pop(hyb_range *range, size_t *i) {
+  uint64_t r = atomic_load(&range->r);
+  for (;;) {
+    size_t b = HYB_RANGE_BEGIN(r), e = HYB_RANGE_END(r);
+    if (b >= e)
+      return hyb_false;
+    if (atomic_compare_exchange_weak(&range->r, &r, HYB_RANGE(b + 1, e))) {
+      *i = b;
+      return hyb_true;
+    }
+  }
+}
+
+/**
+ * @brief Steals the back half of the largest range into the range of thief
+ */
+static hyb_bool hyb_range_steal(hyb_pool *pool, size_t thief) {
+  for (;;) {
+    size_t victim = pool->threads, largest = 0;
+    for (size_t t = 0; t < pool->threads; t++) {
+      uint64_t r = atomic_load(&pool->ranges[t].r);
+      size_t b = HYB_RANGE_BEGIN(r), e = HYB_RANGE_END(r);
+      if (t != thief && e > b && e - b > largest) {
+        largest = e - b;
+        victim = t;
+      }
+    }
+    if (victim == pool->threads)
+      return hyb_false;
+
+    uint64_t r = atomic_load(&pool->ranges[victim].r);
+    size_t b = HYB_RANGE_BEGIN(r), e = HYB_RANGE_END(r);
+    if (b >= e)
+      continue;
+    size_t half = (e - b + 1) / 2;
+    if (atomic_compare_exchange_strong(&pool->ranges[victim].r, &r, HYB_RANGE(b, e - half))) {
+      atomic_store(&pool->ranges[thief].r, HYB_RANGE(e - half, e));
+      return hyb_true;
+    }
+  }
+}
+
+/**
+ * @brief Worker loop: executes its own tasks, then steals
+ */
+static void *hyb_worker_run(void *arg) {
+  hyb_worker *w = (hyb_worker *)arg;
+  hyb_pool *pool = w->pool;
+  size_t i;
+  do {
+    while (hyb_range_pop(&pool->ranges[w->id], &i))
+      pool->task(i, w->id, pool->data);
+  } while (hyb_range_steal(pool, w->id));
+  return NULL;
+}
+
+hyb_errorcode hyb_parallel_for(size_t n, size_t threads, hyb_task task, void *data) {
+  if (!task)
+    return HYB_NULLPTR;
+  if ((uint64_t)n > 0xffffffffu)
+    return HYB_GENERIC;
+  threads = hyb_parallel_threads(threads);
+  if (threads > n)
+    threads = n ? n : 1;
+
+  hyb_pool pool = { threads, NULL, task, data };
+  hyb_worker *workers = (hyb_worker *)malloc(threads * sizeof(hyb_worker));
+  pthread_t *handles = (pthread_t *)malloc(threads * sizeof(pthread_t));
+  void *block = malloc((threads + 1) * sizeof(hyb_range));
+  if (!workers || !handles || !block) {
+    free(workers);
+    free(handles);
+    free(block);
+    return HYB_EMALLOC;
+  }
+  pool.ranges = (hyb_range *)(((uintptr_t)block + HYB_CACHE_LINE - 1) & ~((uintptr_t)HYB_CACHE_LINE - 1));
+
+  for (size_t t = 0; t < threads; t++) {
+    atomic_init(&pool.ranges[t].r, HYB_RANGE(n * t / threads, n * (t + 1) / threads));
+    workers[t].pool = &pool;
+    workers[t].id = t;
+  }
+
+  size_t started = 1;
+  for (; started < threads; started++) {
+    if (pthread_create(&handles[started], NULL, hyb_worker_run, &workers[started]))
+      break;
+  }
+  /* The calling thread works, and steals the ranges of threads not started:
+     all the tasks are executed even if no thread could be started */
+  hyb_worker_run(&workers[0]);
+  for (size_t t = 1; t < started; t++)
+    pthread_join(handles[t], NULL);
+
+  free(workers);
+  free(handles);
+  free(block);
+  return HYB_SUCCESS;
+}
+
+/**
+ * @brief Shared data of a sweep execution
+ */
+typedef struct hyb_sweep_data {
+  hyb_opts *opts;     /**< Model options */
+  hyb_sweep *sweep;   /**< Sweep description */
+  hyb_workspace *ws;  /**< Workspace of each thread */
+} hyb_sweep_data;
+
+/**
+ * @brief Task of a sweep: simulates a single case
+ */
+static void hyb_sweep_task(size_t i, size_t thread, void *data) {
+  hyb_sweep_data *d = (hyb_sweep_data *)data;
+  hyb_sweep *s = d->sweep;
+  hyb_errorcode ret = hyb_simulate(d->opts, &d->ws[thread], &s->traj[i],
+    s->x0 + i * s->x0_stride, s->u, s->u_stride, s->p[i]);
+  if (s->status)
+    s->status[i] = ret;
+}
+
+hyb_errorcode hyb_sweep_run(const hyb_opts *opts, hyb_sweep *sweep, size_t threads) {
+  if (!opts || !sweep || !sweep->x0 || !sweep->p || !sweep->traj)
+    return HYB_NULLPTR;
+  threads = hyb_parallel_threads(threads);
+  if (threads > sweep->cases)
+    threads = sweep->cases ? sweep->cases : 1;
+
+  hyb_sweep_data data = { (hyb_opts *)opts, sweep, NULL };
+  data.ws = (hyb_workspace *)calloc(threads, sizeof(hyb_workspace));
+  if (!data.ws)
+    return HYB_EMALLOC;
+
+  hyb_errorcode ret = HYB_SUCCESS;
+  for (size_t t = 0; t < threads && !ret; t++)
+    ret = hyb_workspace_init(&data.ws[t], opts);
+  if (!ret)
+    ret = hyb_parallel_for(sweep->cases, threads, hyb_sweep_task, &data);
+
+  for (size_t t = 0; t < threads; t++)
+    hyb_workspace_free(&data.ws[t]);
+  free(data.ws);
+  return ret;
+}
@@ -0,0 +1,101 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2018 - Matteo Ragni, Matteo Cocetti - University of Trento
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#ifndef LIBHYBRID_PARALLEL_H_
+#define LIBHYBRID_PARALLEL_H_
+
+/**
+ * @file libhybrid_parallel.h
+ * @author Matteo Ragni, Matteo Cocetti
+ *
+ * Native parallel execution of independent simulations (parameter sweeps,
+ * Monte Carlo studies). The cases are distributed on a pool of POSIX threads
+ * with work stealing: each thread starts from a contiguous range of cases and,
+ * once it is exhausted, steals half of the remaining cases of the busiest
+ * thread. This balances trajectories whose length and number of jumps differ
+ * wildly. Each thread owns its workspace, and the results of each case are
+ * written in the trajectory of the case, thus the placement of the output
+ * does not depend on the scheduling.
+ */
+
+#include "libhybrid.h"
+
+/**
+ * @brief Callback definition for a parallel task
+ * @param i the index of the task
+ * @param thread the index of the thread that executes the task (from 0 to threads - 1)
+ * @param data user data
+ */
+typedef void (*hyb_task)(size_t i, size_t thread, void *data);
+
+/**
+ * @brief Executes n independent tasks on a pool of threads, with work stealing
+ *
+ * The calling thread takes part in the execution as thread 0. The function
+ * returns when all the tasks are completed. If some threads cannot be
+ * started, their tasks are executed by the running ones (at worst by the
+ * calling thread alone): the result is the same, only slower.
+ * @param n number of tasks (less than 2^32)
+ * @param threads number of threads. If 0 the number of online processors is used
+ * @param task the task callback
+ * @param data user data for the callback
+ * @return HYB_SUCCESS when all the tasks are executed, HYB_NULLPTR,
+ *         HYB_EMALLOC, or HYB_GENERIC if n is too large
+ */
+hyb_errorcode hyb_parallel_for(size_t n, size_t threads, hyb_task task, void *data);
+
+/**
+ * @brief Returns the number of threads used by hyb_parallel_for
+ * @param threads requested number of threads, 0 for the number of online processors
+ * @return the actual number of threads
+ */
+size_t hyb_parallel_threads(size_t threads);
+
+/**
+ * @brief Description of a parameter sweep / Monte Carlo run
+ *
+ * Each case is simulated to the horizon with hyb_simulate, from its initial
+ * state and with its parameter vector, and stored in its own trajectory.
+ */
+typedef struct hyb_sweep {
+  size_t cases;          /**< Number of cases */
+  const hyb_float *x0;   /**< Initial augmented states, x0 + i * x0_stride for case i */
+  size_t x0_stride;      /**< Distance between initial states (0 to share x0 among all the cases) */
+  const hyb_float ***p;  /**< Parameter vector of each case */
+  const hyb_float *u;    /**< Input, shared among all the cases (see hyb_simulate) */
+  size_t u_stride;       /**< Distance between two input samples */
+  hyb_trajectory *traj;  /**< Trajectory of each case, with its buffers (output) */
+  hyb_errorcode *status; /**< Result of hyb_simulate for each case (output) */
+} hyb_sweep;
+
+/**
+ * @brief Simulates all the cases of a sweep in parallel
+ * @param opts pointer to the option structure of the model (shared, read only)
+ * @param sweep the sweep description
+ * @param threads number of threads, 0 for the number of online processors
+ * @return HYB_SUCCESS if all the cases have been executed (check status for
+ *         each case), or the error that prevented the execution
+ */
+hyb_errorcode hyb_sweep_run(const hyb_opts *opts, hyb_sweep *sweep, size_t threads);
+
+#endif /* LIBHYBRID_PARALLEL_H_ */
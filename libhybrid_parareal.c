@@ -0,0 +1,220 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2018 - Matteo Ragni, Matteo Cocetti - University of Trento
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/**
+ * @file libhybrid_parareal.c
+ * @author Matteo Ragni, Matteo Cocetti
+ */
+
+#include "libhybrid_parareal.h"
+#include "libhybrid_parallel.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+/**
+ * @brief Shared state of a Parareal run
+ */
+typedef struct hyb_parareal_data {
+  hyb_opts fine;            /**< Options of the fine propagator */
+  hyb_workspace *ws;        /**< Fine workspace of each thread */
+  const hyb_float *u;       /**< Constant input */
+  const hyb_float **p;      /**< Parameter vector */
+  size_t nx;                /**< Augmented state size */
+  size_t first;             /**< First slice of the current fine pass */
+  const hyb_float *t;       /**< Final flow time of each slice */
+  const hyb_float *U;       /**< Initial state of each slice */
+  hyb_float *F;             /**< Fine propagation of each slice */
+  hyb_errorcode *status;    /**< Result of the fine propagation of each slice */
+} hyb_parareal_data;
+
+/**
+ * @brief Propagates x until the flow time t_end, absorbing the jumps
+ *
+ * The propagation stops early at an horizon, keeping the last state. The
+ * workspace buffers xa, xb and y are used as scratch.
+ */
+static hyb_errorcode hyb_parareal_propagate(hyb_opts *opts, hyb_workspace *ws, hyb_float *xp, const hyb_float *x, hyb_float t_end, const hyb_float *u, const hyb_float **p) {
+  const size_t n = opts->x_size + 2;
+  hyb_float *z = ws->xa, *zn = ws->xb;
+  hyb_opts step_opts = *opts;
+  hyb_errorcode ret = HYB_SUCCESS;
+
+  ws->fsal = hyb_false;
+  ws->k0_ready = hyb_false;
+  memcpy(z, x, n * sizeof(hyb_float));
+  while (z[0] < t_end - HYB_EVENT_TOL * opts->Ts) {
+    step_opts.Ts = (t_end - z[0] < opts->Ts) ? t_end - z[0] : opts->Ts;
+    ret = hyb_step(&step_opts, ws, ws->y, zn, z, u, p);
+    if (ret == HYB_TLIMIT || ret == HYB_JLIMIT) {
+      ret = HYB_SUCCESS;
+      break;
+    }
+    if (ret != HYB_SUCCESS)
+      break;
+    hyb_float *swap = z;
+    z = zn;
+    zn = swap;
+  }
+  memcpy(xp, z, n * sizeof(hyb_float));
+  return ret;
+}
+
+/**
+ * @brief Task of the fine pass: propagates a slice
+ */
+static void hyb_parareal_task(size_t i, size_t thread, void *data) {
+  hyb_parareal_data *d = (hyb_parareal_data *)data;
+  const size_t n = d->first + i;
+  d->status[n] = hyb_parareal_propagate(&d->fine, &d->ws[thread], d->F + n * d->nx,
+    d->U + n * d->nx, d->t[n], d->u, d->p);
+}
+
+hyb_errorcode hyb_parareal(const hyb_opts *opts, const hyb_parareal_opts *popts, const hyb_float *x0, const hyb_float *u, const hyb_float **p, hyb_float *x_slices, hyb_parareal_result *result) {
+  if (!opts || !x0 || !x_slices)
+    return HYB_NULLPTR;
+  if (!(opts->T_horizon > x0[0]))
+    return HYB_GENERIC;
+
+  hyb_parareal_opts po;
+  memset(&po, 0, sizeof(po));
+  if (popts)
+    po = *popts;
+  const size_t threads = hyb_parallel_threads(po.threads);
+  const size_t N = po.slices ? po.slices : threads;
+  const size_t max_iter = po.max_iter ? po.max_iter : N;
+  const hyb_float atol = po.atol > 0.0 ? po.atol : 1e-8;
+  const hyb_float rtol = po.rtol > 0.0 ? po.rtol : 1e-6;
+  const size_t nx = opts->x_size + 2;
+
+  hyb_opts coarse = *opts;
+  coarse.Ts = po.coarse_Ts > 0.0 ? po.coarse_Ts : 10.0 * opts->Ts;
+  coarse.integrator = po.coarse_integrator;
+  coarse.h = 0.0;
+
+  hyb_parareal_data d;
+  memset(&d, 0, sizeof(d));
+  d.fine = *opts;
+  d.u = po.input ? NULL : u;
+  d.p = p;
+  d.nx = nx;
+  d.U = x_slices;
+
+  /* Slice end times, fine and coarse propagations, coarse scratch state */
+  hyb_float *block = (hyb_float *)malloc((N + (2 * N + 1) * nx) * sizeof(hyb_float));
+  d.status = (hyb_errorcode *)malloc(N * sizeof(hyb_errorcode));
+  d.ws = (hyb_workspace *)calloc(threads, sizeof(hyb_workspace));
+  hyb_workspace cws;
+  memset(&cws, 0, sizeof(cws));
+  hyb_errorcode ret = (block && d.status && d.ws) ? hyb_workspace_init(&cws, &coarse) : HYB_EMALLOC;
+  if (!ret && po.input)
+    ret = hyb_input_attach(&cws, po.input);
+  for (size_t t = 0; t < threads && !ret; t++) {
+    ret = hyb_workspace_init(&d.ws[t], &d.fine);
+    if (!ret && po.input)
+      ret = hyb_input_attach(&d.ws[t], po.input);
+  }
+
+  hyb_float *t_end = block;
+  hyb_float *G = block ? t_end + N : NULL;
+  hyb_float *g = block ? G + N * nx : NULL;
+  hyb_float *U = x_slices;
+  d.t = t_end;
+  d.F = block ? g + nx : NULL;
+  for (size_t n = 0; n < N && !ret; n++)
+    t_end[n] = (n + 1 == N) ? opts->T_horizon : x0[0] + (opts->T_horizon - x0[0]) * (hyb_float)(n + 1) / (hyb_float)N;
+
+  /* Initial prediction: coarse sweep from x0 */
+  memcpy(U, x0, nx * sizeof(hyb_float));
+  for (size_t n = 0; n < N && !ret; n++) {
+    ret = hyb_parareal_propagate(&coarse, &cws, G + n * nx, U + n * nx, t_end[n], d.u, p);
+    memcpy(U + (n + 1) * nx, G + n * nx, nx * sizeof(hyb_float));
+  }
+
+  hyb_parareal_result res;
+  memset(&res, 0, sizeof(res));
+  for (size_t k = 0; k < max_iter && !ret; k++) {
+    /* Fine pass on the slices whose initial state is not exact yet */
+    d.first = k;
+    ret = hyb_parallel_for(N - k, threads, hyb_parareal_task, &d);
+    for (size_t n = k; n < N && !ret; n++)
+      ret = d.status[n];
+    if (ret)
+      break;
+    res.fine += N - k;
+    res.iterations = k + 1;
+
+    /* Sequential correction, the slice k is exact */
+    hyb_float defect = 0.0;
+    for (size_t n = k; n < N && !ret; n++) {
+      hyb_float *next = U + (n + 1) * nx;
+      hyb_bool seeded = hyb_false;
+      const hyb_float *Fn = d.F + n * nx, *Gn = G + n * nx;
+      if (n == k) {
+        memcpy(g, Fn, nx * sizeof(hyb_float));
+      } else {
+        /* Coarse prediction from the new initial state, in G after the correction */
+        hyb_float *Gk = g;
+        ret = hyb_parareal_propagate(&coarse, &cws, Gk, U + n * nx, t_end[n], d.u, p);
+        if (ret)
+          break;
+        if (Gk[1] == Gn[1] && Fn[1] == Gn[1]) {
+          for (size_t i = 0; i < nx; i++) {
+            const hyb_float gi = Gk[i];
+            Gk[i] = gi + Fn[i] - Gn[i];
+            G[n * nx + i] = gi;
+          }
+        } else {
+          /* Different jumps: re-seed the slice on the new coarse prediction,
+             that is not a fixed point of the iteration */
+          memcpy(G + n * nx, Gk, nx * sizeof(hyb_float));
+          seeded = hyb_true;
+        }
+      }
+      if (seeded || g[1] != next[1]) {
+        defect = HUGE_VAL;
+      } else {
+        for (size_t i = 2; i < nx; i++) {
+          const hyb_float e = fabs(g[i] - next[i]) / (atol + rtol * fabs(g[i]));
+          if (e > defect)
+            defect = e;
+        }
+      }
+      memcpy(next, g, nx * sizeof(hyb_float));
+    }
+    res.defect = defect;
+    if (!ret && (defect <= 1.0 || k + 1 == N)) {
+      res.converged = hyb_true;
+      break;
+    }
+  }
+
+  for (size_t t = 0; d.ws && t < threads; t++)
+    hyb_workspace_free(&d.ws[t]);
+  hyb_workspace_free(&cws);
+  free(d.ws);
+  free(d.status);
+  free(block);
+  if (result)
+    *result = res;
+  return ret;
+}
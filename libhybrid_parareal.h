@@ -0,0 +1,103 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2018 - Matteo Ragni, Matteo Cocetti - University of Trento
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef LIBHYBRID_PARAREAL_H_
+#define LIBHYBRID_PARAREAL_H_
+
+/**
+ * @file libhybrid_parareal.h
+ * @author Matteo Ragni, Matteo Cocetti
+ *
+ * Parallel-in-time simulation of a single long trajectory (Parareal). The
+ * horizon [x0[0], T_horizon] is split in time slices. A cheap coarse
+ * propagator (the same model with a larger step) predicts the states at the
+ * slice boundaries sequentially, then the fine propagator (the options of
+ * the model) advances all the slices in parallel (see hyb_parallel_for), and
+ * the prediction is corrected:
+ * \f[
+ *   U_{n+1}^{k+1} = G(U_n^{k+1}) + F(U_n^k) - G(U_n^k)
+ * \f]
+ * until the boundary states stop changing. After k iterations the first k
+ * slices are exact, thus the result is the sequential one after at most as
+ * many iterations as slices.
+ *
+ * The correction is meaningful only when the three propagations cross the
+ * same jumps: the jump counters are compared, and when they differ the slice
+ * is re-seeded with the coarse prediction G(U_n^{k+1}) of its new initial
+ * state, so that a jump that moves across a boundary is followed by the
+ * next iterations. A re-seeded slice is never considered converged.
+ *
+ * A slice ends exactly at its final flow time (the jumps at that time belong
+ * to the following slice), as in hyb_sample_step. The fixed point is the fine
+ * solution restarted at every slice boundary: when the slice length is not a
+ * multiple of Ts the integration grid differs from the one of hyb_simulate,
+ * and so may the detected jump instants.
+ */
+
+#include "libhybrid.h"
+
+/**
+ * @brief Options of the Parareal solver
+ *
+ * Zero members take the default value.
+ */
+typedef struct hyb_parareal_opts {
+  size_t slices;                    /**< Number of time slices (default: number of threads) */
+  size_t threads;                   /**< Number of threads (default: online processors) */
+  size_t max_iter;                  /**< Maximum number of iterations (default: slices) */
+  hyb_float coarse_Ts;              /**< Step of the coarse propagator (default 10 Ts) */
+  hyb_integrator coarse_integrator; /**< Integrator of the coarse propagator (default HYB_RK4) */
+  hyb_float atol;                   /**< Absolute tolerance on the change of the boundary states (default 1e-8) */
+  hyb_float rtol;                   /**< Relative tolerance on the change of the boundary states (default 1e-6) */
+  const hyb_input *input;           /**< Input signal attached to all the propagators (NULL to use u) */
+} hyb_parareal_opts;
+
+/**
+ * @brief Report of the Parareal solver
+ */
+typedef struct hyb_parareal_result {
+  size_t iterations; /**< Performed iterations */
+  size_t fine;       /**< Fine slice propagations (slices * iterations at most) */
+  hyb_float defect;  /**< Last scaled change of the boundary states (at most 1 if converged) */
+  hyb_bool converged; /**< hyb_true if the boundary states converged */
+} hyb_parareal_result;
+
+/**
+ * @brief Simulates a trajectory with the Parareal method
+ *
+ * The result are the augmented states at the slice boundaries: x_slices
+ * holds slices + 1 states, the first one is x0 and the last one is the state
+ * at T_horizon (or where the jump horizon is reached). Each slice can then be
+ * regenerated independently, from its initial state, with the fine model.
+ * @param opts pointer to the option structure of the model (fine propagator)
+ * @param popts options of the solver (NULL for the defaults)
+ * @param x0 initial augmented state
+ * @param u input vector (constant, ignored if popts->input is set)
+ * @param p parameter vector
+ * @param x_slices output boundary states, (slices + 1) * (x_size + 2) elements
+ * @param result report of the solver (may be NULL)
+ * @return HYB_SUCCESS, HYB_NULLPTR, HYB_EMALLOC, HYB_GENERIC (no horizon to
+ *         cover) or the error of a failing step
+ */
+hyb_errorcode hyb_parareal(const hyb_opts *opts, const hyb_parareal_opts *popts, const hyb_float *x0, const hyb_float *u, const hyb_float **p, hyb_float *x_slices, hyb_parareal_result *result);
+
+#endif /* LIBHYBRID_PARAREAL_H_ */
@@ -0,0 +1,248 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2018 - Matteo Ragni, Matteo Cocetti - University of Trento
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/**
+ * @file libhybrid_pipe.c
+ * @author Matteo Ragni, Matteo Cocetti
+ */
+
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L /**< nanosleep is POSIX, not C99 */
+#endif
+
+#include "libhybrid_pipe.h"
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#define HYB_PIPE_CAPACITY 4096        /**< Default records of each ring */
+#define HYB_PIPE_DECIMATE_DEFAULT 10  /**< Default decimation factor */
+
+/**
+ * @brief Single-producer / single-consumer ring of a consumer
+ *
+ * head is written by the producer only and tail by the consumer only, each
+ * on its own cache line. The producer releases a record storing head, the
+ * consumer releases its slot storing tail.
+ */
+struct hyb_ring {
+  _Atomic size_t head;                  /**< Next record to write */
+  char pad0[HYB_CACHE_LINE - sizeof(size_t)]; /**< Padding against false sharing */
+  _Atomic size_t tail;                  /**< Next record to read */
+  _Atomic int error;                    /**< Error of the consumer, HYB_SUCCESS while running */
+  _Atomic int closed;                   /**< Set by the producer when no more records come */
+  char pad1[HYB_CACHE_LINE - sizeof(size_t) - 2 * sizeof(int)]; /**< Padding against false sharing */
+  size_t published;                     /**< Published records (producer only) */
+  size_t dropped;                       /**< Dropped records (producer only) */
+  size_t skip;                          /**< Decimation counter (producer only) */
+  hyb_float *rec;                       /**< Records, capacity * record_size */
+  const hyb_pipe *pipe;                 /**< Owner */
+  hyb_pipe_consumer consumer;           /**< Consumer */
+  pthread_t thread;                     /**< Thread of the consumer */
+  hyb_bool started;                     /**< hyb_true if the thread is running */
+};
+
+/**
+ * @brief Waits for the other side of a ring: spins, then yields, then sleeps
+ */
+static void hyb_pipe_backoff(unsigned *spins) {
+  if (*spins < 64) {
+    (*spins)++;
+  } else if (*spins < 128) {
+    (*spins)++;
+    sched_yield();
+  } else {
+    struct timespec ts = { 0, 50000 };
+    nanosleep(&ts, NULL);
+  }
+}
+
+/**
+ * @brief Consumer loop: drains the ring in contiguous batches until it is closed and empty
+ */
+static void *hyb_pipe_run(void *arg) {
+  hyb_ring *r = (hyb_ring *)arg;
+  const hyb_pipe *pipe = r->pipe;
+  const size_t capacity = pipe->opts.capacity, rs = pipe->record_size;
+  unsigned spins = 0;
+
+  for (;;) {
+    const size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    const size_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+    if (head == tail) {
+      if (atomic_load_explicit(&r->closed, memory_order_acquire) &&
+          atomic_load_explicit(&r->head, memory_order_acquire) == tail)
+        break;
+      hyb_pipe_backoff(&spins);
+      continue;
+    }
+    spins = 0;
+    const size_t first = tail & (capacity - 1);
+    size_t n = head - tail;
+    if (n > capacity - first)
+      n = capacity - first;
+    if (pipe->opts.batch && n > pipe->opts.batch)
+      n = pipe->opts.batch;
+    hyb_errorcode ret = r->consumer.drain(r->rec + first * rs, n, rs, r->consumer.data);
+    atomic_store_explicit(&r->tail, tail + n, memory_order_release);
+    if (ret != HYB_SUCCESS) {
+      atomic_store_explicit(&r->error, (int)ret, memory_order_release);
+      break;
+    }
+  }
+  return NULL;
+}
+
+hyb_errorcode hyb_pipe_open(hyb_pipe *pipe, const hyb_opts *opts, const hyb_pipe_opts *popts, const hyb_pipe_consumer *consumers, size_t n) {
+  if (!pipe || !opts || (n && !consumers))
+    return HYB_NULLPTR;
+  memset(pipe, 0, sizeof(hyb_pipe));
+  for (size_t c = 0; c < n; c++) {
+    if (!consumers[c].drain)
+      return HYB_NULLPTR;
+  }
+
+  if (popts)
+    pipe->opts = *popts;
+  size_t capacity = 1;
+  while (capacity < (pipe->opts.capacity ? pipe->opts.capacity : HYB_PIPE_CAPACITY))
+    capacity <<= 1;
+  pipe->opts.capacity = capacity;
+  if (!pipe->opts.decimate)
+    pipe->opts.decimate = HYB_PIPE_DECIMATE_DEFAULT;
+  pipe->x_size = opts->x_size + 2;
+  pipe->y_size = opts->y_size;
+  pipe->record_size = pipe->x_size + pipe->y_size + 1;
+  pipe->n = n;
+
+  const size_t rings = (n * sizeof(hyb_ring) + HYB_CACHE_LINE - 1) / HYB_CACHE_LINE * HYB_CACHE_LINE;
+  pipe->block = malloc(HYB_CACHE_LINE + rings + n * capacity * pipe->record_size * sizeof(hyb_float));
+  if (!pipe->block)
+    return HYB_EMALLOC;
+  pipe->rings = (hyb_ring *)(((uintptr_t)pipe->block + HYB_CACHE_LINE - 1) & ~((uintptr_t)HYB_CACHE_LINE - 1));
+  hyb_float *rec = (hyb_float *)((char *)pipe->rings + rings);
+
+  hyb_errorcode ret = HYB_SUCCESS;
+  for (size_t c = 0; c < n; c++) {
+    hyb_ring *r = &pipe->rings[c];
+    memset(r, 0, sizeof(hyb_ring));
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    atomic_init(&r->error, HYB_SUCCESS);
+    atomic_init(&r->closed, 0);
+    r->rec = rec + c * capacity * pipe->record_size;
+    r->pipe = pipe;
+    r->consumer = consumers[c];
+  }
+  for (size_t c = 0; c < n && !ret; c++) {
+    hyb_ring *r = &pipe->rings[c];
+    if (pthread_create(&r->thread, NULL, hyb_pipe_run, r))
+      ret = HYB_GENERIC;
+    else
+      r->started = hyb_true;
+  }
+  if (ret)
+    hyb_pipe_close(pipe, NULL);
+  return ret;
+}
+
+hyb_errorcode hyb_pipe_push(hyb_pipe *pipe, const hyb_float *x, const hyb_float *y, hyb_bool jumped) {
+  const size_t capacity = pipe->opts.capacity, rs = pipe->record_size;
+  hyb_errorcode ret = HYB_SUCCESS;
+
+  for (size_t c = 0; c < pipe->n; c++) {
+    hyb_ring *r = &pipe->rings[c];
+    const int error = atomic_load_explicit(&r->error, memory_order_acquire);
+    if (error != HYB_SUCCESS) {
+      ret = (hyb_errorcode)error;
+      continue;
+    }
+    const size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    size_t used = head - atomic_load_explicit(&r->tail, memory_order_acquire);
+
+    if (pipe->opts.mode == HYB_PIPE_DECIMATE && used >= capacity / 2) {
+      if (r->skip++ % pipe->opts.decimate) {
+        r->dropped++;
+        continue;
+      }
+    } else {
+      r->skip = 0;
+    }
+    if (used == capacity) {
+      if (pipe->opts.mode != HYB_PIPE_BLOCK) {
+        r->dropped++;
+        continue;
+      }
+      unsigned spins = 0;
+      while (used == capacity && atomic_load_explicit(&r->error, memory_order_acquire) == HYB_SUCCESS) {
+        hyb_pipe_backoff(&spins);
+        used = head - atomic_load_explicit(&r->tail, memory_order_acquire);
+      }
+      if (used == capacity) {
+        ret = (hyb_errorcode)atomic_load_explicit(&r->error, memory_order_acquire);
+        continue;
+      }
+    }
+
+    hyb_float *dst = r->rec + (head & (capacity - 1)) * rs;
+    memcpy(dst, x, pipe->x_size * sizeof(hyb_float));
+    if (y)
+      memcpy(dst + pipe->x_size, y, pipe->y_size * sizeof(hyb_float));
+    else
+      memset(dst + pipe->x_size, 0, pipe->y_size * sizeof(hyb_float));
+    dst[rs - 1] = jumped ? 1.0 : 0.0;
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+    r->published++;
+  }
+  return ret;
+}
+
+hyb_errorcode hyb_pipe_sink(const hyb_float *x, const hyb_float *y, hyb_bool jumped, void *data) {
+  return hyb_pipe_push((hyb_pipe *)data, x, y, jumped);
+}
+
+hyb_errorcode hyb_pipe_close(hyb_pipe *pipe, hyb_pipe_stats *stats) {
+  if (!pipe)
+    return HYB_NULLPTR;
+  hyb_errorcode ret = HYB_SUCCESS;
+  for (size_t c = 0; c < pipe->n && pipe->rings; c++)
+    atomic_store_explicit(&pipe->rings[c].closed, 1, memory_order_release);
+  for (size_t c = 0; c < pipe->n && pipe->rings; c++) {
+    hyb_ring *r = &pipe->rings[c];
+    if (r->started)
+      pthread_join(r->thread, NULL);
+    const int error = atomic_load_explicit(&r->error, memory_order_acquire);
+    if (!ret && error != HYB_SUCCESS)
+      ret = (hyb_errorcode)error;
+    if (stats) {
+      stats[c].published = r->published;
+      stats[c].dropped = r->dropped;
+    }
+  }
+  free(pipe->block);
+  memset(pipe, 0, sizeof(hyb_pipe));
+  return ret;
+}
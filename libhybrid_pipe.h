@@ -0,0 +1,167 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2018 - Matteo Ragni, Matteo Cocetti - University of Trento
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef LIBHYBRID_PIPE_H_
+#define LIBHYBRID_PIPE_H_
+
+/**
+ * @file libhybrid_pipe.h
+ * @author Matteo Ragni, Matteo Cocetti
+ *
+ * Pipeline between a running simulation and the consumers of its samples
+ * (logging, plotting, controllers). The simulation thread publishes each
+ * sample as a record in a lock-free single-producer / single-consumer ring
+ * buffer, one ring per consumer, and each consumer runs on its own thread,
+ * draining its ring in batches. The consumers never stall the integrator,
+ * unless the blocking backpressure is selected. Usage:
+ * @code
+ * hyb_pipe pipe;
+ * hyb_pipe_consumer c = { log_records, log_file };
+ * hyb_pipe_open(&pipe, &opts, NULL, &c, 1);
+ * traj.sink = hyb_pipe_sink;
+ * traj.data = &pipe;
+ * ret = hyb_simulate(&opts, &ws, &traj, x0, u, 0, p);
+ * ret2 = hyb_pipe_close(&pipe, NULL);
+ * @endcode
+ * Records are arrays of hyb_float: flow time, jump time, state (x_size),
+ * output (y_size, zero if not available) and 1.0 for the samples produced by
+ * a jump step (0.0 otherwise), thus record_size = x_size + y_size + 3.
+ */
+
+#include "libhybrid.h"
+
+/**
+ * @brief Behaviour of the producer when a ring is full
+ */
+typedef enum hyb_backpressure {
+  HYB_PIPE_BLOCK = 0, /**< Wait until the consumer frees a record (no loss) */
+  HYB_PIPE_DROP,      /**< Drop the new record */
+  HYB_PIPE_DECIMATE   /**< Over half of the capacity publish one record out of hyb_pipe_opts::decimate, drop when full */
+} hyb_backpressure;
+
+/**
+ * @brief Callback definition for a consumer
+ *
+ * Called on the thread of the consumer with a batch of contiguous records.
+ * The records are valid only during the call.
+ * @param records first record of the batch
+ * @param n number of records in the batch
+ * @param record_size distance between two records (x_size + y_size + 3)
+ * @param data user data, as set in the hyb_pipe_consumer structure
+ * @return HYB_SUCCESS to continue. Any other value stops the consumer, and
+ *         it is returned to the producer by the following publications
+ */
+typedef hyb_errorcode (*hyb_pipe_drain)(const hyb_float *records, size_t n, size_t record_size, void *data);
+
+/**
+ * @brief Consumer of a pipeline
+ */
+typedef struct hyb_pipe_consumer {
+  hyb_pipe_drain drain; /**< Batch callback */
+  void *data;           /**< User data for the callback */
+} hyb_pipe_consumer;
+
+/**
+ * @brief Options of a pipeline
+ *
+ * Zero fields take the default value.
+ */
+typedef struct hyb_pipe_opts {
+  size_t capacity;           /**< Records of each ring, rounded up to a power of two (default 4096) */
+  hyb_backpressure mode;     /**< Behaviour when a ring is full (default HYB_PIPE_BLOCK) */
+  size_t decimate;           /**< Decimation factor of HYB_PIPE_DECIMATE (default 10) */
+  size_t batch;              /**< Maximum records per callback (default all the available ones) */
+} hyb_pipe_opts;
+
+/**
+ * @brief Counters of a consumer, filled by hyb_pipe_close
+ */
+typedef struct hyb_pipe_stats {
+  size_t published; /**< Records published in the ring */
+  size_t dropped;   /**< Records dropped by the backpressure */
+} hyb_pipe_stats;
+
+typedef struct hyb_ring hyb_ring;
+
+/**
+ * @brief Pipeline
+ *
+ * The structure must be initialized through hyb_pipe_open and released
+ * through hyb_pipe_close. All the members are for internal use only. Only
+ * one thread may publish.
+ */
+typedef struct hyb_pipe {
+  size_t x_size;           /**< Augmented state size (x_size + 2) */
+  size_t y_size;           /**< Output size */
+  size_t record_size;      /**< Record size */
+  hyb_pipe_opts opts;      /**< Options, with the defaults applied */
+  size_t n;                /**< Number of consumers */
+  hyb_ring *rings;         /**< Ring of each consumer */
+  void *block;             /**< Allocated memory block */
+} hyb_pipe;
+
+/**
+ * @brief Opens a pipeline and starts the consumer threads
+ * @param pipe the pipeline to open
+ * @param opts pointer to the option structure of the model
+ * @param popts options of the pipeline (NULL for the defaults)
+ * @param consumers the consumers (n elements)
+ * @param n number of consumers
+ * @return HYB_SUCCESS, HYB_NULLPTR, HYB_EMALLOC or HYB_GENERIC if a thread
+ *         cannot be started
+ */
+hyb_errorcode hyb_pipe_open(hyb_pipe *pipe, const hyb_opts *opts, const hyb_pipe_opts *popts, const hyb_pipe_consumer *consumers, size_t n);
+
+/**
+ * @brief Publishes a sample to all the consumers
+ *
+ * Does not allocate. It waits only with HYB_PIPE_BLOCK, when a ring is full.
+ * @param pipe the pipeline
+ * @param x augmented state of the sample
+ * @param y output of the sample (NULL publishes zeros)
+ * @param jumped hyb_true if the sample is the result of a jump step
+ * @return HYB_SUCCESS, or the error of a consumer that stopped
+ */
+hyb_errorcode hyb_pipe_push(hyb_pipe *pipe, const hyb_float *x, const hyb_float *y, hyb_bool jumped);
+
+/**
+ * @brief Trajectory sink that publishes the samples in a pipeline (see hyb_sink)
+ * @param x augmented state of the sample
+ * @param y output of the sample
+ * @param jumped hyb_true if the sample is the result of a jump step
+ * @param data the hyb_pipe
+ * @return as hyb_pipe_push
+ */
+hyb_errorcode hyb_pipe_sink(const hyb_float *x, const hyb_float *y, hyb_bool jumped, void *data);
+
+/**
+ * @brief Closes a pipeline
+ *
+ * The consumers drain the remaining records, then the threads are joined and
+ * the pipeline is released.
+ * @param pipe the pipeline
+ * @param stats counters of each consumer (n elements, NULL to discard them)
+ * @return HYB_SUCCESS or the first error returned by a consumer
+ */
+hyb_errorcode hyb_pipe_close(hyb_pipe *pipe, hyb_pipe_stats *stats);
+
+#endif /* LIBHYBRID_PIPE_H_ */
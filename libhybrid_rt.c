@@ -0,0 +1,181 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2018 - Matteo Ragni, Matteo Cocetti - University of Trento
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/**
+ * @file libhybrid_rt.c
+ * @author Matteo Ragni, Matteo Cocetti
+ */
+
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L /**< clock_gettime and clock_nanosleep are POSIX, not C99 */
+#endif
+
+#include "libhybrid_rt.h"
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+/**
+ * @brief Monotonic wall clock in nanoseconds
+ */
+static inline unsigned long long hyb_rt_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+/**
+ * @brief Sleeps until an absolute time of the monotonic clock
+ */
+static void hyb_rt_sleep_until(unsigned long long ns) {
+  struct timespec ts;
+  ts.tv_sec = (time_t)(ns / 1000000000ULL);
+  ts.tv_nsec = (long)(ns % 1000000000ULL);
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+}
+
+/**
+ * @brief Adds a sample to the histogram of a phase
+ */
+static inline void hyb_rt_record(hyb_rt_stats *stats, hyb_rt_phase phase, unsigned long long ns) {
+  hyb_rt_histogram *h = &stats->phase[phase];
+  const unsigned long long b = ns / stats->bin_ns;
+  h->bins[b < HYB_RT_BINS ? b : HYB_RT_BINS - 1]++;
+  h->count++;
+  h->total_ns += ns;
+  if (ns > h->worst_ns)
+    h->worst_ns = ns;
+  if (ns > stats->period_ns)
+    h->misses++;
+}
+
+/**
+ * @brief Touches the stack that the loop will use, so that it does not fault in the loop
+ */
+static void hyb_rt_prefault(void) {
+  volatile unsigned char stack[HYB_RT_STACK];
+  for (size_t i = 0; i < HYB_RT_STACK; i += 256)
+    stack[i] = 0;
+  (void) stack[0];
+}
+
+hyb_errorcode hyb_rt_run(hyb_opts *opts, hyb_workspace *ws, const hyb_rt_opts *rt, hyb_float *x, hyb_float *u, const hyb_float **p, hyb_rt_stats *stats) {
+  if (!opts || !ws || !rt || !x || !stats)
+    return HYB_NULLPTR;
+
+  const size_t n = opts->x_size + 2;
+  const hyb_float period = rt->period > 0 ? rt->period : opts->Ts;
+  const hyb_bool sub_steps = (opts->G || opts->integrator != HYB_RK4) ? hyb_true : hyb_false;
+  hyb_float *xp = ws->xb, *y = ws->y;
+  hyb_opts step_opts = *opts;
+
+  memset(stats, 0, sizeof(hyb_rt_stats));
+  stats->period_ns = (unsigned long long)(period * 1e9 + 0.5);
+  stats->bin_ns = rt->bin_ns ? rt->bin_ns : stats->period_ns / 32;
+  if (stats->period_ns == 0 || stats->bin_ns == 0)
+    return HYB_GENERIC;
+
+  if (rt->lock && mlockall(MCL_CURRENT | MCL_FUTURE))
+    return HYB_GENERIC;
+  int policy = 0;
+  struct sched_param param;
+  if (rt->priority > 0) {
+    struct sched_param fifo;
+    pthread_getschedparam(pthread_self(), &policy, &param);
+    memset(&fifo, 0, sizeof(fifo));
+    fifo.sched_priority = rt->priority;
+    if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &fifo)) {
+      if (rt->lock)
+        munlockall();
+      return HYB_GENERIC;
+    }
+  }
+  hyb_rt_prefault();
+
+  hyb_errorcode ret = HYB_SUCCESS;
+  unsigned long long deadline = hyb_rt_now() + stats->period_ns;
+  while (!rt->cycles || stats->cycles < rt->cycles) {
+    hyb_rt_sleep_until(deadline);
+    unsigned long long t0 = hyb_rt_now();
+    hyb_rt_record(stats, HYB_RT_WAKEUP, t0 > deadline ? t0 - deadline : 0);
+
+    /* One sample of flow time, jumps included (see hyb_sample_step) */
+    const hyb_float t_end = x[0] + opts->Ts;
+    hyb_bool done = hyb_false;
+    for (;;) {
+      if (sub_steps)
+        step_opts.Ts = (t_end - x[0] < opts->Ts) ? t_end - x[0] : opts->Ts;
+      ret = hyb_step(&step_opts, ws, y, xp, x, u, p);
+      const unsigned long long t1 = hyb_rt_now();
+      if (ret == HYB_TLIMIT || ret == HYB_JLIMIT) {
+        ret = HYB_SUCCESS;
+        done = hyb_true;
+        break;
+      }
+      if (ret != HYB_SUCCESS)
+        break;
+      const hyb_bool jumped = (xp[1] != x[1]) ? hyb_true : hyb_false;
+      hyb_rt_record(stats, jumped ? HYB_RT_JUMP : HYB_RT_FLOW, t1 - t0);
+      memcpy(x, xp, n * sizeof(hyb_float));
+      t0 = t1;
+      if (!jumped && !(sub_steps && x[0] < t_end - HYB_EVENT_TOL * opts->Ts))
+        break;
+    }
+    if (ret != HYB_SUCCESS || done)
+      break;
+
+    if (rt->io) {
+      ret = rt->io(u, x, y, stats->cycles, rt->data);
+      const unsigned long long t1 = hyb_rt_now();
+      hyb_rt_record(stats, HYB_RT_IO, t1 - t0);
+      if (ret != HYB_SUCCESS)
+        break;
+    }
+    const unsigned long long end = hyb_rt_now();
+    hyb_rt_record(stats, HYB_RT_PERIOD, end > deadline ? end - deadline : 0);
+    stats->cycles++;
+    deadline += stats->period_ns;
+  }
+
+  if (rt->priority > 0)
+    pthread_setschedparam(pthread_self(), policy, &param);
+  if (rt->lock)
+    munlockall();
+  return ret;
+}
+
+unsigned long long hyb_rt_quantile(const hyb_rt_stats *stats, hyb_rt_phase phase, double q) {
+  if (!stats || phase >= HYB_RT_PHASES)
+    return 0;
+  const hyb_rt_histogram *h = &stats->phase[phase];
+  const double target = q * (double)h->count;
+  unsigned long long seen = 0;
+  for (size_t b = 0; b + 1 < HYB_RT_BINS; b++) {
+    seen += h->bins[b];
+    if ((double)seen >= target && seen > 0)
+      return (b + 1) * stats->bin_ns;
+  }
+  return h->worst_ns;
+}
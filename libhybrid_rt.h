@@ -0,0 +1,152 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2018 - Matteo Ragni, Matteo Cocetti - University of Trento
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#ifndef LIBHYBRID_RT_H_
+#define LIBHYBRID_RT_H_
+
+/**
+ * @file libhybrid_rt.h
+ * @author Matteo Ragni, Matteo Cocetti
+ *
+ * Real-time runner for plant simulators (hardware-in-the-loop rigs). The
+ * model is advanced of one sample per wall clock period: the activations
+ * are scheduled with absolute deadlines (clock_nanosleep with TIMER_ABSTIME
+ * on CLOCK_MONOTONIC), thus the period does not drift with the step time.
+ * After the setup (memory locking, stack prefaulting, scheduling policy) the
+ * loop does not allocate: all the buffers are in the workspace. The runner
+ * records a latency histogram, deadline misses and worst case times for each
+ * phase of the period (wake up, flow steps, jump steps, exchange of the
+ * inputs and outputs, whole period), to verify the budget of a model and to
+ * find which phase exceeds it. Requires POSIX.1-2008 (Linux).
+ */
+
+#include "libhybrid.h"
+
+#ifndef HYB_RT_BINS
+#define HYB_RT_BINS 64 /**< Number of bins of the latency histograms (the last one collects the overflow) */
+#endif
+
+#ifndef HYB_RT_STACK
+#define HYB_RT_STACK (64 * 1024) /**< Stack prefaulted before the loop, in bytes */
+#endif
+
+/**
+ * @brief Phases of a real-time period
+ */
+typedef enum hyb_rt_phase {
+  HYB_RT_WAKEUP = 0, /**< Delay between the deadline and the wake up */
+  HYB_RT_FLOW,       /**< Flow step (hyb_step that does not jump) */
+  HYB_RT_JUMP,       /**< Jump step (hyb_step that jumps) */
+  HYB_RT_IO,         /**< Exchange callback */
+  HYB_RT_PERIOD,     /**< Whole period, from the deadline to the end of the work */
+  HYB_RT_PHASES      /**< Number of phases */
+} hyb_rt_phase;
+
+/**
+ * @brief Callback definition for the exchange with the rig
+ *
+ * Called at the end of each period with the state and the output of the
+ * sample: it publishes them and writes the input of the next sample. It
+ * must not block.
+ * @param u the input of the next sample (as passed to hyb_rt_run)
+ * @param x the augmented state at the end of the sample
+ * @param y the output of the sample
+ * @param cycle the index of the period
+ * @param data user data, as set in the hyb_rt_opts structure
+ * @return HYB_SUCCESS to continue. Any other value stops the runner and it
+ *         is returned by hyb_rt_run
+ */
+typedef hyb_errorcode (*hyb_rt_io)(hyb_float *u, const hyb_float *x, const hyb_float *y, unsigned long long cycle, void *data);
+
+/**
+ * @brief Options of the real-time runner
+ *
+ * Zero fields take the default value.
+ */
+typedef struct hyb_rt_opts {
+  hyb_float period;          /**< Wall clock period in seconds (default hyb_opts::Ts, i.e. real time) */
+  unsigned long long cycles; /**< Number of periods (default until an horizon) */
+  int priority;              /**< SCHED_FIFO priority of the calling thread (default keeps the policy) */
+  hyb_bool lock;             /**< Locks the memory of the process (mlockall) during the run */
+  unsigned long long bin_ns; /**< Width of the histogram bins in nanoseconds (default period / 32) */
+  hyb_rt_io io;              /**< Exchange callback (optional) */
+  void *data;                /**< User data for the exchange callback */
+} hyb_rt_opts;
+
+/**
+ * @brief Latency histogram of a phase
+ *
+ * Bin b counts the samples in [b * bin_ns, (b + 1) * bin_ns), the last bin
+ * counts also all the longer samples.
+ */
+typedef struct hyb_rt_histogram {
+  unsigned long long count;             /**< Number of samples */
+  unsigned long long misses;            /**< Number of samples longer than the period */
+  unsigned long long worst_ns;          /**< Longest sample */
+  unsigned long long total_ns;          /**< Sum of the samples */
+  unsigned long long bins[HYB_RT_BINS]; /**< Histogram */
+} hyb_rt_histogram;
+
+/**
+ * @brief Results of the real-time runner
+ */
+typedef struct hyb_rt_stats {
+  unsigned long long cycles;                /**< Number of completed periods */
+  unsigned long long period_ns;             /**< Period in nanoseconds */
+  unsigned long long bin_ns;                /**< Width of the histogram bins */
+  hyb_rt_histogram phase[HYB_RT_PHASES];    /**< Histogram of each phase */
+} hyb_rt_stats;
+
+/**
+ * @brief Runs a model in real time
+ *
+ * Each period the runner sleeps until the absolute deadline of the period,
+ * advances the model of Ts in flow time (absorbing the jumps, as
+ * hyb_sample_step) timing each hyb_step, calls the exchange callback and
+ * schedules the next deadline one period later. A late period is counted as
+ * a deadline miss (HYB_RT_PERIOD misses) and the next deadline is not moved,
+ * thus the simulation catches up with the wall clock as soon as possible.
+ * @param opts pointer to an option structure
+ * @param ws workspace initialized for the model
+ * @param rt options of the runner
+ * @param x augmented state, initial on input and final on output
+ * @param u input vector, updated by the exchange callback (ignored if an
+ *        input signal is attached to ws)
+ * @param p parameter vector
+ * @param stats results of the run (reset at the beginning)
+ * @return HYB_SUCCESS when the cycles are completed or an horizon is reached,
+ *         HYB_GENERIC if the memory cannot be locked or the priority cannot be
+ *         set, or the error of the failing step or of the exchange callback
+ */
+hyb_errorcode hyb_rt_run(hyb_opts *opts, hyb_workspace *ws, const hyb_rt_opts *rt, hyb_float *x, hyb_float *u, const hyb_float **p, hyb_rt_stats *stats);
+
+/**
+ * @brief Returns an upper bound of a quantile of a phase
+ * @param stats results of the run
+ * @param phase the phase
+ * @param q the quantile, in [0, 1]
+ * @return the upper edge of the bin that contains the quantile in
+ *         nanoseconds (the worst case for the last bin)
+ */
+unsigned long long hyb_rt_quantile(const hyb_rt_stats *stats, hyb_rt_phase phase, double q);
+
+#endif /* LIBHYBRID_RT_H_ */
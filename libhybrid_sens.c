@@ -0,0 +1,424 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2018 - Matteo Ragni, Matteo Cocetti - University of Trento
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+/**
+ * @file libhybrid_sens.c
+ * @author Matteo Ragni, Matteo Cocetti
+ */
+
+#include "libhybrid_sens.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+
+/**
+ * @brief Maps whose Jacobians may be computed by finite differences
+ */
+typedef enum hyb_sens_map {
+  HYB_SENS_F, /**< Flow map */
+  HYB_SENS_J, /**< Jump map */
+  HYB_SENS_G, /**< Jump guard */
+  HYB_SENS_Y  /**< Output map */
+} hyb_sens_map;
+
+/**
+ * @brief Views on the internal storage of hyb_sens
+ */
+typedef struct hyb_sens_buf {
+  hyb_float *Ss;    /**< Stage sensitivity, n * m */
+  hyb_float *dK;    /**< Stage sensitivity derivatives, HYB_WS_STAGES * n * m */
+  hyb_float *S1;    /**< End of step sensitivity, n * m */
+  hyb_float *T;     /**< Temporary sensitivity, n * m */
+  hyb_float *A;     /**< Jacobian wrt state, max(n, ny) * n */
+  hyb_float *B;     /**< Jacobian wrt parameters, max(n, ny) * np */
+  hyb_float *gx;    /**< Guard gradient wrt state, n */
+  hyb_float *gp;    /**< Guard gradient wrt parameters, np */
+  hyb_float *fm;    /**< Flow before a jump, n */
+  hyb_float *fp;    /**< Flow after a jump, n */
+  hyb_float *xt;    /**< Augmented scratch state, n + 2 */
+  hyb_float *fa;    /**< Finite differences base value, max(n, ny) */
+  hyb_float *fb;    /**< Finite differences perturbed value, max(n, ny) */
+} hyb_sens_buf;
+
+/**
+ * @brief Builds the views on the internal storage
+ */
+static hyb_sens_buf hyb_sens_views(const hyb_sens *s) {
+  const size_t n = s->x_size, m = s->cols, np = s->p_size;
+  const size_t r = n > s->y_size ? n : s->y_size;
+  hyb_sens_buf b;
+  b.Ss = s->buffer;
+  b.dK = b.Ss + n * m;
+  b.S1 = b.dK + HYB_WS_STAGES * n * m;
+  b.T = b.S1 + n * m;
+  b.A = b.T + n * m;
+  b.B = b.A + r * n;
+  b.gx = b.B + r * np;
+  b.gp = b.gx + n;
+  b.fm = b.gp + np;
+  b.fp = b.fm + n;
+  b.xt = b.fp + n;
+  b.fa = b.xt + n + 2;
+  b.fb = b.fa + r;
+  return b;
+}
+
+hyb_errorcode hyb_sens_init(hyb_sens *s, const hyb_opts *opts, const hyb_sens_opts *sopts) {
+  if (!s || !opts || !sopts)
+    return HYB_NULLPTR;
+  memset(s, 0, sizeof(hyb_sens));
+
+  const size_t n = opts->x_size, np = sopts->p_size, m = n + np;
+  const size_t r = n > opts->y_size ? n : opts->y_size;
+  const size_t size = (4 + HYB_WS_STAGES) * n * m + r * (n + np) + 4 * n + np + 2 + 2 * r;
+  s->S = (hyb_float *)calloc(n * m, sizeof(hyb_float));
+  s->buffer = (hyb_float *)calloc(size, sizeof(hyb_float));
+  if (!s->S || !s->buffer) {
+    hyb_sens_free(s);
+    return HYB_EMALLOC;
+  }
+  s->x_size = n;
+  s->y_size = opts->y_size;
+  s->p_size = np;
+  s->cols = m;
+  return HYB_SUCCESS;
+}
+
+void hyb_sens_free(hyb_sens *s) {
+  if (!s)
+    return;
+  free(s->S);
+  free(s->buffer);
+  s->S = NULL;
+  s->buffer = NULL;
+}
+
+/**
+ * @brief Input of the callbacks at a sample of the trajectory (see hyb_input_value)
+ */
+static inline const hyb_float *hyb_sens_u(hyb_workspace *ws, const hyb_float *u, hyb_float t) {
+  return ws->input ? hyb_input_value(ws, t) : u;
+}
+
+/**
+ * @brief Evaluates one of the maps in the augmented state x
+ */
+static void hyb_sens_eval(hyb_sens_map map, hyb_opts *opts, hyb_float *out, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  switch (map) {
+  case HYB_SENS_F:
+    opts->F(out, x[0], x[1], x + 2, u, p);
+    break;
+  case HYB_SENS_J:
+    opts->J(out, x[0], x[1], x + 2, u, p);
+    break;
+  case HYB_SENS_G:
+    out[0] = opts->G(x[0], x[1], x + 2, u, p);
+    break;
+  case HYB_SENS_Y:
+    opts->Y(out, x[0], x[1], x + 2, u, p);
+    break;
+  }
+}
+
+/**
+ * @brief Jacobian wrt the state of one of the maps, in the augmented state x
+ *
+ * Uses the user callback if available, forward finite differences otherwise.
+ */
+static void hyb_sens_jac_x(hyb_sens_map map, hyb_jacobian jac, hyb_opts *opts, hyb_sens_buf *b, hyb_float *A, size_t rows, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  const size_t n = opts->x_size;
+  if (jac) {
+    jac(A, x[0], x[1], x + 2, u, p);
+    return;
+  }
+  const hyb_float eps = sqrt(HYB_EPSILON);
+  memcpy(b->xt, x, (n + 2) * sizeof(hyb_float));
+  hyb_sens_eval(map, opts, b->fa, x, u, p);
+  for (size_t c = 0; c < n; c++) {
+    b->xt[c + 2] = x[c + 2] + eps * (fabs(x[c + 2]) > 1.0 ? fabs(x[c + 2]) : 1.0);
+    const hyb_float d = b->xt[c + 2] - x[c + 2];
+    hyb_sens_eval(map, opts, b->fb, b->xt, u, p);
+    b->xt[c + 2] = x[c + 2];
+    for (size_t r = 0; r < rows; r++)
+      A[r + c * rows] = (b->fb[r] - b->fa[r]) / d;
+  }
+}
+
+/**
+ * @brief Jacobian wrt the parameters of one of the maps (zero if not provided)
+ */
+static void hyb_sens_jac_p(hyb_jacobian jac, hyb_float *B, size_t rows, size_t np, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  if (jac)
+    jac(B, x[0], x[1], x + 2, u, p);
+  else
+    memset(B, 0, rows * np * sizeof(hyb_float));
+}
+
+/**
+ * @brief Computes D = A S + [0 B], with A rows * n and S n * m
+ */
+static void hyb_sens_linear(hyb_float *D, const hyb_float *A, const hyb_float *B, const hyb_float *S, size_t rows, size_t n, size_t m) {
+  for (size_t c = 0; c < m; c++) {
+    hyb_float *dc = D + c * rows;
+    const hyb_float *sc = S + c * n;
+    if (c < n)
+      memset(dc, 0, rows * sizeof(hyb_float));
+    else
+      memcpy(dc, B + (c - n) * rows, rows * sizeof(hyb_float));
+    for (size_t k = 0; k < n; k++) {
+      const hyb_float skc = sc[k];
+      const hyb_float *ak = A + k * rows;
+      for (size_t r = 0; r < rows; r++)
+        dc[r] += ak[r] * skc;
+    }
+  }
+}
+
+/**
+ * @brief Derivative of the sensitivity in the augmented state x: D = Fx S + [0 Fp]
+ */
+static void hyb_sens_flow(hyb_opts *opts, const hyb_sens_opts *sopts, const hyb_sens *s, hyb_sens_buf *b, hyb_float *D, const hyb_float *S, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  hyb_sens_jac_x(HYB_SENS_F, opts->Fx, opts, b, b->A, s->x_size, x, u, p);
+  hyb_sens_jac_p(sopts->Fp, b->B, s->x_size, s->p_size, x, u, p);
+  hyb_sens_linear(D, b->A, b->B, S, s->x_size, s->x_size, s->cols);
+}
+
+/** @brief Runge Kutta 4 matrix, row-major lower triangular */
+static const hyb_float hyb_sens_rk4_a[HYB_WS_STAGES][HYB_WS_STAGES] = {
+  { 0 }, { 0.5 }, { 0.0, 0.5 }, { 0.0, 0.0, 1.0 }
+};
+/** @brief Runge Kutta 4 weights */
+static const hyb_float hyb_sens_rk4_b[HYB_WS_STAGES] = { 1.0 / 6.0, 1.0 / 3.0, 1.0 / 3.0, 1.0 / 6.0 };
+/** @brief Dormand-Prince 5(4) matrix, row-major lower triangular */
+static const hyb_float hyb_sens_dopri5_a[HYB_WS_STAGES][HYB_WS_STAGES] = {
+  { 0 },
+  { 1.0 / 5.0 },
+  { 3.0 / 40.0, 9.0 / 40.0 },
+  { 44.0 / 45.0, -56.0 / 15.0, 32.0 / 9.0 },
+  { 19372.0 / 6561.0, -25360.0 / 2187.0, 64448.0 / 6561.0, -212.0 / 729.0 },
+  { 9017.0 / 3168.0, -355.0 / 33.0, 46732.0 / 5247.0, 49.0 / 176.0, -5103.0 / 18656.0 }
+};
+/** @brief Dormand-Prince 5(4) weights (fifth order solution) */
+static const hyb_float hyb_sens_dopri5_b[HYB_WS_STAGES] = {
+  35.0 / 384.0, 0.0, 500.0 / 1113.0, 125.0 / 192.0, -2187.0 / 6784.0, 11.0 / 84.0
+};
+
+/**
+ * @brief Propagates the sensitivity through the last flow step from x to xp
+ *
+ * The stage states are rebuilt from the stages left in the workspace, and the
+ * variational equations are integrated with the same tableau. If the step
+ * was truncated at an event, the sensitivity of the Hermite interpolant at
+ * the kept fraction of the step is used.
+ */
+static void hyb_sens_flow_step(hyb_opts *opts, const hyb_sens_opts *sopts, hyb_workspace *ws, hyb_sens *s, hyb_sens_buf *b, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  const size_t n = s->x_size, m = s->cols, nm = n * m, na = n + 2;
+  const hyb_bool dopri = opts->integrator == HYB_DOPRI5 ? hyb_true : hyb_false;
+  const hyb_float (*a)[HYB_WS_STAGES] = dopri ? hyb_sens_dopri5_a : hyb_sens_rk4_a;
+  const hyb_float *w = dopri ? hyb_sens_dopri5_b : hyb_sens_rk4_b;
+  const size_t stages = dopri ? 6 : 4;
+  const hyb_float h = ws->hs;
+
+  for (size_t i = 0; i < stages; i++) {
+    hyb_float *xs = ws->xs;
+    memcpy(xs, x, na * sizeof(hyb_float));
+    memcpy(b->Ss, s->S, nm * sizeof(hyb_float));
+    for (size_t j = 0; j < i; j++) {
+      const hyb_float c = h * a[i][j];
+      if (c == 0.0)
+        continue;
+      for (size_t r = 0; r < na; r++)
+        xs[r] += c * ws->k[j][r];
+      for (size_t r = 0; r < nm; r++)
+        b->Ss[r] += c * b->dK[j * nm + r];
+    }
+    hyb_sens_flow(opts, sopts, s, b, b->dK + i * nm, b->Ss, xs, hyb_input_flow(ws, u, xs[0]), p);
+  }
+
+  memcpy(b->S1, s->S, nm * sizeof(hyb_float));
+  for (size_t i = 0; i < stages; i++) {
+    const hyb_float c = h * w[i];
+    for (size_t r = 0; r < nm; r++)
+      b->S1[r] += c * b->dK[i * nm + r];
+  }
+
+  if (!ws->event) {
+    memcpy(s->S, b->S1, nm * sizeof(hyb_float));
+    return;
+  }
+
+  /* Hermite interpolant: the first stage is the derivative at the start */
+  const hyb_float th = ws->theta, t2 = th * th, t3 = t2 * th;
+  const hyb_float h00 = 2.0 * t3 - 3.0 * t2 + 1.0;
+  const hyb_float h10 = (t3 - 2.0 * t2 + th) * h;
+  const hyb_float h01 = 3.0 * t2 - 2.0 * t3;
+  const hyb_float h11 = (t3 - t2) * h;
+  hyb_sens_flow(opts, sopts, s, b, b->T, b->S1, ws->ev, hyb_input_flow(ws, u, ws->ev[0]), p);
+  for (size_t r = 0; r < nm; r++)
+    s->S[r] = h00 * s->S[r] + h10 * b->dK[r] + h01 * b->S1[r] + h11 * b->T[r];
+}
+
+/**
+ * @brief Propagates the sensitivity through a jump from x to xp
+ *
+ * The saltation correction applies only to a jump that follows a flow step
+ * truncated at a guard crossing (event): in any other case (initial state
+ * in the jump set, chained jumps) the jump time does not move with the
+ * state, and g(x) is not zero.
+ */
+static void hyb_sens_jump_step(hyb_opts *opts, const hyb_sens_opts *sopts, hyb_sens *s, hyb_sens_buf *b, hyb_bool event, const hyb_float *x, const hyb_float *xp, const hyb_float *u, const hyb_float **p) {
+  const size_t n = s->x_size, m = s->cols, np = s->p_size;
+
+  hyb_sens_jac_x(HYB_SENS_J, sopts->Jx, opts, b, b->A, n, x, u, p);
+  hyb_sens_jac_p(sopts->Jp, b->B, n, np, x, u, p);
+  hyb_sens_linear(b->T, b->A, b->B, s->S, n, n, m);
+
+  if (opts->G && event) {
+    /* Saltation: correction for the motion of the jump time */
+    opts->F(b->fm, x[0], x[1], x + 2, u, p);
+    opts->F(b->fp, xp[0], xp[1], xp + 2, u, p);
+    hyb_sens_jac_x(HYB_SENS_G, sopts->Gx, opts, b, b->gx, 1, x, u, p);
+    hyb_sens_jac_p(sopts->Gp, b->gp, 1, np, x, u, p);
+
+    hyb_float den = 0.0;
+    for (size_t k = 0; k < n; k++)
+      den += b->gx[k] * b->fm[k];
+    if (fabs(den) > HYB_EPSILON) {
+      /* fp <- fp - Jx fm */
+      for (size_t k = 0; k < n; k++) {
+        const hyb_float fk = b->fm[k];
+        for (size_t r = 0; r < n; r++)
+          b->fp[r] -= b->A[r + k * n] * fk;
+      }
+      for (size_t c = 0; c < m; c++) {
+        hyb_float wc = c < n ? 0.0 : b->gp[c - n];
+        for (size_t k = 0; k < n; k++)
+          wc += b->gx[k] * s->S[k + c * n];
+        wc /= den;
+        for (size_t r = 0; r < n; r++)
+          b->T[r + c * n] += b->fp[r] * wc;
+      }
+    }
+  }
+  memcpy(s->S, b->T, n * m * sizeof(hyb_float));
+}
+
+hyb_errorcode hyb_simulate_sens(hyb_opts *opts, const hyb_sens_opts *sopts, hyb_workspace *ws, hyb_sens *s, hyb_trajectory *traj, const hyb_float *x0, const hyb_float *u, size_t u_stride, const hyb_float **p) {
+  if (!opts || !sopts || !s || !s->S || !traj || !x0)
+    return HYB_NULLPTR;
+  if (opts->integrator == HYB_ROS2)
+    return HYB_GENERIC;
+
+  const size_t nx = opts->x_size + 2;
+  const size_t ny = opts->y_size;
+  const size_t n = s->x_size, m = s->cols;
+  const hyb_bool bounded = (traj->x || traj->y || s->dy) ? hyb_true : hyb_false;
+  hyb_sens_buf b = hyb_sens_views(s);
+
+  traj->samples = 0;
+  traj->jumps = 0;
+  if (bounded && traj->length == 0)
+    return HYB_BUFFER;
+
+  hyb_workspace own_ws;
+  if (!ws) {
+    hyb_errorcode ret = hyb_workspace_init(&own_ws, opts);
+    if (ret)
+      return ret;
+    ws = &own_ws;
+  }
+
+  hyb_float *x = traj->x ? traj->x : ws->xa;
+  hyb_float *xp = traj->x ? traj->x + nx : ws->xb;
+  hyb_float *y = traj->y ? traj->y : ws->y;
+  hyb_float *dy = s->dy;
+  memcpy(x, x0, nx * sizeof(hyb_float));
+  memset(s->S, 0, n * m * sizeof(hyb_float));
+  for (size_t i = 0; i < n; i++)
+    s->S[i + i * n] = 1.0;
+
+  hyb_errorcode ret = HYB_SUCCESS;
+  hyb_bool jumped = hyb_false, event = hyb_false;
+  size_t k = 0;
+  for (;;) {
+    const hyb_float *uk = hyb_sens_u(ws, u, x[0]);
+    opts->Y(y, x[0], x[1], x + 2, uk, p);
+    if (dy) {
+      hyb_sens_jac_x(HYB_SENS_Y, sopts->Yx, opts, &b, b.A, ny, x, uk, p);
+      hyb_sens_jac_p(sopts->Yp, b.B, ny, s->p_size, x, uk, p);
+      hyb_sens_linear(dy, b.A, b.B, s->S, ny, n, m);
+    }
+    traj->samples = k + 1;
+    if (traj->sink) {
+      ret = traj->sink(x, y, jumped, traj->data);
+      if (ret)
+        break;
+    }
+
+    if (x[0] >= opts->T_horizon || x[1] >= opts->J_horizon)
+      break;
+    if (bounded && k + 1 >= traj->length) {
+      ret = HYB_BUFFER;
+      break;
+    }
+
+    jumped = hyb_it_jumps(opts, x, uk, p);
+    ret = hyb_advance(opts, ws, jumped, xp, x, u, p);
+    if (ret)
+      break;
+    if (jumped) {
+      hyb_sens_jump_step(opts, sopts, s, &b, event, x, xp, hyb_sens_u(ws, u, x[0]), p);
+      event = hyb_false;
+    } else {
+      hyb_sens_flow_step(opts, sopts, ws, s, &b, x, u, p);
+      event = ws->event;
+    }
+
+    k++;
+    if (jumped) {
+      if (traj->jump_idx && traj->jumps < traj->jumps_length)
+        traj->jump_idx[traj->jumps] = k;
+      traj->jumps++;
+    } else {
+      u += u_stride;
+    }
+
+    if (traj->x) {
+      x = xp;
+      xp += nx;
+    } else {
+      hyb_float *swap = x;
+      x = xp;
+      xp = swap;
+    }
+    if (traj->y)
+      y += ny;
+    if (dy)
+      dy += ny * m;
+  }
+
+  if (ws == &own_ws)
+    hyb_workspace_free(&own_ws);
+  return ret;
+}
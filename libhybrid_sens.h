@@ -0,0 +1,122 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2018 - Matteo Ragni, Matteo Cocetti - University of Trento
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#ifndef LIBHYBRID_SENS_H_
+#define LIBHYBRID_SENS_H_
+
+/**
+ * @file libhybrid_sens.h
+ * @author Matteo Ragni, Matteo Cocetti
+ *
+ * Forward sensitivity analysis of the hybrid system. Together with the state,
+ * the library propagates the sensitivity matrix
+ * \f[
+ *   S = \left[ \frac{\partial x}{\partial x_0} \; \frac{\partial x}{\partial p} \right]
+ * \f]
+ * During flow steps the variational equations are integrated with the same
+ * stages of the state integrator, thus S is the exact derivative of the
+ * discrete trajectory. Across a jump the sensitivity is mapped through the
+ * Jacobians of the jump map and, when the jump follows a flow step truncated
+ * at a guard crossing (event location), corrected with the saltation matrix:
+ * \f[
+ *   S^+ = J_x S^- + J_p + (f^+ - J_x f^-) \frac{g_x S^- + g_p}{g_x f^-}
+ * \f]
+ * that accounts for the motion of the jump time. The guard is assumed not to
+ * depend explicitly on the flow time.
+ * Jacobians with respect to the state that are not provided are computed by
+ * finite differences, Jacobians with respect to the parameters that are not
+ * provided are considered zero.
+ */
+
+#include "libhybrid.h"
+
+/**
+ * @brief Options for the sensitivity analysis
+ *
+ * The Jacobian of the flow map with respect to the state is hyb_opts::Fx.
+ */
+typedef struct hyb_sens_opts {
+  size_t p_size;   /**< Number of scalar parameters */
+  hyb_jacobian Fp; /**< Flow map Jacobian wrt parameters (x_size * p_size) */
+  hyb_jacobian Jx; /**< Jump map Jacobian wrt state (x_size * x_size) */
+  hyb_jacobian Jp; /**< Jump map Jacobian wrt parameters (x_size * p_size) */
+  hyb_jacobian Gx; /**< Guard gradient wrt state (1 * x_size) */
+  hyb_jacobian Gp; /**< Guard gradient wrt parameters (1 * p_size) */
+  hyb_jacobian Yx; /**< Output map Jacobian wrt state (y_size * x_size) */
+  hyb_jacobian Yp; /**< Output map Jacobian wrt parameters (y_size * p_size) */
+} hyb_sens_opts;
+
+/**
+ * @brief Sensitivity state and storage
+ *
+ * Must be initialized with hyb_sens_init and released with hyb_sens_free.
+ * The sensitivity S has x_size rows and cols = x_size + p_size columns, is
+ * stored column-major and refers to the state only (not to flow and jump time).
+ */
+typedef struct hyb_sens {
+  size_t x_size;   /**< State size */
+  size_t y_size;   /**< Output size */
+  size_t p_size;   /**< Number of scalar parameters */
+  size_t cols;     /**< Columns of the sensitivity (x_size + p_size) */
+  hyb_float *S;    /**< Current sensitivity, x_size * cols */
+  hyb_float *dy;   /**< Output sensitivity of each sample, y_size * cols per sample. User buffer, may be NULL */
+  hyb_float *buffer; /**< Internal storage. For internal use only */
+} hyb_sens;
+
+/**
+ * @brief Allocates the storage for the sensitivity analysis
+ * @param s the sensitivity structure to initialize
+ * @param opts pointer to the option structure of the model
+ * @param sopts pointer to the sensitivity options
+ * @return HYB_SUCCESS, HYB_NULLPTR or HYB_EMALLOC
+ */
+hyb_errorcode hyb_sens_init(hyb_sens *s, const hyb_opts *opts, const hyb_sens_opts *sopts);
+
+/**
+ * @brief Releases the storage of the sensitivity analysis
+ * @param s the sensitivity structure to release
+ */
+void hyb_sens_free(hyb_sens *s);
+
+/**
+ * @brief Whole horizon simulation with forward sensitivities
+ *
+ * Same as hyb_simulate, but propagates the sensitivity along the trajectory,
+ * starting from S = [I 0]. On exit s->S holds the sensitivity of the last
+ * sample. If s->dy is not NULL the sensitivity of the output of each sample
+ * is stored in it (it must be as long as the trajectory).
+ * @param opts pointer to an option structure
+ * @param sopts pointer to the sensitivity options
+ * @param ws workspace initialized for the model (NULL for a temporary one)
+ * @param s sensitivity structure
+ * @param traj trajectory descriptor, with buffers already allocated
+ * @param x0 initial augmented state (flow time, jump time, state)
+ * @param u input vector (or matrix of input samples, one per column)
+ * @param u_stride distance between two consecutive input samples
+ * @param p parameter vector
+ * @return the same codes of hyb_simulate, or HYB_GENERIC for the integrator
+ *         HYB_ROS2, whose variational step is not implemented
+ */
+hyb_errorcode hyb_simulate_sens(hyb_opts *opts, const hyb_sens_opts *sopts, hyb_workspace *ws, hyb_sens *s, hyb_trajectory *traj, const hyb_float *x0, const hyb_float *u, size_t u_stride, const hyb_float **p);
+
+#endif /* LIBHYBRID_SENS_H_ */
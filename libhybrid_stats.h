@@ -0,0 +1,85 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2018 - Matteo Ragni, Matteo Cocetti - University of Trento
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#ifndef LIBHYBRID_STATS_H_
+#define LIBHYBRID_STATS_H_
+
+/**
+ * @file libhybrid_stats.h
+ * @author Matteo Ragni, Matteo Cocetti
+ *
+ * Accounting of the runtime statistics (see hyb_stats), shared by the
+ * compilation units that evaluate the callbacks of a model. For internal use
+ * only: it is not part of the interface of the library.
+ */
+
+#include "libhybrid.h"
+
+#ifdef HYB_STATS
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define hyb_ticks() ((unsigned long long)__rdtsc()) /**< Time stamp counter */
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define hyb_ticks() ((unsigned long long)__rdtsc()) /**< Time stamp counter */
+#elif defined(__aarch64__)
+/**
+ * @brief Virtual counter of the ARM64 generic timer
+ */
+static inline unsigned long long hyb_ticks(void) {
+  unsigned long long c;
+  __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(c));
+  return c;
+}
+#else
+#include <time.h>
+/**
+ * @brief Processor time in nanoseconds, when no cycle counter is available
+ */
+static inline unsigned long long hyb_ticks(void) {
+  return (unsigned long long)((double)clock() * (1e9 / CLOCKS_PER_SEC));
+}
+#endif
+
+/**
+ * @brief Increments a counter of the statistics of a workspace (if any)
+ */
+#define HYB_COUNT(ws, field) do { if (ws) (ws)->stats.field++; } while (0)
+
+/**
+ * @brief Executes a callback, accounting call and time in the workspace (if any)
+ */
+#define HYB_TIMED(ws, cb, call) do { \
+    const unsigned long long t0_ = hyb_ticks(); \
+    call; \
+    if (ws) { \
+      (ws)->stats.calls[cb]++; \
+      (ws)->stats.ticks[cb] += hyb_ticks() - t0_; \
+    } \
+  } while (0)
+#else
+#define HYB_COUNT(ws, field) do { } while (0) /**< Statistics are not compiled */
+#define HYB_TIMED(ws, cb, call) call          /**< Statistics are not compiled */
+#endif
+
+#endif /* LIBHYBRID_STATS_H_ */
@@ -0,0 +1,1085 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2018 - Matteo Ragni, Matteo Cocetti - University of Trento
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+
+/**
+ * @file libhybrid_test.c
+ * @author Matteo Ragni, Matteo Cocetti
+ *
+ * Standalone regression tests of the library (MATLAB is not required). Each
+ * test builds a small model for which the expected result is known in closed
+ * form. Compile and run with:
+ * @code
+ * cc -O2 -std=c99 libhybrid_test.c libhybrid.c libhybrid_sens.c libhybrid_pipe.c libhybrid_ensemble.c libhybrid_automaton.c libhybrid_estim.c libhybrid_parallel.c libhybrid_rt.c libhybrid_accum.c libhybrid_parareal.c -lm -lpthread -o libhybrid_test
+ * ./libhybrid_test
+ * @endcode
+ * The program prints one line per test and exits with a non zero status if
+ * any of them fails. New tests are added to the test_cases table.
+ */
+
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200809L /**< POSIX threads and clocks of the pipeline and real-time tests */
+#endif
+
+#include "libhybrid.h"
+#include "libhybrid_sens.h"
+#include "libhybrid_pipe.h"
+#include "libhybrid_ensemble.h"
+#include "libhybrid_automaton.h"
+#include "libhybrid_estim.h"
+#include "libhybrid_rt.h"
+#include "libhybrid_accum.h"
+#include "libhybrid_parareal.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <stdatomic.h>
+
+/**
+ * @brief Fails the current test if the condition does not hold
+ */
+#define TEST_CHECK(cond) do { \
+    if (!(cond)) { \
+      printf("  %s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+      return 1; \
+    } \
+  } while (0)
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Decay with a reset: x' = -x in C, x+ = x + 1 in D = { x <= 0 }, guard x
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+static void decay_F(hyb_float *xdot, hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  (void) t; (void) j; (void) u; (void) p;
+  xdot[0] = -x[0];
+}
+
+static void decay_J(hyb_float *xp, hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  (void) t; (void) j; (void) u; (void) p;
+  xp[0] = x[0] + 1.0;
+}
+
+static void decay_Y(hyb_float *y, hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  (void) t; (void) j; (void) u; (void) p;
+  y[0] = x[0];
+}
+
+static hyb_bool decay_D(hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  (void) t; (void) j; (void) u; (void) p;
+  return x[0] <= 0.0 ? hyb_true : hyb_false;
+}
+
+static hyb_bool decay_C(hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  (void) t; (void) j; (void) u; (void) p;
+  return x[0] > 0.0 ? hyb_true : hyb_false;
+}
+
+static hyb_float decay_G(hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  (void) t; (void) j; (void) u; (void) p;
+  return x[0];
+}
+
+/**
+ * @brief Sink that keeps the flow time of the last sample
+ */
+static hyb_errorcode test_last_time(const hyb_float *x, const hyb_float *y, hyb_bool jumped, void *data) {
+  (void) y; (void) jumped;
+  *(hyb_float *) data = x[0];
+  return HYB_SUCCESS;
+}
+
+/**
+ * @brief Sink that keeps the augmented state of the last sample (one state)
+ */
+static hyb_errorcode test_last_state(const hyb_float *x, const hyb_float *y, hyb_bool jumped, void *data) {
+  (void) y; (void) jumped;
+  memcpy(data, x, 3 * sizeof(hyb_float));
+  return HYB_SUCCESS;
+}
+
+/**
+ * @brief Sensitivity across a jump that does not come from a guard crossing
+ *
+ * The initial state lies in the jump set, thus the first step is a jump at
+ * a fixed time, and the saltation correction does not apply even if the
+ * guard is given: S(t) = exp(-t) with and without guard.
+ */
+static int test_sens_jump_without_event(void) {
+  hyb_opts opts = { .y_size = 1, .x_size = 1, .Ts = 1e-2, .T_horizon = 1.0, .J_horizon = 10.0,
+                    .F = decay_F, .J = decay_J, .Y = decay_Y, .D = decay_D, .C = decay_C, .G = decay_G };
+  hyb_sens_opts sopts;
+  hyb_sens s;
+  const hyb_float x0[3] = { 0.0, 0.0, -0.5 };
+
+  memset(&sopts, 0, sizeof(sopts));
+  TEST_CHECK(hyb_sens_init(&s, &opts, &sopts) == HYB_SUCCESS);
+  for (int guard = 0; guard < 2; guard++) {
+    hyb_float t = 0.0;
+    hyb_trajectory traj;
+    memset(&traj, 0, sizeof(traj));
+    traj.sink = test_last_time;
+    traj.data = &t;
+    opts.G = guard ? decay_G : NULL;
+    TEST_CHECK(hyb_simulate_sens(&opts, &sopts, NULL, &s, &traj, x0, NULL, 0, NULL) == HYB_SUCCESS);
+    TEST_CHECK(traj.jumps == 1);
+    TEST_CHECK(fabs(s.S[0] - exp(-t)) < 1e-6);
+  }
+  hyb_sens_free(&s);
+  return 0;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Pipeline
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#define TEST_PIPE_CAPACITY 64 /**< Records of the ring */
+#define TEST_PIPE_PUSHES 2000 /**< Published samples */
+
+/**
+ * @brief Consumer that stalls until released, then records the flow times
+ */
+typedef struct test_pipe_log {
+  atomic_int released;               /**< Set by the producer after the last push */
+  size_t n;                          /**< Received records */
+  hyb_float t[TEST_PIPE_CAPACITY];   /**< Flow time of the received records */
+} test_pipe_log;
+
+static hyb_errorcode test_pipe_drain(const hyb_float *records, size_t n, size_t record_size, void *data) {
+  test_pipe_log *log = (test_pipe_log *) data;
+  while (!atomic_load(&log->released));
+  for (size_t i = 0; i < n && log->n < TEST_PIPE_CAPACITY; i++)
+    log->t[log->n++] = records[i * record_size];
+  return HYB_SUCCESS;
+}
+
+/**
+ * @brief Decimation of a stalled consumer
+ *
+ * The consumer does not free any record until all the samples are pushed.
+ * The first half of the ring is filled with consecutive samples, the second
+ * half with one sample out of decimate, then the samples are dropped.
+ */
+static int test_pipe_decimate(void) {
+  hyb_opts opts = { .y_size = 1, .x_size = 1, .Ts = 1e-2, .T_horizon = 1.0, .J_horizon = 10.0,
+                    .F = decay_F, .J = decay_J, .Y = decay_Y, .D = decay_D, .C = decay_C };
+  hyb_pipe_opts popts = { .capacity = TEST_PIPE_CAPACITY, .mode = HYB_PIPE_DECIMATE, .decimate = 4 };
+  hyb_pipe_stats stats;
+  hyb_pipe pipe;
+  static test_pipe_log log;
+  hyb_pipe_consumer c = { test_pipe_drain, &log };
+  hyb_float x[3] = { 0.0, 0.0, 1.0 };
+
+  atomic_init(&log.released, 0);
+  log.n = 0;
+  TEST_CHECK(hyb_pipe_open(&pipe, &opts, &popts, &c, 1) == HYB_SUCCESS);
+  for (size_t k = 0; k < TEST_PIPE_PUSHES; k++) {
+    x[0] = (hyb_float) k;
+    TEST_CHECK(hyb_pipe_push(&pipe, x, NULL, hyb_false) == HYB_SUCCESS);
+  }
+  atomic_store(&log.released, 1);
+  TEST_CHECK(hyb_pipe_close(&pipe, &stats) == HYB_SUCCESS);
+
+  TEST_CHECK(stats.published == TEST_PIPE_CAPACITY);
+  TEST_CHECK(stats.dropped == TEST_PIPE_PUSHES - TEST_PIPE_CAPACITY);
+  TEST_CHECK(log.n == TEST_PIPE_CAPACITY);
+  for (size_t i = 0; i < TEST_PIPE_CAPACITY / 2; i++) {
+    TEST_CHECK(log.t[i] == (hyb_float) i);
+    TEST_CHECK(log.t[TEST_PIPE_CAPACITY / 2 + i] == (hyb_float) (TEST_PIPE_CAPACITY / 2 + 4 * i));
+  }
+  return 0;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Ensemble
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#define TEST_WIDE_Y 8 /**< Outputs of the wide model, more than x_size + 2 */
+
+static void wide_Y(hyb_float *y, hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  (void) t; (void) j; (void) u; (void) p;
+  for (size_t i = 0; i < TEST_WIDE_Y; i++)
+    y[i] = (hyb_float) (i + 1) * x[0];
+}
+
+/**
+ * @brief Ensemble output of a model whose output is wider than its state
+ */
+static int test_ensemble_wide_output(void) {
+  hyb_opts opts = { .y_size = TEST_WIDE_Y, .x_size = 1, .Ts = 1e-2, .T_horizon = 1.0, .J_horizon = 10.0,
+                    .F = decay_F, .J = decay_J, .Y = wide_Y, .D = decay_D, .C = decay_C };
+  const hyb_float *p0[1] = { NULL };
+  const hyb_float **p[3] = { p0, p0, p0 };
+  hyb_float y[TEST_WIDE_Y * 3];
+  hyb_ensemble e;
+
+  TEST_CHECK(hyb_ensemble_init(&e, &opts, 3, p) == HYB_SUCCESS);
+  for (size_t l = 0; l < 3; l++) {
+    const hyb_float x[3] = { 0.0, 0.0, (hyb_float) (l + 1) };
+    hyb_ensemble_set_state(&e, l, x);
+  }
+  hyb_ensemble_output(&opts, &e, y, NULL);
+  hyb_ensemble_free(&e);
+  for (size_t i = 0; i < TEST_WIDE_Y; i++) {
+    for (size_t l = 0; l < 3; l++)
+      TEST_CHECK(y[i * 3 + l] == (hyb_float) ((i + 1) * (l + 1)));
+  }
+  return 0;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Bouncing ball: h' = v, v' = -g in C, v+ = -e v in D = { h <= 0, v < 0 }
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#define TEST_BALL_G 9.81  /**< Gravity */
+#define TEST_BALL_E 0.8   /**< Restitution coefficient */
+#define TEST_BALL_JUMPS 5 /**< Checked impacts */
+
+static void ball_F(hyb_float *xdot, hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  (void) t; (void) j; (void) u; (void) p;
+  xdot[0] = x[1];
+  xdot[1] = -TEST_BALL_G;
+}
+
+static void ball_J(hyb_float *xp, hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  (void) t; (void) j; (void) u; (void) p;
+  xp[0] = x[0];
+  xp[1] = -TEST_BALL_E * x[1];
+}
+
+static void ball_Y(hyb_float *y, hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  (void) t; (void) j; (void) u; (void) p;
+  y[0] = x[0];
+}
+
+static hyb_bool ball_D(hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  (void) t; (void) j; (void) u; (void) p;
+  return (x[0] <= 0.0 && x[1] < 0.0) ? hyb_true : hyb_false;
+}
+
+static hyb_bool ball_C(hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  return ball_D(t, j, x, u, p) ? hyb_false : hyb_true;
+}
+
+static hyb_float ball_G(hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  (void) t; (void) j; (void) u; (void) p;
+  return x[0];
+}
+
+/**
+ * @brief Impact times of the ball dropped from rest at height 1
+ *
+ * The first impact is at sqrt(2 / g) with speed v = sqrt(2 g), each flight
+ * after the impact k lasts 2 e^k v / g.
+ */
+static void ball_impacts(hyb_float *t) {
+  const hyb_float v = sqrt(2.0 * TEST_BALL_G);
+  t[0] = sqrt(2.0 / TEST_BALL_G);
+  for (size_t k = 1; k < TEST_BALL_JUMPS; k++)
+    t[k] = t[k - 1] + 2.0 * pow(TEST_BALL_E, (hyb_float) k) * v / TEST_BALL_G;
+}
+
+/**
+ * @brief Jump times of the bouncing ball against the closed form
+ *
+ * RK4 and the Hermite interpolant are exact on the parabolic flights, thus
+ * the located impacts match the closed form up to the event tolerance, while
+ * the impacts detected at the end of the steps are late.
+ */
+static int test_event_bouncing_ball(void) {
+  hyb_opts opts = { .y_size = 1, .x_size = 2, .Ts = 1e-2, .T_horizon = 10.0, .J_horizon = TEST_BALL_JUMPS,
+                    .F = ball_F, .J = ball_J, .Y = ball_Y, .D = ball_D, .C = ball_C, .G = ball_G };
+  static hyb_float x[1024 * 4];
+  size_t jump_idx[TEST_BALL_JUMPS];
+  hyb_float impacts[TEST_BALL_JUMPS];
+  const hyb_float x0[4] = { 0.0, 0.0, 1.0, 0.0 };
+  hyb_trajectory traj;
+
+  ball_impacts(impacts);
+  for (int located = 1; located >= 0; located--) {
+    hyb_float err = 0.0;
+    memset(&traj, 0, sizeof(traj));
+    traj.length = 1024;
+    traj.x = x;
+    traj.jumps_length = TEST_BALL_JUMPS;
+    traj.jump_idx = jump_idx;
+    opts.G = located ? ball_G : NULL;
+    TEST_CHECK(hyb_simulate(&opts, NULL, &traj, x0, NULL, 0, NULL) == HYB_SUCCESS);
+    TEST_CHECK(traj.jumps == TEST_BALL_JUMPS);
+    for (size_t k = 0; k < TEST_BALL_JUMPS; k++) {
+      const hyb_float *xk = x + jump_idx[k] * 4;
+      TEST_CHECK(xk[1] == (hyb_float) (k + 1));
+      if (fabs(xk[0] - impacts[k]) > err)
+        err = fabs(xk[0] - impacts[k]);
+      if (located)
+        TEST_CHECK(fabs(xk[2]) < 1e-9);
+    }
+    if (located)
+      TEST_CHECK(err < 1e-9);
+    else
+      TEST_CHECK(err > 1e-4);
+  }
+  return 0;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Integrators against the analytic decay x(t) = x0 exp(-t)
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/**
+ * @brief Largest relative error of the samples against exp(-t)
+ */
+typedef struct test_decay_error {
+  hyb_float rate; /**< Decay rate */
+  hyb_float err;  /**< Largest relative error */
+} test_decay_error;
+
+static hyb_errorcode test_decay_sink(const hyb_float *x, const hyb_float *y, hyb_bool jumped, void *data) {
+  test_decay_error *e = (test_decay_error *) data;
+  const hyb_float ref = exp(-e->rate * x[0]);
+  (void) y; (void) jumped;
+  if (fabs(x[2] - ref) / ref > e->err)
+    e->err = fabs(x[2] - ref) / ref;
+  return HYB_SUCCESS;
+}
+
+/**
+ * @brief Dormand-Prince 5(4) against the analytic decay
+ *
+ * The error follows the tolerances, and the step grows from the initial h:
+ * the horizon is covered in far fewer steps than T_horizon / h.
+ */
+static int test_dopri5_decay(void) {
+  hyb_opts opts = { .y_size = 1, .x_size = 1, .Ts = 1.0, .T_horizon = 10.0, .J_horizon = 10.0,
+                    .F = decay_F, .J = decay_J, .Y = decay_Y, .D = decay_D, .C = decay_C,
+                    .integrator = HYB_DOPRI5, .h = 1e-3 };
+  const hyb_float x0[3] = { 0.0, 0.0, 1.0 };
+  const hyb_float rtol[2] = { 1e-5, 1e-10 };
+  hyb_float err[2];
+  hyb_trajectory traj;
+
+  for (size_t i = 0; i < 2; i++) {
+    test_decay_error e = { 1.0, 0.0 };
+    hyb_workspace ws;
+    opts.rtol = rtol[i];
+    opts.atol = 1e-3 * rtol[i];
+    memset(&traj, 0, sizeof(traj));
+    traj.sink = test_decay_sink;
+    traj.data = &e;
+    TEST_CHECK(hyb_workspace_init(&ws, &opts) == HYB_SUCCESS);
+    TEST_CHECK(hyb_simulate(&opts, &ws, &traj, x0, NULL, 0, NULL) == HYB_SUCCESS);
+    hyb_workspace_free(&ws);
+    TEST_CHECK(traj.jumps == 0);
+    TEST_CHECK(e.err < 100.0 * rtol[i]);
+    TEST_CHECK(traj.samples < (i ? 400u : 100u));
+    err[i] = e.err;
+  }
+  TEST_CHECK(err[1] < 1e-3 * err[0]);
+  return 0;
+}
+
+static void rate_F(hyb_float *xdot, hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  (void) t; (void) j; (void) u;
+  xdot[0] = -p[0][0] * x[0];
+}
+
+static void rate_Fx(hyb_float *jac, hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  (void) t; (void) j; (void) x; (void) u;
+  jac[0] = -p[0][0];
+}
+
+/**
+ * @brief Error at the horizon of a decay x' = -rate x integrated with step Ts
+ */
+static hyb_errorcode test_rate_error(hyb_opts *opts, hyb_float rate, hyb_float Ts, hyb_float *err) {
+  const hyb_float *p[1] = { &rate };
+  const hyb_float x0[3] = { 0.0, 0.0, 1.0 };
+  hyb_float x[3];
+  hyb_trajectory traj;
+  memset(&traj, 0, sizeof(traj));
+  traj.sink = test_last_state;
+  traj.data = x;
+  opts->Ts = Ts;
+  hyb_errorcode ret = hyb_simulate(opts, NULL, &traj, x0, NULL, 0, p);
+  *err = fabs(x[2] - exp(-rate * x[0]));
+  return ret;
+}
+
+/**
+ * @brief Rosenbrock ROS2 against the analytic decay
+ *
+ * On a mild decay the error is of second order in the step, with the
+ * Jacobian of Fx or of the finite differences. On a stiff decay (rate Ts =
+ * 100) the L-stable method damps the solution, where RK4 diverges.
+ */
+static int test_ros2_decay(void) {
+  hyb_opts opts = { .y_size = 1, .x_size = 1, .T_horizon = 1.0, .J_horizon = 10.0,
+                    .F = rate_F, .J = decay_J, .Y = decay_Y, .D = decay_D, .C = decay_C,
+                    .integrator = HYB_ROS2 };
+  hyb_float e1, e2;
+
+  for (int fx = 0; fx < 2; fx++) {
+    opts.Fx = fx ? rate_Fx : NULL;
+    TEST_CHECK(test_rate_error(&opts, 1.0, 2e-2, &e1) == HYB_SUCCESS);
+    TEST_CHECK(test_rate_error(&opts, 1.0, 1e-2, &e2) == HYB_SUCCESS);
+    TEST_CHECK(e1 < 1e-3 && e2 < 1e-3);
+    TEST_CHECK(e1 / e2 > 3.5 && e1 / e2 < 4.5);
+  }
+
+  TEST_CHECK(test_rate_error(&opts, 1e4, 1e-2, &e1) == HYB_SUCCESS);
+  TEST_CHECK(e1 < 1e-6);
+  opts.integrator = HYB_RK4;
+  TEST_CHECK(test_rate_error(&opts, 1e4, 1e-2, &e1) == HYB_SUCCESS);
+  TEST_CHECK(!(e1 < 1.0));
+  return 0;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Dense output
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#define TEST_GRID_LENGTH 200 /**< Samples of the grid */
+#define TEST_GRID_DT 0.0123  /**< Grid spacing, unrelated to the step */
+
+/**
+ * @brief Height of the bouncing ball at the time t (closed form)
+ */
+static hyb_float ball_height(const hyb_float *impacts, hyb_float t) {
+  if (t < impacts[0])
+    return 1.0 - 0.5 * TEST_BALL_G * t * t;
+  size_t k = 0;
+  while (k + 1 < TEST_BALL_JUMPS && t >= impacts[k + 1])
+    k++;
+  const hyb_float v = pow(TEST_BALL_E, (hyb_float) (k + 1)) * sqrt(2.0 * TEST_BALL_G), s = t - impacts[k];
+  return v * s - 0.5 * TEST_BALL_G * s * s;
+}
+
+/**
+ * @brief Bouncing ball sampled on a grid finer than the step
+ *
+ * The cubic interpolant of the flow steps is exact on the parabolic flights,
+ * thus the grid samples match the closed form also between the steps and
+ * across the impacts, and the jumps fall between the expected samples.
+ */
+static int test_grid_bouncing_ball(void) {
+  hyb_opts opts = { .y_size = 1, .x_size = 2, .Ts = 5e-2, .T_horizon = 10.0, .J_horizon = TEST_BALL_JUMPS,
+                    .F = ball_F, .J = ball_J, .Y = ball_Y, .D = ball_D, .C = ball_C, .G = ball_G };
+  static hyb_float grid[TEST_GRID_LENGTH], x[TEST_GRID_LENGTH * 4], y[TEST_GRID_LENGTH];
+  size_t jump_idx[TEST_BALL_JUMPS];
+  hyb_float impacts[TEST_BALL_JUMPS];
+  const hyb_float x0[4] = { 0.0, 0.0, 1.0, 0.0 };
+  hyb_trajectory traj;
+
+  ball_impacts(impacts);
+  for (size_t k = 0; k < TEST_GRID_LENGTH; k++)
+    grid[k] = (hyb_float) k * TEST_GRID_DT;
+  memset(&traj, 0, sizeof(traj));
+  traj.length = TEST_GRID_LENGTH;
+  traj.x = x;
+  traj.y = y;
+  traj.jumps_length = TEST_BALL_JUMPS;
+  traj.jump_idx = jump_idx;
+  TEST_CHECK(hyb_simulate_grid(&opts, NULL, &traj, grid, x0, NULL, 0, NULL) == HYB_SUCCESS);
+  TEST_CHECK(traj.samples == TEST_GRID_LENGTH);
+
+  size_t jumps = 0;
+  for (size_t k = 0; k < TEST_GRID_LENGTH; k++) {
+    while (jumps < TEST_BALL_JUMPS && impacts[jumps] <= grid[k])
+      jumps++;
+    TEST_CHECK(x[k * 4] == grid[k]);
+    TEST_CHECK(x[k * 4 + 1] == (hyb_float) jumps);
+    TEST_CHECK(fabs(x[k * 4 + 2] - ball_height(impacts, grid[k])) < 1e-9);
+    TEST_CHECK(y[k] == x[k * 4 + 2]);
+  }
+  TEST_CHECK(traj.jumps == jumps && jumps == TEST_BALL_JUMPS - 1);
+  for (size_t i = 0; i < jumps; i++)
+    TEST_CHECK(jump_idx[i] == (size_t) ceil(impacts[i] / TEST_GRID_DT));
+  return 0;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Checkpoints
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#define TEST_CKPT_LENGTH 512 /**< Capacity of the trajectories */
+#define TEST_CKPT_SAMPLE 37  /**< Sample at which the checkpoint is taken */
+
+/**
+ * @brief Sink that saves a checkpoint at a given sample and stops the simulation
+ */
+typedef struct test_ckpt {
+  hyb_workspace *ws; /**< Workspace of the simulation */
+  size_t k;          /**< Samples received */
+  void *blob;        /**< Checkpoint buffer */
+  size_t size;       /**< Size of the checkpoint buffer */
+} test_ckpt;
+
+static hyb_errorcode test_ckpt_sink(const hyb_float *x, const hyb_float *y, hyb_bool jumped, void *data) {
+  test_ckpt *c = (test_ckpt *) data;
+  (void) y; (void) jumped;
+  if (c->k++ < TEST_CKPT_SAMPLE)
+    return HYB_SUCCESS;
+  if (hyb_checkpoint_save(c->ws, x, c->blob, c->size))
+    return HYB_GENERIC;
+  return HYB_ABORT;
+}
+
+/**
+ * @brief Resumed simulation against the uninterrupted one
+ *
+ * The bouncing ball is integrated with the adaptive and the implicit
+ * integrator, whose step history and Jacobian are part of the checkpoint:
+ * restored in a new workspace, the continuation reproduces the remaining
+ * samples bit for bit. A corrupted checkpoint is rejected.
+ */
+static int test_checkpoint_resume(void) {
+  hyb_opts opts = { .y_size = 1, .x_size = 2, .Ts = 5e-2, .T_horizon = 10.0, .J_horizon = TEST_BALL_JUMPS,
+                    .F = ball_F, .J = ball_J, .Y = ball_Y, .D = ball_D, .C = ball_C, .G = ball_G };
+  const hyb_integrator integrators[2] = { HYB_DOPRI5, HYB_ROS2 };
+  static hyb_float ref[TEST_CKPT_LENGTH * 4], x[TEST_CKPT_LENGTH * 4];
+  static unsigned char blob[4096];
+  const hyb_float x0[4] = { 0.0, 0.0, 1.0, 0.0 };
+  hyb_trajectory traj;
+  hyb_workspace ws;
+  size_t samples;
+
+  for (size_t i = 0; i < 2; i++) {
+    opts.integrator = integrators[i];
+    memset(&traj, 0, sizeof(traj));
+    traj.length = TEST_CKPT_LENGTH;
+    traj.x = ref;
+    TEST_CHECK(hyb_simulate(&opts, NULL, &traj, x0, NULL, 0, NULL) == HYB_SUCCESS);
+    TEST_CHECK(traj.jumps == TEST_BALL_JUMPS);
+    samples = traj.samples;
+
+    test_ckpt c = { &ws, 0, blob, sizeof(blob) };
+    TEST_CHECK(hyb_workspace_init(&ws, &opts) == HYB_SUCCESS);
+    TEST_CHECK(hyb_checkpoint_size(&ws) <= sizeof(blob));
+    memset(&traj, 0, sizeof(traj));
+    traj.sink = test_ckpt_sink;
+    traj.data = &c;
+    TEST_CHECK(hyb_simulate(&opts, &ws, &traj, x0, NULL, 0, NULL) == HYB_ABORT);
+    hyb_workspace_free(&ws);
+
+    hyb_float xr[4];
+    TEST_CHECK(hyb_workspace_init(&ws, &opts) == HYB_SUCCESS);
+    TEST_CHECK(hyb_checkpoint_load(&ws, xr, blob, sizeof(blob)) == HYB_SUCCESS);
+    memset(&traj, 0, sizeof(traj));
+    traj.length = TEST_CKPT_LENGTH;
+    traj.x = x;
+    TEST_CHECK(hyb_simulate(&opts, &ws, &traj, xr, NULL, 0, NULL) == HYB_SUCCESS);
+    TEST_CHECK(traj.samples == samples - TEST_CKPT_SAMPLE);
+    TEST_CHECK(!memcmp(x, ref + TEST_CKPT_SAMPLE * 4, traj.samples * 4 * sizeof(hyb_float)));
+
+    blob[hyb_checkpoint_size(&ws) - 1] ^= 1;
+    TEST_CHECK(hyb_checkpoint_load(&ws, xr, blob, sizeof(blob)) == HYB_GENERIC);
+    hyb_workspace_free(&ws);
+  }
+  return 0;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Input signals
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#define TEST_INPUT_LENGTH 9 /**< Samples of t^2 on [0, 1] */
+
+static void integ_F(hyb_float *xdot, hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  (void) t; (void) j; (void) x; (void) p;
+  xdot[0] = u[0];
+}
+
+/**
+ * @brief Holds of a sampled t^2, read in place from the first row of a matrix
+ *
+ * Between the samples the zero order hold keeps the sample, the first order
+ * hold interpolates linearly and the cubic one is exact on the quadratic
+ * (away from the ends). Integrating x' = u with steps aligned to the samples
+ * gives the rectangle and the trapezoid rule exactly, and the cubic hold is
+ * closer to the integral of t^2.
+ */
+static int test_input_holds(void) {
+  hyb_opts opts = { .y_size = 1, .x_size = 1, .Ts = 0.0625, .T_horizon = 1.0, .J_horizon = 10.0,
+                    .F = integ_F, .J = decay_J, .Y = decay_Y, .D = decay_D, .C = decay_C };
+  const hyb_float value[3] = { 0.0625, 0.09375, 0.09 };
+  const hyb_float integral[3] = { 0.2734375, 0.3359375, 1.0 / 3.0 };
+  hyb_float u[2 * TEST_INPUT_LENGTH];
+  hyb_input in = { .u = u, .t0 = 0.0, .dt = 0.125, .u_size = 1, .length = TEST_INPUT_LENGTH, .stride = 2 };
+  const hyb_float x0[3] = { 0.0, 0.0, 1.0 };
+  hyb_float x[3];
+  hyb_workspace ws;
+  hyb_trajectory traj;
+
+  for (size_t k = 0; k < TEST_INPUT_LENGTH; k++) {
+    u[2 * k] = (hyb_float) (k * k) / 64.0;
+    u[2 * k + 1] = 1e9;
+  }
+  TEST_CHECK(hyb_workspace_init(&ws, &opts) == HYB_SUCCESS);
+  for (int hold = HYB_ZOH; hold <= HYB_CUBIC; hold++) {
+    in.hold = (hyb_hold) hold;
+    TEST_CHECK(hyb_input_attach(&ws, &in) == HYB_SUCCESS);
+    TEST_CHECK(fabs(hyb_input_value(&ws, 0.3)[0] - value[hold]) < 1e-15);
+    TEST_CHECK(hyb_input_value(&ws, 0.5) == u + 8);
+    TEST_CHECK(hyb_input_value(&ws, -1.0)[0] == 0.0);
+    TEST_CHECK(hyb_input_value(&ws, 2.0)[0] == 1.0);
+
+    memset(&traj, 0, sizeof(traj));
+    traj.sink = test_last_state;
+    traj.data = x;
+    TEST_CHECK(hyb_simulate(&opts, &ws, &traj, x0, NULL, 0, NULL) == HYB_SUCCESS);
+    TEST_CHECK(x[0] == 1.0);
+    if (hold == HYB_CUBIC)
+      TEST_CHECK(fabs(x[2] - 1.0 - integral[hold]) < fabs(integral[HYB_FOH] - integral[hold]));
+    else
+      TEST_CHECK(fabs(x[2] - 1.0 - integral[hold]) < 1e-15);
+  }
+  hyb_workspace_free(&ws);
+  return 0;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Automaton: triangle wave, x' = 1 in mode 0 up to 1, x' = -1 in mode 1 down to 0
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#define TEST_TRI_LENGTH 512 /**< Capacity of the trajectories */
+
+static void tri_up_F(hyb_float *xdot, hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  (void) t; (void) j; (void) x; (void) u; (void) p;
+  xdot[0] = 1.0;
+}
+
+static void tri_down_F(hyb_float *xdot, hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  (void) t; (void) j; (void) x; (void) u; (void) p;
+  xdot[0] = -1.0;
+}
+
+static hyb_float tri_up_G(hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  (void) t; (void) j; (void) u; (void) p;
+  return 1.0 - x[0];
+}
+
+static hyb_bool tri_top(hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  (void) t; (void) j; (void) u; (void) p;
+  return x[0] >= 1.0 ? hyb_true : hyb_false;
+}
+
+static void tri_reset(hyb_float *xp, hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  (void) t; (void) j; (void) u; (void) p;
+  xp[0] = x[0];
+}
+
+static const hyb_mode tri_modes[2] = {
+  { .F = tri_up_F, .G = tri_up_G },
+  { .F = tri_down_F, .G = decay_G }
+};
+
+static const hyb_transition tri_transitions[2] = {
+  { .from = 0, .to = 1, .guard = tri_top, .reset = tri_reset },
+  { .from = 1, .to = 0, .guard = decay_D, .reset = tri_reset }
+};
+
+/**
+ * @brief Sink of the automaton that saves a checkpoint at a given sample and stops
+ */
+typedef struct test_tri_ckpt {
+  hyb_automaton *a;  /**< Automaton of the simulation */
+  hyb_workspace *ws; /**< Workspace of the simulation */
+  size_t k;          /**< Samples received */
+  size_t at;         /**< Sample of the checkpoint */
+  void *blob;        /**< Checkpoint buffer */
+  size_t size;       /**< Size of the checkpoint buffer */
+} test_tri_ckpt;
+
+static hyb_errorcode test_tri_sink(const hyb_float *x, const hyb_float *y, hyb_bool jumped, void *data) {
+  test_tri_ckpt *c = (test_tri_ckpt *) data;
+  (void) y; (void) jumped;
+  if (c->k++ < c->at)
+    return HYB_SUCCESS;
+  if (hyb_automaton_checkpoint_save(c->a, c->ws, x, c->blob, c->size))
+    return HYB_GENERIC;
+  return HYB_ABORT;
+}
+
+/**
+ * @brief Triangle wave of a two mode automaton against the closed form
+ *
+ * The transitions are located at the integer times, each sample is in the
+ * mode given by the parity of its jump count, and the state follows the
+ * triangle wave. Restored from a checkpoint taken in mode 1, a new automaton
+ * (in mode 0 after the initialization) continues in mode 1.
+ */
+static int test_automaton_triangle(void) {
+  hyb_opts opts = { .y_size = 1, .x_size = 1, .Ts = 0.3, .T_horizon = 5.0, .J_horizon = 100.0,
+                    .F = decay_F, .J = decay_J, .Y = decay_Y, .D = decay_D };
+  static hyb_float x[TEST_TRI_LENGTH * 3], xc[TEST_TRI_LENGTH * 3];
+  static size_t modes[TEST_TRI_LENGTH], modes_c[TEST_TRI_LENGTH];
+  static unsigned char blob[4096];
+  const hyb_float x0[3] = { 0.0, 0.0, 0.0 };
+  size_t jump_idx[4];
+  hyb_automaton a;
+  hyb_workspace ws;
+  hyb_trajectory traj;
+
+  TEST_CHECK(hyb_automaton_init(&a, &opts, tri_modes, 2, tri_transitions, 2) == HYB_SUCCESS);
+  memset(&traj, 0, sizeof(traj));
+  traj.length = TEST_TRI_LENGTH;
+  traj.x = x;
+  traj.jumps_length = 4;
+  traj.jump_idx = jump_idx;
+  TEST_CHECK(hyb_automaton_simulate(&a, NULL, &traj, modes, x0, NULL, 0, NULL) == HYB_SUCCESS);
+  TEST_CHECK(traj.jumps == 4);
+  for (size_t i = 0; i < 4; i++)
+    TEST_CHECK(fabs(x[jump_idx[i] * 3] - (hyb_float) (i + 1)) < 1e-9);
+  for (size_t k = 0; k < traj.samples; k++) {
+    const hyb_float *xk = x + k * 3;
+    const hyb_float s = fmod(xk[0], 2.0);
+    TEST_CHECK(modes[k] == (size_t) xk[1] % 2);
+    TEST_CHECK(fabs(xk[2] - (s < 1.0 ? s : 2.0 - s)) < 1e-9);
+  }
+  const size_t samples = traj.samples;
+
+  test_tri_ckpt c = { &a, &ws, 0, 0, blob, sizeof(blob) };
+  while (modes[c.at] != 1)
+    c.at++;
+  c.at++;
+  a.mode = 0;
+  TEST_CHECK(hyb_workspace_init(&ws, &opts) == HYB_SUCCESS);
+  TEST_CHECK(hyb_automaton_checkpoint_size(&ws) <= sizeof(blob));
+  memset(&traj, 0, sizeof(traj));
+  traj.sink = test_tri_sink;
+  traj.data = &c;
+  TEST_CHECK(hyb_automaton_simulate(&a, &ws, &traj, NULL, x0, NULL, 0, NULL) == HYB_ABORT);
+  hyb_workspace_free(&ws);
+  hyb_automaton_free(&a);
+
+  hyb_float xr[3];
+  TEST_CHECK(hyb_automaton_init(&a, &opts, tri_modes, 2, tri_transitions, 2) == HYB_SUCCESS);
+  TEST_CHECK(hyb_workspace_init(&ws, &opts) == HYB_SUCCESS);
+  TEST_CHECK(hyb_automaton_checkpoint_load(&a, &ws, xr, blob, sizeof(blob)) == HYB_SUCCESS);
+  TEST_CHECK(a.mode == 1);
+  memset(&traj, 0, sizeof(traj));
+  traj.length = TEST_TRI_LENGTH;
+  traj.x = xc;
+  TEST_CHECK(hyb_automaton_simulate(&a, &ws, &traj, modes_c, xr, NULL, 0, NULL) == HYB_SUCCESS);
+  TEST_CHECK(traj.samples == samples - c.at);
+  TEST_CHECK(!memcmp(xc, x + c.at * 3, traj.samples * 3 * sizeof(hyb_float)));
+  TEST_CHECK(!memcmp(modes_c, modes + c.at, traj.samples * sizeof(size_t)));
+  hyb_workspace_free(&ws);
+  hyb_automaton_free(&a);
+  return 0;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Estimator
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#define TEST_ESTIM_LENGTH 100 /**< Samples of the dataset */
+
+/**
+ * @brief Recovery of the rate and of the initial state of a decay
+ *
+ * The dataset is the output of the model itself, so the estimator has to
+ * find the true parameter and initial state from a wrong guess, with a
+ * cost that vanishes and continuous segments.
+ */
+static int test_estimate_decay(void) {
+  hyb_opts opts = { .y_size = 1, .x_size = 1, .Ts = 0.05, .T_horizon = 100.0, .J_horizon = 10.0,
+                    .F = rate_F, .J = decay_J, .Y = decay_Y, .D = decay_D, .C = decay_C };
+  static hyb_float t[TEST_ESTIM_LENGTH], x[TEST_ESTIM_LENGTH * 3], y[TEST_ESTIM_LENGTH];
+  hyb_float rate = 2.0, x0[3] = { 0.0, 0.0, 1.0 };
+  const hyb_float *p_true[1] = { &rate };
+  hyb_float *p[1] = { &rate };
+  const size_t p_size[1] = { 1 };
+  hyb_estim_opts eopts;
+  hyb_estim_result res;
+  hyb_trajectory traj;
+
+  memset(&traj, 0, sizeof(traj));
+  traj.length = TEST_ESTIM_LENGTH;
+  traj.x = x;
+  traj.y = y;
+  TEST_CHECK(hyb_simulate(&opts, NULL, &traj, x0, NULL, 0, p_true) == HYB_BUFFER);
+  for (size_t k = 0; k < TEST_ESTIM_LENGTH; k++)
+    t[k] = x[k * 3];
+
+  hyb_dataset data = { .length = TEST_ESTIM_LENGTH, .t = t, .y = y, .x0 = x0 };
+  memset(&eopts, 0, sizeof(eopts));
+  eopts.segment = 20;
+  eopts.threads = 2;
+  rate = 1.0;
+  x0[2] = 0.8;
+  TEST_CHECK(hyb_estimate(&opts, &eopts, &data, 1, p, 1, p_size, &res) == HYB_SUCCESS);
+  TEST_CHECK(fabs(rate - 2.0) < 1e-6);
+  TEST_CHECK(fabs(x0[2] - 1.0) < 1e-6);
+  TEST_CHECK(res.cost < 1e-12 * res.cost0);
+  TEST_CHECK(res.defect < 1e-6);
+  return 0;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Real-time runner
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#define TEST_RT_CYCLES 20       /**< Periods of the run */
+#define TEST_RT_PERIOD 2e-3     /**< Wall clock period */
+
+/**
+ * @brief Exchange that feeds the index of the next period as input
+ */
+static hyb_errorcode test_rt_io(hyb_float *u, const hyb_float *x, const hyb_float *y, unsigned long long cycle, void *data) {
+  (void) x; (void) y; (void) data;
+  u[0] = (hyb_float) (cycle + 1);
+  return HYB_SUCCESS;
+}
+
+/**
+ * @brief Real-time run of x' = u, with the input written by the exchange
+ *
+ * The state integrates the inputs of the exchange, one flow step per period,
+ * the run lasts at least the scheduled periods and each period is recorded
+ * in the histograms.
+ */
+static int test_rt_schedule(void) {
+  hyb_opts opts = { .y_size = 1, .x_size = 1, .Ts = 0.125, .T_horizon = 100.0, .J_horizon = 10.0,
+                    .F = integ_F, .J = decay_J, .Y = decay_Y, .D = decay_D, .C = decay_C };
+  hyb_rt_opts rt = { .period = TEST_RT_PERIOD, .cycles = TEST_RT_CYCLES, .io = test_rt_io };
+  hyb_float x[3] = { 0.0, 0.0, 1.0 }, u[1] = { 0.0 };
+  struct timespec t0, t1;
+  hyb_rt_stats stats;
+  hyb_workspace ws;
+
+  TEST_CHECK(hyb_workspace_init(&ws, &opts) == HYB_SUCCESS);
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  TEST_CHECK(hyb_rt_run(&opts, &ws, &rt, x, u, NULL, &stats) == HYB_SUCCESS);
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  hyb_workspace_free(&ws);
+
+  TEST_CHECK(x[0] == TEST_RT_CYCLES * opts.Ts);
+  TEST_CHECK(x[2] == 1.0 + opts.Ts * TEST_RT_CYCLES * (TEST_RT_CYCLES - 1) / 2);
+  TEST_CHECK((t1.tv_sec - t0.tv_sec) + 1e-9 * (t1.tv_nsec - t0.tv_nsec) >= (TEST_RT_CYCLES - 1) * TEST_RT_PERIOD);
+  TEST_CHECK(stats.cycles == TEST_RT_CYCLES);
+  TEST_CHECK(stats.period_ns == 2000000ull);
+  TEST_CHECK(stats.phase[HYB_RT_FLOW].count == TEST_RT_CYCLES);
+  TEST_CHECK(stats.phase[HYB_RT_JUMP].count == 0);
+  for (int ph = 0; ph < HYB_RT_PHASES; ph++) {
+    unsigned long long n = 0;
+    for (size_t b = 0; b < HYB_RT_BINS; b++)
+      n += stats.phase[ph].bins[b];
+    TEST_CHECK(n == stats.phase[ph].count);
+  }
+  TEST_CHECK(stats.phase[HYB_RT_PERIOD].count == TEST_RT_CYCLES);
+  TEST_CHECK(hyb_rt_quantile(&stats, HYB_RT_PERIOD, 0.5) <= hyb_rt_quantile(&stats, HYB_RT_PERIOD, 1.0));
+  return 0;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Vector kernels
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#define TEST_CHAIN_SIZE 1003 /**< States of the chain, not a multiple of any vector width */
+#define TEST_CHAIN_STEPS 50  /**< Flow steps of the comparison */
+
+static void chain_F(hyb_float *xdot, hyb_float t, hyb_float j, const hyb_float *x, const hyb_float *u, const hyb_float **p) {
+  (void) t; (void) j; (void) u; (void) p;
+  xdot[0] = -x[0];
+  for (size_t i = 1; i < TEST_CHAIN_SIZE; i++)
+    xdot[i] = 0.3 * x[i - 1] - (hyb_float) (i % 7 + 1) * x[i];
+}
+
+/**
+ * @brief Same trajectory with every instruction set of the stage kernels
+ *
+ * The workspace is lowered to each level up to the detected one: all of them
+ * must reproduce the scalar loops bit for bit.
+ */
+static int test_simd_levels(void) {
+  hyb_opts opts = { .y_size = 1, .x_size = TEST_CHAIN_SIZE, .Ts = 1e-2, .T_horizon = 10.0, .J_horizon = 10.0,
+                    .F = chain_F, .J = decay_J, .Y = decay_Y, .D = decay_D, .C = decay_C };
+  static hyb_float ref[TEST_CHAIN_SIZE + 2], x[TEST_CHAIN_SIZE + 2], xp[TEST_CHAIN_SIZE + 2];
+  hyb_workspace ws;
+  hyb_float y;
+
+  TEST_CHECK(hyb_workspace_init(&ws, &opts) == HYB_SUCCESS);
+  const hyb_simd detected = ws.simd;
+  for (int level = HYB_SIMD_NONE; level <= (int) detected; level++) {
+    ws.simd = (hyb_simd) level;
+    x[0] = x[1] = 0.0;
+    for (size_t i = 0; i < TEST_CHAIN_SIZE; i++)
+      x[i + 2] = 1.0 + 0.001 * (hyb_float) i;
+    for (size_t k = 0; k < TEST_CHAIN_STEPS; k++) {
+      TEST_CHECK(hyb_step(&opts, &ws, &y, xp, x, NULL, NULL) == HYB_SUCCESS);
+      memcpy(x, xp, sizeof(x));
+    }
+    if (level == HYB_SIMD_NONE)
+      memcpy(ref, x, sizeof(x));
+    else
+      TEST_CHECK(!memcmp(x, ref, sizeof(x)));
+  }
+  hyb_workspace_free(&ws);
+  return 0;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Accumulators
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/**
+ * @brief Reductions of the bouncing ball against the closed form
+ *
+ * Range of the height and of the speed and time of the first impact from
+ * hyb_simulate, error against the closed form heights on a grid. A bound of
+ * zero on the error of a shifted reference stops the simulation at the
+ * first matched sample.
+ */
+static int test_accum_bouncing_ball(void) {
+  hyb_opts opts = { .y_size = 1, .x_size = 2, .Ts = 1e-2, .T_horizon = 10.0, .J_horizon = TEST_BALL_JUMPS,
+                    .F = ball_F, .J = ball_J, .Y = ball_Y, .D = ball_D, .C = ball_C, .G = ball_G };
+  static hyb_float grid[TEST_GRID_LENGTH], ref[TEST_GRID_LENGTH];
+  hyb_float impacts[TEST_BALL_JUMPS];
+  const hyb_float x0[4] = { 0.0, 0.0, 1.0, 0.0 };
+  hyb_accum acc[4];
+  hyb_accum_set set = { acc, 4 };
+  hyb_trajectory traj;
+
+  ball_impacts(impacts);
+  hyb_accum_init(&acc[0], HYB_ACC_MAX, 0, hyb_true);
+  hyb_accum_init(&acc[1], HYB_ACC_MIN, 2, hyb_false);
+  hyb_accum_init(&acc[2], HYB_ACC_MIN, 3, hyb_false);
+  hyb_accum_init(&acc[3], HYB_ACC_FIRST_JUMP, 0, hyb_false);
+  memset(&traj, 0, sizeof(traj));
+  traj.sink = hyb_accum_sink;
+  traj.data = &set;
+  TEST_CHECK(hyb_simulate(&opts, NULL, &traj, x0, NULL, 0, NULL) == HYB_SUCCESS);
+  TEST_CHECK(acc[0].value == 1.0 && acc[0].count == traj.samples);
+  TEST_CHECK(acc[1].value < 0.0 && acc[1].value > -1e-9);
+  TEST_CHECK(fabs(acc[2].value + sqrt(2.0 * TEST_BALL_G)) < 1e-9);
+  TEST_CHECK(fabs(acc[3].value - impacts[0]) < 1e-9 && acc[3].count == 1);
+
+  for (size_t k = 0; k < TEST_GRID_LENGTH; k++) {
+    grid[k] = (hyb_float) k * TEST_GRID_DT;
+    ref[k] = ball_height(impacts, grid[k]);
+  }
+  hyb_accum_init(&acc[0], HYB_ACC_SSE, 0, hyb_true);
+  acc[0].ref_t = grid;
+  acc[0].ref_y = ref;
+  acc[0].ref_length = TEST_GRID_LENGTH;
+  set.n = 1;
+  memset(&traj, 0, sizeof(traj));
+  traj.length = TEST_GRID_LENGTH;
+  traj.sink = hyb_accum_sink;
+  traj.data = &set;
+  TEST_CHECK(hyb_simulate_grid(&opts, NULL, &traj, grid, x0, NULL, 0, NULL) == HYB_SUCCESS);
+  TEST_CHECK(acc[0].count == TEST_GRID_LENGTH && acc[0].value < 1e-16);
+
+  for (size_t k = 0; k < TEST_GRID_LENGTH; k++)
+    ref[k] += 0.1;
+  acc[0].bound = 0.0;
+  hyb_accum_reset(&set);
+  TEST_CHECK(hyb_simulate_grid(&opts, NULL, &traj, grid, x0, NULL, 0, NULL) == HYB_ABORT);
+  TEST_CHECK(acc[0].count == 1 && traj.samples == 1);
+  return 0;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Parareal
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#define TEST_PARAREAL_SLICES 5 /**< Time slices of 0.5 */
+
+/**
+ * @brief Parareal boundary states against the sequential simulation
+ *
+ * The bouncing ball, without event location, jumps on the integration grid,
+ * that the slice boundaries follow (the slice length is a multiple of Ts):
+ * the converged boundary states are the states of hyb_simulate at the same
+ * times, before the jumps at those times.
+ */
+static int test_parareal_bouncing_ball(void) {
+  hyb_opts opts = { .y_size = 1, .x_size = 2, .Ts = 1.0 / 64.0, .T_horizon = 2.5, .J_horizon = 100.0,
+                    .F = ball_F, .J = ball_J, .Y = ball_Y, .D = ball_D, .C = ball_C };
+  hyb_parareal_opts popts = { .slices = TEST_PARAREAL_SLICES, .threads = 2, .coarse_Ts = 0.125 };
+  static hyb_float x[1024 * 4];
+  hyb_float xs[(TEST_PARAREAL_SLICES + 1) * 4];
+  const hyb_float x0[4] = { 0.0, 0.0, 1.0, 0.0 };
+  hyb_parareal_result res;
+  hyb_trajectory traj;
+
+  memset(&traj, 0, sizeof(traj));
+  traj.length = 1024;
+  traj.x = x;
+  TEST_CHECK(hyb_simulate(&opts, NULL, &traj, x0, NULL, 0, NULL) == HYB_SUCCESS);
+  TEST_CHECK(traj.jumps > 0);
+  TEST_CHECK(hyb_parareal(&opts, &popts, x0, NULL, NULL, xs, &res) == HYB_SUCCESS);
+  TEST_CHECK(res.converged && res.iterations <= TEST_PARAREAL_SLICES);
+
+  size_t k = 0;
+  for (size_t n = 0; n <= TEST_PARAREAL_SLICES; n++) {
+    const hyb_float *xn = xs + n * 4;
+    while (k < traj.samples && x[k * 4] < 0.5 * (hyb_float) n)
+      k++;
+    TEST_CHECK(k < traj.samples && x[k * 4] == 0.5 * (hyb_float) n);
+    TEST_CHECK(xn[0] == x[k * 4] && xn[1] == x[k * 4 + 1]);
+    TEST_CHECK(fabs(xn[2] - x[k * 4 + 2]) < 1e-10 && fabs(xn[3] - x[k * 4 + 3]) < 1e-10);
+  }
+  return 0;
+}
+
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Runner
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+/**
+ * @brief A test returns 0 on success
+ */
+typedef struct test_case {
+  const char *name;
+  int (*run)(void);
+} test_case;
+
+static const test_case test_cases[] = {
+  { "sens_jump_without_event", test_sens_jump_without_event },
+  { "pipe_decimate", test_pipe_decimate },
+  { "ensemble_wide_output", test_ensemble_wide_output },
+  { "event_bouncing_ball", test_event_bouncing_ball },
+  { "dopri5_decay", test_dopri5_decay },
+  { "ros2_decay", test_ros2_decay },
+  { "grid_bouncing_ball", test_grid_bouncing_ball },
+  { "checkpoint_resume", test_checkpoint_resume },
+  { "input_holds", test_input_holds },
+  { "automaton_triangle", test_automaton_triangle },
+  { "estimate_decay", test_estimate_decay },
+  { "rt_schedule", test_rt_schedule },
+  { "simd_levels", test_simd_levels },
+  { "accum_bouncing_ball", test_accum_bouncing_ball },
+  { "parareal_bouncing_ball", test_parareal_bouncing_ball }
+};
+
+int main(void) {
+  int failed = 0;
+  for (size_t i = 0; i < sizeof(test_cases) / sizeof(test_cases[0]); i++) {
+    int ret = test_cases[i].run();
+    printf("%s %s\n", ret ? "FAIL" : "PASS", test_cases[i].name);
+    failed += ret != 0;
+  }
+  return failed ? 1 : 0;
+}
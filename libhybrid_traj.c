@@ -0,0 +1,236 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2018 - Matteo Ragni, Matteo Cocetti - University of Trento
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+/**
+ * @file libhybrid_traj.c
+ * @author Matteo Ragni, Matteo Cocetti
+ */
+
+#include "libhybrid_traj.h"
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char hyb_traj_magic[8] = { 'H', 'Y', 'B', 'T', 'R', 'A', 'J', '\0' }; /**< File signature */
+
+/**
+ * @brief Header of a trajectory file (HYB_TRAJ_HEADER bytes)
+ */
+typedef struct hyb_traj_header {
+  char magic[8];       /**< hyb_traj_magic */
+  uint32_t version;    /**< HYB_TRAJ_VERSION */
+  uint32_t float_size; /**< sizeof(hyb_float) */
+  uint64_t x_size;     /**< State size */
+  uint64_t y_size;     /**< Output size */
+  uint64_t chunk_len;  /**< Records per chunk */
+  uint64_t records;    /**< Number of records (0 until the writer is closed) */
+  uint64_t jumps;      /**< Number of jumps */
+  uint64_t complete;   /**< 1 once the writer is closed */
+} hyb_traj_header;
+
+/**
+ * @brief Writes the header of the file
+ */
+static hyb_errorcode hyb_traj_header_write(hyb_traj_writer *w, hyb_bool complete) {
+  hyb_traj_header hd;
+  char block[HYB_TRAJ_HEADER];
+  memset(&hd, 0, sizeof(hd));
+  memcpy(hd.magic, hyb_traj_magic, sizeof(hd.magic));
+  hd.version = HYB_TRAJ_VERSION;
+  hd.float_size = sizeof(hyb_float);
+  hd.x_size = w->x_size;
+  hd.y_size = w->y_size;
+  hd.chunk_len = w->chunk_len;
+  hd.records = w->records;
+  hd.jumps = w->jumps_len;
+  hd.complete = complete ? 1 : 0;
+  memset(block, 0, sizeof(block));
+  memcpy(block, &hd, sizeof(hd));
+  if (fseek(w->file, 0, SEEK_SET) || fwrite(block, sizeof(block), 1, w->file) != 1)
+    return HYB_IO;
+  return HYB_SUCCESS;
+}
+
+/**
+ * @brief Writes the current chunk (padded with zeros) to the file
+ */
+static hyb_errorcode hyb_traj_flush(hyb_traj_writer *w) {
+  const size_t cols = w->x_size + w->y_size + 2;
+  if (w->fill == 0)
+    return HYB_SUCCESS;
+  for (size_t c = 0; c < cols; c++)
+    memset(w->chunk + c * w->chunk_len + w->fill, 0, (w->chunk_len - w->fill) * sizeof(hyb_float));
+  if (fwrite(w->chunk, sizeof(hyb_float), cols * w->chunk_len, w->file) != cols * w->chunk_len)
+    return HYB_IO;
+  w->chunks++;
+  w->fill = 0;
+  return HYB_SUCCESS;
+}
+
+hyb_errorcode hyb_traj_open(hyb_traj_writer *w, const char *path, const hyb_opts *opts, size_t chunk_len) {
+  if (!w || !path || !opts)
+    return HYB_NULLPTR;
+  memset(w, 0, sizeof(hyb_traj_writer));
+  w->x_size = opts->x_size;
+  w->y_size = opts->y_size;
+  /* Columns start on a cache line (and the jump index is aligned) */
+  const size_t line = HYB_CACHE_LINE / sizeof(hyb_float);
+  chunk_len = chunk_len ? chunk_len : HYB_TRAJ_CHUNK;
+  w->chunk_len = ((chunk_len + line - 1) / line) * line;
+  w->chunk = (hyb_float *)malloc(w->chunk_len * (w->x_size + w->y_size + 2) * sizeof(hyb_float));
+  if (!w->chunk)
+    return HYB_EMALLOC;
+  w->file = fopen(path, "wb");
+  if (!w->file || hyb_traj_header_write(w, hyb_false)) {
+    if (w->file)
+      fclose(w->file);
+    free(w->chunk);
+    memset(w, 0, sizeof(hyb_traj_writer));
+    return HYB_IO;
+  }
+  return HYB_SUCCESS;
+}
+
+hyb_errorcode hyb_traj_write(hyb_traj_writer *w, const hyb_float *x, const hyb_float *y, hyb_bool jumped) {
+  const size_t len = w->chunk_len, f = w->fill;
+  hyb_float *col = w->chunk + f;
+
+  if (jumped) {
+    if (w->jumps_len == w->jumps_cap) {
+      size_t cap = w->jumps_cap ? 2 * w->jumps_cap : 64;
+      uint64_t *jumps = (uint64_t *)realloc(w->jumps, cap * sizeof(uint64_t));
+      if (!jumps)
+        return HYB_EMALLOC;
+      w->jumps = jumps;
+      w->jumps_cap = cap;
+    }
+    w->jumps[w->jumps_len++] = w->records;
+  }
+
+  for (size_t i = 0; i < w->x_size + 2; i++, col += len)
+    *col = x[i];
+  for (size_t i = 0; i < w->y_size; i++, col += len)
+    *col = y ? y[i] : 0.0;
+  w->fill++;
+  w->records++;
+  return w->fill == len ? hyb_traj_flush(w) : HYB_SUCCESS;
+}
+
+hyb_errorcode hyb_traj_sink(const hyb_float *x, const hyb_float *y, hyb_bool jumped, void *data) {
+  return hyb_traj_write((hyb_traj_writer *)data, x, y, jumped);
+}
+
+hyb_errorcode hyb_traj_close(hyb_traj_writer *w) {
+  if (!w || !w->file)
+    return HYB_NULLPTR;
+  hyb_errorcode ret = hyb_traj_flush(w);
+  if (!ret && w->jumps_len && fwrite(w->jumps, sizeof(uint64_t), w->jumps_len, w->file) != w->jumps_len)
+    ret = HYB_IO;
+  if (!ret)
+    ret = hyb_traj_header_write(w, hyb_true);
+  if (fclose(w->file) && !ret)
+    ret = HYB_IO;
+  free(w->chunk);
+  free(w->jumps);
+  memset(w, 0, sizeof(hyb_traj_writer));
+  return ret;
+}
+
+hyb_errorcode hyb_traj_map(hyb_traj_reader *r, const char *path) {
+  if (!r || !path)
+    return HYB_NULLPTR;
+  memset(r, 0, sizeof(hyb_traj_reader));
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return HYB_IO;
+  struct stat st;
+  if (fstat(fd, &st) || (size_t)st.st_size < HYB_TRAJ_HEADER) {
+    close(fd);
+    return HYB_IO;
+  }
+  void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return HYB_IO;
+  r->map = map;
+  r->map_size = (size_t)st.st_size;
+
+  hyb_traj_header hd;
+  memcpy(&hd, map, sizeof(hd));
+  const uint64_t cols = hd.x_size + hd.y_size + 2;
+  const uint64_t chunks = hd.chunk_len ? (hd.records + hd.chunk_len - 1) / hd.chunk_len : 0;
+  const uint64_t size = HYB_TRAJ_HEADER + chunks * hd.chunk_len * cols * sizeof(hyb_float) + hd.jumps * sizeof(uint64_t);
+  if (memcmp(hd.magic, hyb_traj_magic, sizeof(hd.magic)) || hd.version != HYB_TRAJ_VERSION ||
+      hd.float_size != sizeof(hyb_float) || !hd.complete || !hd.chunk_len || size > r->map_size) {
+    hyb_traj_unmap(r);
+    return HYB_IO;
+  }
+
+  r->x_size = (size_t)hd.x_size;
+  r->y_size = (size_t)hd.y_size;
+  r->chunk_len = (size_t)hd.chunk_len;
+  r->records = hd.records;
+  r->jumps = hd.jumps;
+  r->data = (const hyb_float *)((const char *)map + HYB_TRAJ_HEADER);
+  r->jump_idx = (const uint64_t *)(r->data + chunks * hd.chunk_len * cols);
+  return HYB_SUCCESS;
+}
+
+void hyb_traj_unmap(hyb_traj_reader *r) {
+  if (!r)
+    return;
+  if (r->map)
+    munmap(r->map, r->map_size);
+  memset(r, 0, sizeof(hyb_traj_reader));
+}
+
+const hyb_float *hyb_traj_column(const hyb_traj_reader *r, size_t col, uint64_t i, size_t *count) {
+  if (i >= r->records || col >= r->x_size + r->y_size + 2)
+    return NULL;
+  const size_t offset = (size_t)(i % r->chunk_len);
+  if (count) {
+    const uint64_t left = r->records - i;
+    *count = (left < r->chunk_len - offset) ? (size_t)left : r->chunk_len - offset;
+  }
+  return &r->data[(i / r->chunk_len) * r->chunk_len * (r->x_size + r->y_size + 2) + col * r->chunk_len + offset];
+}
+
+uint64_t hyb_traj_find(const hyb_traj_reader *r, hyb_float t) {
+  uint64_t a = 0, b = r->records;
+  while (a < b) {
+    const uint64_t c = a + (b - a) / 2;
+    if (hyb_traj_value(r, HYB_TRAJ_T, c) < t)
+      a = c + 1;
+    else
+      b = c;
+  }
+  return a;
+}
+
+uint64_t hyb_traj_jump(const hyb_traj_reader *r, uint64_t k) {
+  return k < r->jumps ? r->jump_idx[k] : r->records;
+}
@@ -0,0 +1,179 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Copyright 2018 - Matteo Ragni, Matteo Cocetti - University of Trento
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+
+#ifndef LIBHYBRID_TRAJ_H_
+#define LIBHYBRID_TRAJ_H_
+
+/**
+ * @file libhybrid_traj.h
+ * @author Matteo Ragni, Matteo Cocetti
+ *
+ * Streaming storage of trajectories on file. The writer appends samples
+ * (t, j, x, y) to a binary file organized in chunks of a fixed number of
+ * records: inside a chunk the data is columnar, thus each quantity (flow
+ * time, jump time, each state, each output) is a contiguous array. The file
+ * layout is:
+ *  * a header of HYB_TRAJ_HEADER bytes, with sizes and counters;
+ *  * the chunks, each of chunk_len * (x_size + y_size + 2) hyb_float (the
+ *    last one is padded);
+ *  * the jump index: the record index of each sample produced by a jump,
+ *    as uint64_t.
+ *
+ * The writer keeps in memory only the current chunk and the jump index, and
+ * it can be used as the sink of a trajectory (hyb_traj_sink), so a whole
+ * horizon is persisted without storing it in memory. The reader maps the file
+ * in memory: columns are accessed in place, without loading or parsing the
+ * whole run. Files are in the native byte order and precision, and they are
+ * complete only once the writer is closed. POSIX only (mmap).
+ */
+
+#include "libhybrid.h"
+#include <stdio.h>
+#include <stdint.h>
+
+#define HYB_TRAJ_HEADER 64      /**< Size of the file header, in bytes */
+#define HYB_TRAJ_VERSION 1      /**< Version of the file format */
+#define HYB_TRAJ_CHUNK 4096     /**< Default number of records per chunk */
+#define HYB_TRAJ_T 0            /**< Column of the flow time */
+#define HYB_TRAJ_J 1            /**< Column of the jump time */
+#define HYB_TRAJ_X(i) (2 + (i)) /**< Column of the i-th state */
+#define HYB_TRAJ_Y(r, i) (2 + (r)->x_size + (i)) /**< Column of the i-th output, for a writer or reader r */
+
+/**
+ * @brief Trajectory file writer
+ */
+typedef struct hyb_traj_writer {
+  FILE *file;          /**< Output file */
+  size_t x_size;       /**< State size */
+  size_t y_size;       /**< Output size */
+  size_t chunk_len;    /**< Records per chunk */
+  size_t fill;         /**< Records in the current chunk */
+  uint64_t records;    /**< Records written */
+  uint64_t chunks;     /**< Chunks written to the file */
+  hyb_float *chunk;    /**< Current chunk, columnar */
+  uint64_t *jumps;     /**< Jump index */
+  size_t jumps_len;    /**< Number of jumps */
+  size_t jumps_cap;    /**< Capacity of the jump index */
+} hyb_traj_writer;
+
+/**
+ * @brief Creates a trajectory file
+ * @param w the writer to initialize
+ * @param path path of the file (overwritten if it exists)
+ * @param opts option structure of the model (for the sizes)
+ * @param chunk_len records per chunk, 0 for HYB_TRAJ_CHUNK. It is rounded up
+ *        so that each column fills whole cache lines
+ * @return HYB_SUCCESS, HYB_NULLPTR, HYB_EMALLOC or HYB_IO
+ */
+hyb_errorcode hyb_traj_open(hyb_traj_writer *w, const char *path, const hyb_opts *opts, size_t chunk_len);
+
+/**
+ * @brief Appends a record
+ * @param w the writer
+ * @param x augmented state (flow time, jump time, state)
+ * @param y output (NULL stores zeros)
+ * @param jumped hyb_true if the record is produced by a jump step
+ * @return HYB_SUCCESS, HYB_EMALLOC or HYB_IO
+ */
+hyb_errorcode hyb_traj_write(hyb_traj_writer *w, const hyb_float *x, const hyb_float *y, hyb_bool jumped);
+
+/**
+ * @brief Trajectory sink that appends each sample to the writer in data
+ *
+ * Set it as hyb_trajectory::sink, with a pointer to an open hyb_traj_writer
+ * as hyb_trajectory::data.
+ */
+hyb_errorcode hyb_traj_sink(const hyb_float *x, const hyb_float *y, hyb_bool jumped, void *data);
+
+/**
+ * @brief Flushes the last chunk, writes the jump index and the header, and closes the file
+ * @param w the writer (released in any case)
+ * @return HYB_SUCCESS, HYB_NULLPTR or HYB_IO
+ */
+hyb_errorcode hyb_traj_close(hyb_traj_writer *w);
+
+/**
+ * @brief Memory mapped trajectory file
+ */
+typedef struct hyb_traj_reader {
+  void *map;                /**< Mapped file */
+  size_t map_size;          /**< Size of the mapping */
+  size_t x_size;            /**< State size */
+  size_t y_size;            /**< Output size */
+  size_t chunk_len;         /**< Records per chunk */
+  uint64_t records;         /**< Number of records */
+  uint64_t jumps;           /**< Number of jumps */
+  const hyb_float *data;    /**< First chunk */
+  const uint64_t *jump_idx; /**< Jump index */
+} hyb_traj_reader;
+
+/**
+ * @brief Maps a trajectory file in memory
+ * @param r the reader to initialize
+ * @param path path of the file
+ * @return HYB_SUCCESS, HYB_NULLPTR, or HYB_IO if the file cannot be mapped,
+ *         is not a complete trajectory file or uses a different precision
+ */
+hyb_errorcode hyb_traj_map(hyb_traj_reader *r, const char *path);
+
+/**
+ * @brief Unmaps a trajectory file
+ * @param r the reader to release
+ */
+void hyb_traj_unmap(hyb_traj_reader *r);
+
+/**
+ * @brief Returns a column from record i, in place
+ *
+ * The values are contiguous up to the end of the chunk that contains the
+ * record: count receives their number (the following ones start at record
+ * i + count).
+ * @param r the reader
+ * @param col column (HYB_TRAJ_T, HYB_TRAJ_J, HYB_TRAJ_X(k), HYB_TRAJ_Y(r, k))
+ * @param i record index
+ * @param count number of contiguous values (output, may be NULL)
+ * @return pointer to the value of record i, NULL if out of range
+ */
+const hyb_float *hyb_traj_column(const hyb_traj_reader *r, size_t col, uint64_t i, size_t *count);
+
+/**
+ * @brief Value of a column at record i (no range checks)
+ */
+static inline hyb_float hyb_traj_value(const hyb_traj_reader *r, size_t col, uint64_t i) {
+  const size_t cols = r->x_size + r->y_size + 2;
+  return r->data[(i / r->chunk_len) * r->chunk_len * cols + col * r->chunk_len + i % r->chunk_len];
+}
+
+/**
+ * @brief First record with flow time greater or equal to t (binary search)
+ * @return the record index, r->records if there is none
+ */
+uint64_t hyb_traj_find(const hyb_traj_reader *r, hyb_float t);
+
+/**
+ * @brief Record produced by the k-th jump (the state right after the jump)
+ * @return the record index, r->records if k is out of range
+ */
+uint64_t hyb_traj_jump(const hyb_traj_reader *r, uint64_t k);
+
+#endif /* LIBHYBRID_TRAJ_H_ */
@@ -32,8 +32,20 @@
 #ifdef MATLAB_WRAPPER
 
 #include "libhybrid.h"
+#include "libhybrid_model.h"
 #include "mex.h"
+#include <string.h>
 
+#ifdef HYB_MODEL_EXTERN
+/**
+ * @brief Option structure of a model compiled separately
+ *
+ * Defining HYB_MODEL_EXTERN the model is not included in the wrapper, but it
+ * is linked as a separate compilation unit (for example a C++ model that
+ * uses libhybrid.hpp) that defines the hyb_opts structure "options".
+ */
+extern hyb_opts options;
+#else
 #ifndef HYB_MODEL_SOURCE
 /**
  * @brief Name of the model to wrap
@@ -49,6 +61,7 @@
 #define HYB_MODEL_SOURCE "model.c"
 #endif
 #include HYB_MODEL_SOURCE
+#endif
 
 /**
  * @brief MATLAB System Identification wrapper and common wrapper are different
@@ -73,6 +86,33 @@
 #define inline __inline /**< For compatibility with Microsoft Compiler */
 #endif
 
+/**
+ * @brief Parameter estimation in the mex function
+ *
+ * The 'estimate' command runs the multiple shooting estimator on the thread
+ * pool of libhybrid_parallel.c, that requires POSIX threads: define
+ * HYB_MEX_ESTIMATE and link libhybrid_estim.c and libhybrid_parallel.c (with
+ * -lpthread) to enable it. Without it the command raises an error, and the
+ * wrapper builds also where POSIX threads are not available (MSVC).
+ */
+// #define HYB_MEX_ESTIMATE
+
+#ifdef HYB_MEX_ESTIMATE
+#include "libhybrid_estim.h"
+#endif
+
+/**
+ * @brief Sizes of the input and of the parameters of the model
+ *
+ * The option structure does not carry them: define HYB_MODEL_U_SIZE (number
+ * of inputs) and HYB_MODEL_P_SIZE (brace list with the number of elements of
+ * each parameter array, e.g. { 1, 3 }), in the model source or on the command
+ * line, to have the input of 'step' and the parameters of 'create' checked
+ * before the model reads them. Without them the arrays are passed as they are.
+ */
+// #define HYB_MODEL_U_SIZE 1
+// #define HYB_MODEL_P_SIZE { 1, 3 }
+
 /**
  * @brief handler for errors from hyb_main_loop function
  *
@@ -106,6 +146,26 @@ inline void error_message(hyb_errorcode c) {
     mexErrMsgIdAndTxt("LIBHYBRID:Model:InvalidSet",
      "Invalid set conditions provided");
     break;
+  case HYB_BUFFER:
+    mexErrMsgIdAndTxt("LIBHYBRID:Model:BufferFull",
+     "Trajectory buffer exhausted before reaching an horizon");
+    break;
+  case HYB_STEPSIZE:
+    mexErrMsgIdAndTxt("LIBHYBRID:Model:StepSize",
+     "Step length underflow in the adaptive integrator");
+    break;
+  case HYB_SINGULAR:
+    mexErrMsgIdAndTxt("LIBHYBRID:Model:Singular",
+     "Singular iteration matrix in the implicit integrator");
+    break;
+  case HYB_IO:
+    mexErrMsgIdAndTxt("LIBHYBRID:Model:IO",
+     "Input / output error on a trajectory file");
+    break;
+  case HYB_ABORT:
+    mexErrMsgIdAndTxt("LIBHYBRID:Model:Abort",
+     "Simulation stopped by a cost bound");
+    break;
   default:
     mexErrMsgIdAndTxt("LIBHYBRID:Model:GenericError",
      "An unknown error was raised");
@@ -114,6 +174,499 @@ inline void error_message(hyb_errorcode c) {
 }
 
 
+#ifndef HYB_MEX_INSTANCES
+#define HYB_MEX_INSTANCES 64 /**< Maximum number of model instances held by the mex function */
+#endif
+
+/**
+ * @brief Workspace of the model, kept across calls of the mex function
+ */
+static hyb_workspace workspace;
+static hyb_bool workspace_ready = hyb_false; /**< hyb_true once the workspace is initialized */
+
+/**
+ * @brief Registry of the model instances, addressed by handle (index + 1)
+ */
+static hyb_model *instances[HYB_MEX_INSTANCES];
+
+/**
+ * @brief Releases the workspace and all the instances when the mex function is cleared
+ */
+static void workspace_release(void) {
+  size_t i;
+  if (workspace_ready)
+    hyb_workspace_free(&workspace);
+  workspace_ready = hyb_false;
+  for (i = 0; i < HYB_MEX_INSTANCES; i++) {
+    hyb_model_destroy(instances[i]);
+    instances[i] = NULL;
+  }
+}
+
+/**
+ * @brief Initializes the workspace at the first call of the mex function
+ */
+static void workspace_acquire(void) {
+  if (workspace_ready)
+    return;
+  error_message(hyb_workspace_init(&workspace, &options));
+  workspace_ready = hyb_true;
+  mexAtExit(workspace_release);
+}
+
+/**
+ * @brief Returns the registry slot addressed by a handle, raising an error if it is not valid
+ */
+static size_t instance_slot(const mxArray *h) {
+  double v = (h && mxGetNumberOfElements(h) == 1 && !mxIsChar(h)) ? mxGetScalar(h) : 0.0;
+  if (!(v >= 1.0 && v <= HYB_MEX_INSTANCES) || v != (double)(size_t) v || !instances[(size_t) v - 1]) {
+    mexErrMsgIdAndTxt("LIBHYBRID:Model:InvalidHandle",
+    "Invalid model instance handle");
+  }
+  return (size_t) v - 1;
+}
+
+/**
+ * @brief Returns the runtime statistics of the workspace as a MATLAB struct
+ *
+ * The struct contains the counters of hyb_stats of the workspace ws. The fields calls and ticks
+ * are 1 x 8 vectors, ordered as hyb_callback: F, J, Y, D, C, G, fused, Fx. Without
+ * HYB_STATS the statistics are not collected, and requesting them is an error.
+ */
+static mxArray *stats_struct(const hyb_workspace *ws) {
+#ifdef HYB_STATS
+  static const char *fields[] = { "flow_steps", "jumps", "events", "rejected", "failed",
+                                  "jacobians", "factorizations", "max_jump_chain", "calls", "ticks" };
+  hyb_stats stats;
+  mxArray *s = mxCreateStructMatrix(1, 1, sizeof(fields) / sizeof(fields[0]), fields);
+  mxArray *calls = mxCreateDoubleMatrix(1, HYB_CB_SIZE, mxREAL);
+  mxArray *ticks = mxCreateDoubleMatrix(1, HYB_CB_SIZE, mxREAL);
+
+  hyb_stats_get(ws, &stats);
+  mxSetField(s, 0, "flow_steps", mxCreateDoubleScalar((double) stats.flow_steps));
+  mxSetField(s, 0, "jumps", mxCreateDoubleScalar((double) stats.jumps));
+  mxSetField(s, 0, "events", mxCreateDoubleScalar((double) stats.events));
+  mxSetField(s, 0, "rejected", mxCreateDoubleScalar((double) stats.rejected));
+  mxSetField(s, 0, "failed", mxCreateDoubleScalar((double) stats.failed));
+  mxSetField(s, 0, "jacobians", mxCreateDoubleScalar((double) stats.jacobians));
+  mxSetField(s, 0, "factorizations", mxCreateDoubleScalar((double) stats.factorizations));
+  mxSetField(s, 0, "max_jump_chain", mxCreateDoubleScalar((double) stats.max_jump_chain));
+  for (size_t i = 0; i < HYB_CB_SIZE; i++) {
+    mxGetPr(calls)[i] = (double) stats.calls[i];
+    mxGetPr(ticks)[i] = (double) stats.ticks[i];
+  }
+  mxSetField(s, 0, "calls", calls);
+  mxSetField(s, 0, "ticks", ticks);
+  return s;
+#else
+  mexErrMsgIdAndTxt("LIBHYBRID:Model:NoStats",
+  "Statistics are not available: compile the model with -DHYB_STATS");
+  return NULL;
+#endif
+}
+
+/**
+ * @brief Simulates whole experiments in a single call
+ *
+ * Called as:
+ * @code
+ * [X, Y] = model('experiment', t, X0, U, p1, p2, ...)
+ * [X, Y, stats] = model('experiment', t, X0, U, p1, p2, ...)
+ * @endcode
+ * where t is the vector of the N sample times, X0 the initial (augmented)
+ * state and U the nu x N input matrix (one column per sample, i.e. the
+ * transpose of the InputData of an iddata). The result X is the
+ * (x_size + 2) x N matrix of the states at the sample times and Y the
+ * y_size x N matrix of the outputs. Each sample is advanced as in the System
+ * Identification wrapper (jumps are absorbed, see hyb_sample_step), with the
+ * sample length taken from the sample times, thus the sampling may also be
+ * non uniform.
+ *
+ * Multiple experiments are passed as cell arrays for t and U, with X0 holding
+ * one initial state per column: X and Y are then cell arrays too. The outputs
+ * are allocated once, and the states are written directly in the output
+ * matrices, so there are no allocations per sample. The optional third output
+ * contains the runtime statistics of the call (see stats_struct).
+ *
+ * The inputs prhs are t, X0 and U, while the model is given through opts, ws
+ * and p: either the model of the mex function or an instance (see instance).
+ */
+static void experiment_run(hyb_opts *opts, hyb_workspace *ws, const double **p,
+                           int nlhs, mxArray *plhs[], const mxArray *prhs[]) {
+  const size_t nx = opts->x_size + 2;
+  mxArray *X, *Y;
+  const mxArray *t_e, *u_e;
+  size_t ne, e, k, n, nu;
+  hyb_bool is_cell;
+
+  is_cell = mxIsCell(prhs[0]) ? hyb_true : hyb_false;
+  ne = is_cell ? mxGetNumberOfElements(prhs[0]) : 1;
+  if (mxGetM(prhs[1]) != nx || mxGetN(prhs[1]) != ne) {
+    mexErrMsgIdAndTxt("LIBHYBRID:Model:InvalidSyntax",
+    "The initial states should be a %d x %d matrix", (int) nx, (int) ne);
+  }
+  if (is_cell != (mxIsCell(prhs[2]) ? hyb_true : hyb_false) ||
+      (is_cell && mxGetNumberOfElements(prhs[2]) != ne)) {
+    mexErrMsgIdAndTxt("LIBHYBRID:Model:InvalidSyntax",
+    "Sample times and inputs should describe the same experiments");
+  }
+
+  if (is_cell) {
+    plhs[0] = mxCreateCellMatrix(1, ne);
+    plhs[1] = mxCreateCellMatrix(1, ne);
+  }
+
+  hyb_stats_reset(ws);
+
+  for (e = 0; e < ne; e++) {
+    t_e = is_cell ? mxGetCell(prhs[0], e) : prhs[0];
+    u_e = is_cell ? mxGetCell(prhs[2], e) : prhs[2];
+    if (!t_e || !u_e) {
+      mexErrMsgIdAndTxt("LIBHYBRID:Model:InvalidSyntax",
+      "Empty cell for experiment %d", (int) e + 1);
+    }
+    n = mxGetNumberOfElements(t_e);
+    nu = mxGetM(u_e);
+    if (nu > 0 && mxGetN(u_e) != n) {
+      mexErrMsgIdAndTxt("LIBHYBRID:Model:InvalidSyntax",
+      "The inputs of experiment %d should have %d columns", (int) e + 1, (int) n);
+    }
+
+    X = mxCreateDoubleMatrix(nx, n, mxREAL);
+    Y = mxCreateDoubleMatrix(opts->y_size, n, mxREAL);
+    if (is_cell) {
+      mxSetCell(plhs[0], e, X);
+      mxSetCell(plhs[1], e, Y);
+    } else {
+      plhs[0] = X;
+      plhs[1] = Y;
+    }
+
+    const double *t = mxGetPr(t_e);
+    const double *u = nu > 0 ? mxGetPr(u_e) : NULL;
+    double *x = mxGetPr(X);
+    double *y = mxGetPr(Y);
+    if (n == 0)
+      continue;
+
+    for (k = 0; k < nx; k++)
+      x[k] = mxGetPr(prhs[1])[e * nx + k];
+    for (k = 0; k + 1 < n; k++) {
+      error_message(hyb_sample_step(opts, ws, y + k * opts->y_size, x + (k + 1) * nx, x + k * nx,
+                                    u ? u + k * nu : NULL, p, t[k+1] - t[k]));
+    }
+    /* The last output closes the record: the state is advanced in the
+       workspace buffer xb and then discarded */
+    error_message(hyb_sample_step(opts, ws, y + k * opts->y_size, ws->xb, x + k * nx,
+                                  u ? u + k * nu : NULL, p, opts->Ts));
+  }
+  if (nlhs > 2)
+    plhs[2] = stats_struct(ws);
+}
+
+/**
+ * @brief Simulates whole experiments with the model of the mex function (see experiment_run)
+ */
+static void experiment(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+  const double **p;
+  int i, np;
+
+  if (nrhs < 3) {
+    mexErrMsgIdAndTxt("LIBHYBRID:Model:InvalidSyntax",
+    "At least 3 inputs expected for experiment (t, x0, u).");
+  }
+  np = nrhs - 3;
+
+  p = mxCalloc(np, sizeof(double*));
+  for (i = 0; i < np; i++)
+    p[i] = mxGetPr(prhs[3+i]); /* Parameter arrays. */
+
+  workspace_acquire();
+  experiment_run(&options, &workspace, p, nlhs, plhs, prhs);
+  mxFree((void *) p);
+}
+
+/**
+ * @brief Reads a numeric field of an option struct (def if missing or empty)
+ */
+static double option_field(const mxArray *o, const char *name, double def) {
+  const mxArray *f = (o && mxIsStruct(o)) ? mxGetField(o, 0, name) : NULL;
+  return (f && !mxIsEmpty(f)) ? mxGetScalar(f) : def;
+}
+
+#ifdef HYB_MEX_ESTIMATE
+/**
+ * @brief Reads a mask of the estimation options (NULL if missing or empty)
+ */
+static const hyb_bool *estimate_mask(const mxArray *o, const char *name, size_t n) {
+  const mxArray *f = (o && mxIsStruct(o)) ? mxGetField(o, 0, name) : NULL;
+  hyb_bool *mask;
+  size_t i;
+  if (!f || mxIsEmpty(f))
+    return NULL;
+  if (mxGetNumberOfElements(f) != n) {
+    mexErrMsgIdAndTxt("LIBHYBRID:Model:InvalidSyntax",
+    "The option %s should have %d elements", name, (int) n);
+  }
+  mask = mxCalloc(n, sizeof(hyb_bool));
+  for (i = 0; i < n; i++) {
+    if (mxIsLogical(f))
+      mask[i] = mxGetLogicals(f)[i] ? hyb_true : hyb_false;
+    else
+      mask[i] = mxGetPr(f)[i] != 0.0 ? hyb_true : hyb_false;
+  }
+  return mask;
+}
+
+/**
+ * @brief Estimates parameters and initial states through multiple shooting
+ *
+ * Called as:
+ * @code
+ * [P, X0, info] = model('estimate', t, Y, U, X0, opts, p1, p2, ...)
+ * @endcode
+ * where t, U and X0 are as in experiment, and Y is the y_size x N matrix of
+ * the measured outputs (cell arrays for multiple experiments). p1, p2, ...
+ * are the initial guesses of the parameters: P is the cell array of the
+ * estimates, with the same sizes, and X0 the estimated initial states. opts
+ * is a struct with the optional fields segment, max_iter, threads,
+ * continuity, lambda, ftol, xtol, fd_step, free_p (one element per scalar
+ * parameter) and free_x0 (x_size elements), see hyb_estim_opts, or [] for
+ * the defaults. info contains iterations, simulations, cost0, cost and
+ * defect (see hyb_estim_result).
+ */
+static void estimate(int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+  static const char *fields[] = { "iterations", "simulations", "cost0", "cost", "defect" };
+  const size_t nx = options.x_size + 2;
+  const mxArray *opts;
+  hyb_estim_opts eo;
+  hyb_estim_result res;
+  hyb_dataset *data;
+  double **p;
+  size_t *p_size, ne, e, n_scalar;
+  hyb_bool is_cell;
+  int i, np;
+
+  if (nrhs < 5) {
+    mexErrMsgIdAndTxt("LIBHYBRID:Model:InvalidSyntax",
+    "At least 5 inputs expected for estimate (t, y, u, x0, opts).");
+  }
+  np = nrhs - 5;
+  opts = prhs[4];
+
+  is_cell = mxIsCell(prhs[0]) ? hyb_true : hyb_false;
+  ne = is_cell ? mxGetNumberOfElements(prhs[0]) : 1;
+  if (mxGetM(prhs[3]) != nx || mxGetN(prhs[3]) != ne) {
+    mexErrMsgIdAndTxt("LIBHYBRID:Model:InvalidSyntax",
+    "The initial states should be a %d x %d matrix", (int) nx, (int) ne);
+  }
+  for (i = 1; i < 3; i++) {
+    if (is_cell != (mxIsCell(prhs[i]) ? hyb_true : hyb_false) ||
+        (is_cell && mxGetNumberOfElements(prhs[i]) != ne)) {
+      mexErrMsgIdAndTxt("LIBHYBRID:Model:InvalidSyntax",
+      "Sample times, outputs and inputs should describe the same experiments");
+    }
+  }
+
+  /* The estimates are written in place in the copies returned to MATLAB */
+  plhs[0] = mxCreateCellMatrix(1, np);
+  p = mxCalloc(np, sizeof(double*));
+  p_size = mxCalloc(np, sizeof(size_t));
+  n_scalar = 0;
+  for (i = 0; i < np; i++) {
+    mxArray *pi = mxDuplicateArray(prhs[5+i]);
+    mxSetCell(plhs[0], i, pi);
+    p[i] = mxGetPr(pi);
+    p_size[i] = mxGetNumberOfElements(pi);
+    n_scalar += p_size[i];
+  }
+  plhs[1] = mxDuplicateArray(prhs[3]);
+
+  data = mxCalloc(ne, sizeof(hyb_dataset));
+  for (e = 0; e < ne; e++) {
+    const mxArray *t_e = is_cell ? mxGetCell(prhs[0], e) : prhs[0];
+    const mxArray *y_e = is_cell ? mxGetCell(prhs[1], e) : prhs[1];
+    const mxArray *u_e = is_cell ? mxGetCell(prhs[2], e) : prhs[2];
+    size_t n, nu;
+    if (!t_e || !y_e || !u_e) {
+      mexErrMsgIdAndTxt("LIBHYBRID:Model:InvalidSyntax",
+      "Empty cell for experiment %d", (int) e + 1);
+    }
+    n = mxGetNumberOfElements(t_e);
+    nu = mxGetM(u_e);
+    if (mxGetM(y_e) != options.y_size || mxGetN(y_e) != n) {
+      mexErrMsgIdAndTxt("LIBHYBRID:Model:InvalidSyntax",
+      "The outputs of experiment %d should be a %d x %d matrix", (int) e + 1, (int) options.y_size, (int) n);
+    }
+    if (nu > 0 && mxGetN(u_e) != n) {
+      mexErrMsgIdAndTxt("LIBHYBRID:Model:InvalidSyntax",
+      "The inputs of experiment %d should have %d columns", (int) e + 1, (int) n);
+    }
+    data[e].length = n;
+    data[e].t = mxGetPr(t_e);
+    data[e].y = mxGetPr(y_e);
+    data[e].u = nu > 0 ? mxGetPr(u_e) : NULL;
+    data[e].u_stride = nu;
+    data[e].x0 = mxGetPr(plhs[1]) + e * nx;
+  }
+
+  memset(&eo, 0, sizeof(eo));
+  eo.segment = (size_t) option_field(opts, "segment", 0.0);
+  eo.max_iter = (size_t) option_field(opts, "max_iter", 0.0);
+  eo.threads = (size_t) option_field(opts, "threads", 0.0);
+  eo.continuity = option_field(opts, "continuity", 0.0);
+  eo.lambda = option_field(opts, "lambda", 0.0);
+  eo.ftol = option_field(opts, "ftol", 0.0);
+  eo.xtol = option_field(opts, "xtol", 0.0);
+  eo.fd_step = option_field(opts, "fd_step", 0.0);
+  eo.free_p = estimate_mask(opts, "free_p", n_scalar);
+  eo.free_x0 = estimate_mask(opts, "free_x0", options.x_size);
+
+  error_message(hyb_estimate(&options, &eo, data, ne, p, np, p_size, &res));
+
+  if (nlhs > 2) {
+    plhs[2] = mxCreateStructMatrix(1, 1, sizeof(fields) / sizeof(fields[0]), fields);
+    mxSetField(plhs[2], 0, "iterations", mxCreateDoubleScalar((double) res.iterations));
+    mxSetField(plhs[2], 0, "simulations", mxCreateDoubleScalar((double) res.simulations));
+    mxSetField(plhs[2], 0, "cost0", mxCreateDoubleScalar(res.cost0));
+    mxSetField(plhs[2], 0, "cost", mxCreateDoubleScalar(res.cost));
+    mxSetField(plhs[2], 0, "defect", mxCreateDoubleScalar(res.defect));
+  }
+  mxFree((void *) eo.free_p);
+  mxFree((void *) eo.free_x0);
+  mxFree(data);
+  mxFree(p_size);
+  mxFree(p);
+}
+#endif
+
+/**
+ * @brief Manages the model instances held by the mex function
+ *
+ * Called as:
+ * @code
+ * h = model('create', opts, p1, p2, ...)
+ * model('param', h, p1, p2, ...)
+ * [xp, y] = model('step', h, x, u)
+ * [X, Y, stats] = model('simulate', h, t, X0, U)
+ * stats = model('stats', h)
+ * model('destroy', h)
+ * @endcode
+ * An instance owns a copy of the options of the model, its workspace and its
+ * parameters (see hyb_model), and it stays resident until it is destroyed or
+ * the mex function is cleared. opts is a struct with the optional fields Ts,
+ * T_horizon, J_horizon, atol, rtol and h, that override the options of the
+ * model ([] keeps them all), and p1, p2, ... are the initial parameters:
+ * 'param' updates them, with the same sizes. 'step' advances a single sample
+ * as the single sample call, and 'simulate' runs whole experiments as
+ * experiment, with the parameters of the instance.
+ */
+static void instance(const char *command, int nlhs, mxArray *plhs[], int nrhs, const mxArray *prhs[]) {
+  hyb_model *m;
+  size_t *p_size, i, k, slot;
+  int np;
+
+  if (!strcmp(command, "create")) {
+    hyb_opts opts = options;
+    const mxArray *o = nrhs > 0 ? prhs[0] : NULL;
+    for (i = 0; i < HYB_MEX_INSTANCES && instances[i]; i++);
+    if (i == HYB_MEX_INSTANCES) {
+      mexErrMsgIdAndTxt("LIBHYBRID:Model:TooManyInstances",
+      "No free model instances (at most %d)", HYB_MEX_INSTANCES);
+    }
+    opts.Ts = option_field(o, "Ts", opts.Ts);
+    opts.T_horizon = option_field(o, "T_horizon", opts.T_horizon);
+    opts.J_horizon = option_field(o, "J_horizon", opts.J_horizon);
+    opts.atol = option_field(o, "atol", opts.atol);
+    opts.rtol = option_field(o, "rtol", opts.rtol);
+    opts.h = option_field(o, "h", opts.h);
+    np = nrhs > 1 ? nrhs - 1 : 0;
+    #ifdef HYB_MODEL_P_SIZE
+    {
+      static const size_t model_p_size[] = HYB_MODEL_P_SIZE;
+      const size_t model_n_p = sizeof(model_p_size) / sizeof(model_p_size[0]);
+      if ((size_t) np != model_n_p) {
+        mexErrMsgIdAndTxt("LIBHYBRID:Model:InvalidSyntax",
+        "The model has %d parameters", (int) model_n_p);
+      }
+      for (k = 0; k < model_n_p; k++) {
+        if (mxGetNumberOfElements(prhs[1+k]) != model_p_size[k]) {
+          mexErrMsgIdAndTxt("LIBHYBRID:Model:InvalidSyntax",
+          "The parameter %d should have %d elements", (int) k + 1, (int) model_p_size[k]);
+        }
+      }
+    }
+    #endif
+    p_size = mxCalloc(np, sizeof(size_t));
+    for (k = 0; k < (size_t) np; k++)
+      p_size[k] = mxGetNumberOfElements(prhs[1+k]);
+    error_message(hyb_model_create(&m, &opts, np, p_size));
+    for (k = 0; k < (size_t) np; k++)
+      hyb_model_set_param(m, k, mxGetPr(prhs[1+k]));
+    mxFree(p_size);
+    instances[i] = m;
+    mexAtExit(workspace_release);
+    plhs[0] = mxCreateDoubleScalar((double) (i + 1));
+    return;
+  }
+
+  if (nrhs < 1) {
+    mexErrMsgIdAndTxt("LIBHYBRID:Model:InvalidSyntax",
+    "The command '%s' expects a model instance handle", command);
+  }
+  slot = instance_slot(prhs[0]);
+  m = instances[slot];
+  nrhs--;
+  prhs++;
+
+  if (!strcmp(command, "destroy")) {
+    instances[slot] = NULL;
+    hyb_model_destroy(m);
+  } else if (!strcmp(command, "param")) {
+    if ((size_t) nrhs != m->n_p) {
+      mexErrMsgIdAndTxt("LIBHYBRID:Model:InvalidSyntax",
+      "The instance has %d parameters", (int) m->n_p);
+    }
+    for (k = 0; k < m->n_p; k++) {
+      if (mxGetNumberOfElements(prhs[k]) != m->p_size[k]) {
+        mexErrMsgIdAndTxt("LIBHYBRID:Model:InvalidSyntax",
+        "The parameter %d should have %d elements", (int) k + 1, (int) m->p_size[k]);
+      }
+    }
+    for (k = 0; k < m->n_p; k++)
+      hyb_model_set_param(m, k, mxGetPr(prhs[k]));
+  } else if (!strcmp(command, "step")) {
+    if (nrhs < 2 || mxGetNumberOfElements(prhs[0]) != m->opts.x_size + 2) {
+      mexErrMsgIdAndTxt("LIBHYBRID:Model:InvalidSyntax",
+      "The command step expects a state of %d elements and an input", (int) m->opts.x_size + 2);
+    }
+    #ifdef HYB_MODEL_U_SIZE
+    if (mxGetNumberOfElements(prhs[1]) != HYB_MODEL_U_SIZE) {
+      mexErrMsgIdAndTxt("LIBHYBRID:Model:InvalidSyntax",
+      "The input should have %d elements", (int) HYB_MODEL_U_SIZE);
+    }
+    #endif
+    plhs[0] = mxCreateDoubleMatrix(m->opts.x_size + 2, 1, mxREAL);
+    plhs[1] = mxCreateDoubleMatrix(m->opts.y_size, 1, mxREAL);
+    #ifdef MATLAB_SYSTEM_IDENTIFICATION
+      error_message(hyb_model_sample(m, mxGetPr(plhs[1]), mxGetPr(plhs[0]), mxGetPr(prhs[0]),
+                                     mxGetPr(prhs[1]), m->opts.Ts));
+    #else
+      error_message(hyb_model_step(m, mxGetPr(plhs[1]), mxGetPr(plhs[0]), mxGetPr(prhs[0]),
+                                   mxGetPr(prhs[1])));
+    #endif
+  } else if (!strcmp(command, "simulate")) {
+    if (nrhs < 3) {
+      mexErrMsgIdAndTxt("LIBHYBRID:Model:InvalidSyntax",
+      "At least 3 inputs expected for simulate (h, t, x0, u).");
+    }
+    experiment_run(&m->opts, &m->ws, (const double **) m->p, nlhs, plhs, prhs);
+  } else {
+    plhs[0] = stats_struct(&m->ws);
+    hyb_stats_reset(&m->ws);
+  }
+}
+
 /**
  * @brief Entry point for MATLAB Api
  *
@@ -124,14 +677,54 @@ inline void error_message(hyb_errorcode c) {
  * @param plhs pointer for data in the left hand side
  * @param nrhs number of elements in the pointer for the input arguments (rhs = right hand side)
  * @param prhs pointer for input data for the function
+ *
+ * If the first argument is the string 'experiment' the call simulates whole
+ * experiments (see experiment), with 'estimate' it estimates the parameters
+ * (see estimate, only with HYB_MEX_ESTIMATE), the commands 'create',
+ * 'destroy', 'param', 'step' and 'simulate' manage the model instances (see
+ * instance), otherwise the call advances a single sample.
+ * model('stats') returns the statistics accumulated since the mex function
+ * was loaded (or since the last 'stats' call), and resets them. A single
+ * sample call returns the same statistics, without reset, as optional third
+ * output.
  */
 void mexFunction(int nlhs, mxArray *plhs[],
                  int nrhs, const mxArray *prhs[]) {
   /* Declaration of input and output arguments. */
-  double *x, *u, **p, *xp, *y, *sim_time;
+  double *x, *u, **p, *xp, *y;
   int     i, np;
   size_t  nu, nx;
 
+  if (nrhs > 0 && mxIsChar(prhs[0])) {
+    char command[16];
+    if (mxGetString(prhs[0], command, sizeof(command))) {
+      command[0] = '\0';
+    }
+    if (!strcmp(command, "experiment")) {
+      experiment(nlhs, plhs, nrhs - 1, prhs + 1);
+    } else if (!strcmp(command, "estimate")) {
+#ifdef HYB_MEX_ESTIMATE
+      estimate(nlhs, plhs, nrhs - 1, prhs + 1);
+#else
+      mexErrMsgIdAndTxt("LIBHYBRID:Model:NoEstimate",
+      "Estimation is not available: compile the model with -DHYB_MEX_ESTIMATE");
+#endif
+    } else if (!strcmp(command, "stats") && nrhs == 1) {
+      workspace_acquire();
+      plhs[0] = stats_struct(&workspace);
+      hyb_stats_reset(&workspace);
+    } else if (!strcmp(command, "create") || !strcmp(command, "destroy") ||
+               !strcmp(command, "param") || !strcmp(command, "step") ||
+               !strcmp(command, "simulate") || !strcmp(command, "stats")) {
+      instance(command, nlhs, plhs, nrhs - 1, prhs + 1);
+    } else {
+      mexErrMsgIdAndTxt("LIBHYBRID:Model:InvalidSyntax",
+      "Unknown command. Available commands: 'experiment', 'estimate', 'stats', "
+      "'create', 'destroy', 'param', 'step', 'simulate'.");
+    }
+    return;
+  }
+
   if (nrhs < 3) {
       mexErrMsgIdAndTxt("LIBHYBRID:Model:InvalidSyntax",
       "At least 4 inputs expected (t, u, x, p).");
@@ -147,9 +740,15 @@ void mexFunction(int nlhs, mxArray *plhs[],
     mexErrMsgIdAndTxt("LIBHYBRID:Model:InvalidSyntax",
     "The dimension of input 2 should be %d", options.x_size + 2);
   }
+  #ifdef HYB_MODEL_U_SIZE
+  if (nu != HYB_MODEL_U_SIZE) {
+    mexErrMsgIdAndTxt("LIBHYBRID:Model:InvalidSyntax",
+    "The dimension of input 3 should be %d", (int) HYB_MODEL_U_SIZE);
+  }
+  #endif
 
   /* Obtain double data pointers from mxArrays. */
-  sim_time = mxGetPr(prhs[0]);  /* States at time t. */
+  /* The sim time prhs[0] is not used: the flow time is the first state. */
   x = mxGetPr(prhs[1]);  /* States at time t. */
   u = mxGetPr(prhs[2]);  /* Inputs at time t. */
 
@@ -163,29 +762,17 @@ void mexFunction(int nlhs, mxArray *plhs[],
   xp      = mxGetPr(plhs[0]); /* State derivative values. */
   y       = mxGetPr(plhs[1]); /* Output values. */
 
+  workspace_acquire();
+
   #ifdef MATLAB_SYSTEM_IDENTIFICATION
-    double *z = mxCalloc(options.x_size + 2, sizeof(double));
-    hyb_bool is_step = hyb_true;
-    for(size_t i = 0; i < options.x_size + 2; i++)
-        z[i] = x[i];
-
-    while (is_step) {
-      hyb_errorcode ret = hyb_main_loop(&options, y, xp, sim_time[0], z, u, (const double**) p);
-      if (z[1] != xp[1]) {
-        for(size_t i = 0; i < options.x_size + 2; i++)
-          z[i] = xp[i];
-        is_step = hyb_true;
-      } else {
-        is_step = hyb_false;
-      }
-      error_message(ret);
-    }
-    mxFree(z);
+    error_message(hyb_sample_step(&options, &workspace, y, xp, x, u, (const double**) p, options.Ts));
   #else
-    hyb_errorcode ret = hyb_main_loop(&options, y, xp, sim_time[0], x, u, (const double**) p);
+    hyb_errorcode ret = hyb_step(&options, &workspace, y, xp, x, u, (const double**) p);
     error_message(ret);
   #endif
   mxFree(p);
+  if (nlhs > 2)
+    plhs[2] = stats_struct(&workspace);
 }
 
 #endif